@@ -1,603 +1,6646 @@
-
-
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <ctype.h>
-#include <time.h>
-
-// --------------------- Config ---------------------
-#define MAX_PATIENTS   1000
-#define MAX_DOCTORS     300
-#define MAX_APPTS      3000
-#define MAX_MEDS        800
-#define MAX_INVOICES   6000
-
-#define NAME_LEN        64
-#define PHONE_LEN       20
-#define ADDR_LEN       128
-#define SPEC_LEN        64
-#define NOTES_LEN      128
-#define DATE_LEN        11   // YYYY-MM-DD
-#define TIME_LEN         6   // HH:MM
-#define DESC_LEN       128
-#define TYPE_LEN        32
-
-#define DELIM           "|"  // pipe-delimited storage
-
-// --------------------- Models ---------------------
-typedef struct {
-    int id;
-    char name[NAME_LEN];
-    int age;
-    char gender[10];
-    char phone[PHONE_LEN];
-    char address[ADDR_LEN];
-    int admitted;   // 0/1 (kept for future room mgmt)
-    int roomNo;     // -1 if none
-} Patient;
-
-typedef struct {
-    int id;
-    char name[NAME_LEN];
-    char specialization[SPEC_LEN];
-    char phone[PHONE_LEN];
-} Doctor;
-
-typedef struct {
-    int id;
-    int patientId;
-    int doctorId;
-    char date[DATE_LEN];  // YYYY-MM-DD
-    char time[TIME_LEN];  // HH:MM
-    char notes[NOTES_LEN];
-    int canceled;         // 0/1
-} Appointment;
-
-typedef struct {
-    int id;
-    char name[NAME_LEN];
-    int stock;
-    double price; // per unit
-} Medicine;
-
-typedef struct {
-    int id;
-    int patientId;
-    double amount;
-    char description[DESC_LEN];
-    char date[DATE_LEN];
-} Invoice;
-
-// --------------------- Globals ---------------------
-static Patient     g_patients[MAX_PATIENTS];
-static int         g_patientCount = 0;
-static int         g_nextPatientId = 1;
-
-static Doctor      g_doctors[MAX_DOCTORS];
-static int         g_doctorCount = 0;
-static int         g_nextDoctorId = 1;
-
-static Appointment g_appts[MAX_APPTS];
-static int         g_apptCount = 0;
-static int         g_nextApptId = 1;
-
-static Medicine    g_meds[MAX_MEDS];
-static int         g_medCount = 0;
-static int         g_nextMedId = 1;
-
-static Invoice     g_invoices[MAX_INVOICES];
-static int         g_invoiceCount = 0;
-static int         g_nextInvoiceId = 1;
-
-// --------------------- Utils ---------------------
-/* Portable case-insensitive substring search (replacement for strcasestr).
- * Works on Windows/MSVC and POSIX. Returns a pointer into haystack or NULL.
- */
-static const char* strcasestr_portable(const char *haystack, const char *needle){
-    if(!haystack || !needle) return NULL;
-    if(!*needle) return haystack;
-    size_t nlen = strlen(needle);
-    for(const char *p = haystack; *p; ++p){
-        size_t i = 0;
-        while(i < nlen && p[i] &&
-              tolower((unsigned char)p[i]) == tolower((unsigned char)needle[i])){
-            ++i;
-        }
-        if(i == nlen) return p; // found match starting at p
-    }
-    return NULL;
-}
-
-static void trim_newline(char *s){
-    if(!s) return; size_t n=strlen(s); if(n && s[n-1]=='\n') s[n-1]='\0';
-}
-
-static void safe_input(const char* prompt, char *buf, size_t bufsz){
-    printf("%s", prompt); fflush(stdout);
-    if(fgets(buf, (int)bufsz, stdin)==NULL){ buf[0]='\0'; return; }
-    trim_newline(buf);
-}
-
-static int input_int(const char* prompt){
-    char tmp[64];
-    while(1){
-        safe_input(prompt, tmp, sizeof tmp);
-        char *end; long v = strtol(tmp, &end, 10);
-        if(end!=tmp && *end=='\0') return (int)v;
-        puts("  Invalid integer. Try again.");
-    }
-}
-
-static double input_double(const char* prompt){
-    char tmp[64];
-    while(1){
-        safe_input(prompt, tmp, sizeof tmp);
-        char *end; double v = strtod(tmp, &end);
-        if(end!=tmp && *end=='\0') return v;
-        puts("  Invalid number. Try again.");
-    }
-}
-
-static void today(char out[DATE_LEN]){
-    time_t t=time(NULL); struct tm *lt=localtime(&t);
-    strftime(out, DATE_LEN, "%Y-%m-%d", lt);
-}
-
-static void press_enter(){
-    printf("\nPress ENTER to continue..."); fflush(stdout);
-    int c; while((c=getchar())!='\n' && c!=EOF){}
-}
-
-// --------------------- File I/O ---------------------
-
-// Note: We rewrite entire files for simplicity. Strings must not contain '|'.
-// If users enter '|', it will be replaced by '/'.
-static void sanitize_pipes(char *s){
-    for(; *s; ++s) if(*s=='|') *s='/';
-}
-
-static void load_patients(){
-    FILE *f=fopen("patients.db","r");
-    g_patientCount=0; g_nextPatientId=1;
-    if(!f) return;
-    char line[512];
-    while(fgets(line, sizeof line, f)){
-        trim_newline(line);
-        if(!*line) continue;
-        Patient p={0};
-        // id|name|age|gender|phone|address|admitted|roomNo
-        char name[NAME_LEN],gender[10],phone[PHONE_LEN],addr[ADDR_LEN];
-        int id, age, admitted, roomNo;
-        if(sscanf(line, "%d|%63[^|]|%d|%9[^|]|%19[^|]|%127[^|]|%d|%d",
-                  &id, name, &age, gender, phone, addr, &admitted, &roomNo)==8){
-            p.id=id; strncpy(p.name,name,NAME_LEN);
-            p.age=age; strncpy(p.gender,gender,sizeof p.gender);
-            strncpy(p.phone,phone,PHONE_LEN); strncpy(p.address,addr,ADDR_LEN);
-            p.admitted=admitted; p.roomNo=roomNo;
-            if(g_patientCount<MAX_PATIENTS) g_patients[g_patientCount++]=p;
-            if(id>=g_nextPatientId) g_nextPatientId=id+1;
-        }
-    }
-    fclose(f);
-}
-
-static void save_patients(){
-    FILE *f=fopen("patients.db","w"); if(!f){perror("patients.db"); return;}
-    for(int i=0;i<g_patientCount;i++){
-        Patient *p=&g_patients[i];
-        char nm[NAME_LEN]; char ph[PHONE_LEN]; char ad[ADDR_LEN]; char gd[10];
-        strncpy(nm,p->name,NAME_LEN); sanitize_pipes(nm);
-        strncpy(ph,p->phone,PHONE_LEN); sanitize_pipes(ph);
-        strncpy(ad,p->address,ADDR_LEN); sanitize_pipes(ad);
-        strncpy(gd,p->gender,sizeof gd); sanitize_pipes(gd);
-        fprintf(f, "%d|%s|%d|%s|%s|%s|%d|%d\n", p->id, nm, p->age, gd, ph, ad, p->admitted, p->roomNo);
-    }
-    fclose(f);
-}
-
-static void load_doctors(){
-    FILE *f=fopen("doctors.db","r"); g_doctorCount=0; g_nextDoctorId=1; if(!f) return;
-    char line[512];
-    while(fgets(line, sizeof line, f)){
-        trim_newline(line); if(!*line) continue; Doctor d={0};
-        // id|name|spec|phone
-        char name[NAME_LEN], spec[SPEC_LEN], phone[PHONE_LEN]; int id;
-        if(sscanf(line, "%d|%63[^|]|%63[^|]|%19[^|]", &id, name, spec, phone)==4){
-            d.id=id; strncpy(d.name,name,NAME_LEN); strncpy(d.specialization,spec,SPEC_LEN); strncpy(d.phone,phone,PHONE_LEN);
-            if(g_doctorCount<MAX_DOCTORS) g_doctors[g_doctorCount++]=d;
-            if(id>=g_nextDoctorId) g_nextDoctorId=id+1;
-        }
-    }
-    fclose(f);
-}
-
-static void save_doctors(){
-    FILE *f=fopen("doctors.db","w"); if(!f){perror("doctors.db"); return;}
-    for(int i=0;i<g_doctorCount;i++){
-        Doctor *d=&g_doctors[i]; char nm[NAME_LEN]; char sp[SPEC_LEN]; char ph[PHONE_LEN];
-        strncpy(nm,d->name,NAME_LEN); sanitize_pipes(nm);
-        strncpy(sp,d->specialization,SPEC_LEN); sanitize_pipes(sp);
-        strncpy(ph,d->phone,PHONE_LEN); sanitize_pipes(ph);
-        fprintf(f, "%d|%s|%s|%s\n", d->id, nm, sp, ph);
-    }
-    fclose(f);
-}
-
-static void load_appts(){
-    FILE *f=fopen("appointments.db","r"); g_apptCount=0; g_nextApptId=1; if(!f) return;
-    char line[768];
-    while(fgets(line, sizeof line, f)){
-        trim_newline(line); if(!*line) continue; Appointment a={0};
-        // id|patId|docId|date|time|notes|canceled
-        int id, pid, did, canceled; char date[DATE_LEN], tim[TIME_LEN], notes[NOTES_LEN];
-        if(sscanf(line, "%d|%d|%d|%10[^|]|%5[^|]|%127[^|]|%d", &id,&pid,&did,date,tim,notes,&canceled)==7){
-            a.id=id; a.patientId=pid; a.doctorId=did; strncpy(a.date,date,DATE_LEN); strncpy(a.time,tim,TIME_LEN); strncpy(a.notes,notes,NOTES_LEN); a.canceled=canceled;
-            if(g_apptCount<MAX_APPTS) g_appts[g_apptCount++]=a; if(id>=g_nextApptId) g_nextApptId=id+1;
-        }
-    }
-    fclose(f);
-}
-
-static void save_appts(){
-    FILE *f=fopen("appointments.db","w"); if(!f){perror("appointments.db"); return;}
-    for(int i=0;i<g_apptCount;i++){
-        Appointment *a=&g_appts[i]; char nt[NOTES_LEN]; strncpy(nt,a->notes,NOTES_LEN); sanitize_pipes(nt);
-        fprintf(f, "%d|%d|%d|%s|%s|%s|%d\n", a->id, a->patientId, a->doctorId, a->date, a->time, nt, a->canceled);
-    }
-    fclose(f);
-}
-
-static void load_meds(){
-    FILE *f=fopen("medicines.db","r"); g_medCount=0; g_nextMedId=1; if(!f) return;
-    char line[512];
-    while(fgets(line, sizeof line, f)){
-        trim_newline(line); if(!*line) continue; Medicine m={0};
-        // id|name|stock|price
-        int id, stock; char name[NAME_LEN]; double price;
-        if(sscanf(line, "%d|%63[^|]|%d|%lf", &id, name, &stock, &price)==4){
-            m.id=id; strncpy(m.name,name,NAME_LEN); m.stock=stock; m.price=price;
-            if(g_medCount<MAX_MEDS) g_meds[g_medCount++]=m; if(id>=g_nextMedId) g_nextMedId=id+1;
-        }
-    }
-    fclose(f);
-}
-
-static void save_meds(){
-    FILE *f=fopen("medicines.db","w"); if(!f){perror("medicines.db"); return;}
-    for(int i=0;i<g_medCount;i++){
-        Medicine *m=&g_meds[i]; char nm[NAME_LEN]; strncpy(nm,m->name,NAME_LEN); sanitize_pipes(nm);
-        fprintf(f, "%d|%s|%d|%.2f\n", m->id, nm, m->stock, m->price);
-    }
-    fclose(f);
-}
-
-static void load_invoices(){
-    FILE *f=fopen("invoices.db","r"); g_invoiceCount=0; g_nextInvoiceId=1; if(!f) return;
-    char line[768];
-    while(fgets(line, sizeof line, f)){
-        trim_newline(line); if(!*line) continue; Invoice iv={0};
-        // id|patientId|amount|description|date
-        int id, pid; double amt; char desc[DESC_LEN], date[DATE_LEN];
-        if(sscanf(line, "%d|%d|%lf|%127[^|]|%10[^|]", &id,&pid,&amt,desc,date)==5){
-            iv.id=id; iv.patientId=pid; iv.amount=amt; strncpy(iv.description,desc,DESC_LEN); strncpy(iv.date,date,DATE_LEN);
-            if(g_invoiceCount<MAX_INVOICES) g_invoices[g_invoiceCount++]=iv; if(id>=g_nextInvoiceId) g_nextInvoiceId=id+1;
-        }
-    }
-    fclose(f);
-}
-
-static void save_invoices(){
-    FILE *f=fopen("invoices.db","w"); if(!f){perror("invoices.db"); return;}
-    for(int i=0;i<g_invoiceCount;i++){
-        Invoice *iv=&g_invoices[i]; char ds[DESC_LEN]; strncpy(ds,iv->description,DESC_LEN); sanitize_pipes(ds);
-        fprintf(f, "%d|%d|%.2f|%s|%s\n", iv->id, iv->patientId, iv->amount, ds, iv->date);
-    }
-    fclose(f);
-}
-
-// --------------------- Lookups ---------------------
-static Patient* find_patient_by_id(int id){
-    for(int i=0;i<g_patientCount;i++) if(g_patients[i].id==id) return &g_patients[i];
-    return NULL;
-}
-
-static Doctor* find_doctor_by_id(int id){
-    for(int i=0;i<g_doctorCount;i++) if(g_doctors[i].id==id) return &g_doctors[i];
-    return NULL;
-}
-
-static Medicine* find_med_by_id(int id){
-    for(int i=0;i<g_medCount;i++) if(g_meds[i].id==id) return &g_meds[i];
-    return NULL;
-}
-
-// --------------------- Patients ---------------------
-static void list_patients(){
-    printf("\n-- Patients (%d) --\n", g_patientCount);
-    printf("%-5s %-20s %-3s %-7s %-14s %-s\n", "ID","Name","Age","Gender","Phone","Address");
-    for(int i=0;i<g_patientCount;i++){
-        Patient *p=&g_patients[i];
-        printf("%-5d %-20.20s %-3d %-7.7s %-14.14s %-40.40s\n", p->id, p->name, p->age, p->gender, p->phone, p->address);
-    }
-}
-
-static void add_patient(){
-    if(g_patientCount>=MAX_PATIENTS){ puts("Patient capacity reached."); return; }
-    Patient p={0}; p.id=g_nextPatientId++; p.admitted=0; p.roomNo=-1;
-    safe_input("Name: ", p.name, sizeof p.name);
-    p.age = input_int("Age: ");
-    safe_input("Gender (M/F/Other): ", p.gender, sizeof p.gender);
-    safe_input("Phone: ", p.phone, sizeof p.phone);
-    safe_input("Address: ", p.address, sizeof p.address);
-    g_patients[g_patientCount++]=p; save_patients();
-    printf("Added patient with ID %d\n", p.id);
-}
-
-static void edit_patient(){
-    int id=input_int("Enter patient ID to edit: "); Patient *p=find_patient_by_id(id);
-    if(!p){ puts("Not found."); return; }
-    char tmp[8];
-    printf("Editing patient %d (%s). Leave blank to keep.\n", p->id, p->name);
-    char buf[ADDR_LEN];
-    safe_input("Name: ", buf, sizeof buf); if(strlen(buf)) strncpy(p->name,buf,sizeof p->name);
-    safe_input("Age: ", buf, sizeof buf); if(strlen(buf)) p->age=atoi(buf);
-    safe_input("Gender: ", buf, sizeof buf); if(strlen(buf)) strncpy(p->gender,buf,sizeof p->gender);
-    safe_input("Phone: ", buf, sizeof buf); if(strlen(buf)) strncpy(p->phone,buf,sizeof p->phone);
-    safe_input("Address: ", buf, sizeof buf); if(strlen(buf)) strncpy(p->address,buf,sizeof p->address);
-    save_patients(); puts("Updated.");
-}
-
-static void delete_patient(){
-    int id=input_int("Enter patient ID to delete: "); int idx=-1; for(int i=0;i<g_patientCount;i++) if(g_patients[i].id==id){idx=i;break;}
-    if(idx<0){ puts("Not found."); return; }
-    for(int i=idx;i<g_patientCount-1;i++) g_patients[i]=g_patients[i+1];
-    g_patientCount--; save_patients(); puts("Deleted.");
-}
-
-static void search_patient(){
-    char name[NAME_LEN]; safe_input("Enter name (partial ok): ", name, sizeof name);
-    printf("Results for '%s':\n", name);
-    for(int i=0;i<g_patientCount;i++){
-        if(strcasestr_portable(g_patients[i].name, name)){
-            Patient *p=&g_patients[i];
-            printf("  #%d  %s, %d, %s, %s\n", p->id, p->name, p->age, p->gender, p->phone);
-        }
-    }
-}
-
-// --------------------- Doctors ---------------------
-static void list_doctors(){
-    printf("\n-- Doctors (%d) --\n", g_doctorCount);
-    printf("%-5s %-22s %-18s %-14s\n", "ID","Name","Specialization","Phone");
-    for(int i=0;i<g_doctorCount;i++){
-        Doctor *d=&g_doctors[i];
-        printf("%-5d %-22.22s %-18.18s %-14.14s\n", d->id, d->name, d->specialization, d->phone);
-    }
-}
-
-static void add_doctor(){
-    if(g_doctorCount>=MAX_DOCTORS){ puts("Doctor capacity reached."); return; }
-    Doctor d={0}; d.id=g_nextDoctorId++;
-    safe_input("Name: ", d.name, sizeof d.name);
-    safe_input("Specialization: ", d.specialization, sizeof d.specialization);
-    safe_input("Phone: ", d.phone, sizeof d.phone);
-    g_doctors[g_doctorCount++]=d; save_doctors();
-    printf("Added doctor with ID %d\n", d.id);
-}
-
-static void edit_doctor(){
-    int id=input_int("Enter doctor ID to edit: "); Doctor *d=find_doctor_by_id(id);
-    if(!d){ puts("Not found."); return; }
-    char buf[128];
-    printf("Editing doctor %d (%s). Leave blank to keep.\n", d->id, d->name);
-    safe_input("Name: ", buf, sizeof buf); if(strlen(buf)) strncpy(d->name,buf,sizeof d->name);
-    safe_input("Specialization: ", buf, sizeof buf); if(strlen(buf)) strncpy(d->specialization,buf,sizeof d->specialization);
-    safe_input("Phone: ", buf, sizeof buf); if(strlen(buf)) strncpy(d->phone,buf,sizeof d->phone);
-    save_doctors(); puts("Updated.");
-}
-
-static void delete_doctor(){
-    int id=input_int("Enter doctor ID to delete: "); int idx=-1; for(int i=0;i<g_doctorCount;i++) if(g_doctors[i].id==id){idx=i;break;}
-    if(idx<0){ puts("Not found."); return; }
-    for(int i=idx;i<g_doctorCount-1;i++) g_doctors[i]=g_doctors[i+1];
-    g_doctorCount--; save_doctors(); puts("Deleted.");
-}
-
-// --------------------- Appointments ---------------------
-static void list_appts(){
-    printf("\n-- Appointments (%d) --\n", g_apptCount);
-    printf("%-4s %-6s %-6s %-10s %-5s %-s %-s\n", "ID","PatID","DocID","Date","Time","Canceled","Notes");
-    for(int i=0;i<g_apptCount;i++){
-        Appointment *a=&g_appts[i];
-        printf("%-4d %-6d %-6d %-10s %-5s %-7s %-40.40s\n", a->id, a->patientId, a->doctorId, a->date, a->time, a->canceled?"Yes":"No", a->notes);
-    }
-}
-
-static void schedule_appt(){
-    if(g_apptCount>=MAX_APPTS){ puts("Appointment capacity reached."); return; }
-    int pid=input_int("Patient ID: "); if(!find_patient_by_id(pid)){ puts("Invalid patient."); return; }
-    int did=input_int("Doctor ID: "); if(!find_doctor_by_id(did)){ puts("Invalid doctor."); return; }
-    Appointment a={0}; a.id=g_nextApptId++; a.patientId=pid; a.doctorId=did; a.canceled=0;
-    safe_input("Date (YYYY-MM-DD): ", a.date, sizeof a.date);
-    safe_input("Time (HH:MM): ", a.time, sizeof a.time);
-    safe_input("Notes: ", a.notes, sizeof a.notes);
-    g_appts[g_apptCount++]=a; save_appts(); puts("Appointment scheduled.");
-}
-
-static void cancel_appt(){
-    int id=input_int("Appointment ID to cancel: ");
-    for(int i=0;i<g_apptCount;i++) if(g_appts[i].id==id){ g_appts[i].canceled=1; save_appts(); puts("Canceled."); return; }
-    puts("Not found.");
-}
-
-// --------------------- Pharmacy ---------------------
-static void list_meds(){
-    printf("\n-- Medicines (%d) --\n", g_medCount);
-    printf("%-4s %-22s %-8s %-8s\n", "ID","Name","Stock","Price");
-    for(int i=0;i<g_medCount;i++){
-        Medicine *m=&g_meds[i];
-        printf("%-4d %-22.22s %-8d %-8.2f\n", m->id, m->name, m->stock, m->price);
-    }
-}
-
-static void add_med(){
-    if(g_medCount>=MAX_MEDS){ puts("Medicine capacity reached."); return; }
-    Medicine m={0}; m.id=g_nextMedId++;
-    safe_input("Name: ", m.name, sizeof m.name);
-    m.stock = input_int("Initial stock: ");
-    m.price = input_double("Price per unit: ");
-    g_meds[g_medCount++]=m; save_meds(); printf("Added medicine ID %d\n", m.id);
-}
-
-static void restock_med(){
-    int id=input_int("Medicine ID: "); Medicine *m=find_med_by_id(id); if(!m){ puts("Not found."); return; }
-    int qty=input_int("Add quantity: "); if(qty<0){ puts("Invalid."); return; }
-    m->stock += qty; save_meds(); puts("Restocked.");
-}
-
-static void sell_med(){
-    int pid=input_int("Patient ID: "); Patient *p=find_patient_by_id(pid); if(!p){ puts("Invalid patient."); return; }
-    int mid=input_int("Medicine ID: "); Medicine *m=find_med_by_id(mid); if(!m){ puts("Invalid medicine."); return; }
-
-    int qty=input_int("Quantity: "); if(qty<=0){ puts("Invalid quantity."); return; }
-    if(qty>m->stock){ puts("Insufficient stock."); return; }
-    double total = m->price * qty;
-    m->stock -= qty; save_meds();
-
-    // Create invoice
-    if(g_invoiceCount>=MAX_INVOICES){ puts("Invoice capacity reached; sale recorded without invoice."); return; }
-    Invoice iv={0}; iv.id=g_nextInvoiceId++; iv.patientId=pid; iv.amount=total;
-    snprintf(iv.description, sizeof iv.description, "Medicine: %s x %d", m->name, qty);
-    today(iv.date);
-    g_invoices[g_invoiceCount++]=iv; save_invoices();
-    printf("Sold. Invoice #%d Amount: %.2f\n", iv.id, iv.amount);
-}
-
-// --------------------- Billing ---------------------
-static void list_invoices(){
-    printf("\n-- Invoices (%d) --\n", g_invoiceCount);
-    printf("%-4s %-6s %-10s %-s\n", "ID","PatID","Amount","Description");
-    for(int i=0;i<g_invoiceCount;i++){
-        Invoice *iv=&g_invoices[i];
-        printf("%-4d %-6d %-10.2f %-40.40s (%s)\n", iv->id, iv->patientId, iv->amount, iv->description, iv->date);
-    }
-}
-
-static void new_invoice(){
-    if(g_invoiceCount>=MAX_INVOICES){ puts("Invoice capacity reached."); return; }
-    int pid=input_int("Patient ID: "); if(!find_patient_by_id(pid)){ puts("Invalid patient."); return; }
-    double amt=input_double("Amount: ");
-    char desc[DESC_LEN]; safe_input("Description: ", desc, sizeof desc);
-    Invoice iv={0}; iv.id=g_nextInvoiceId++; iv.patientId=pid; iv.amount=amt; strncpy(iv.description,desc,sizeof iv.description); today(iv.date);
-    g_invoices[g_invoiceCount++]=iv; save_invoices(); printf("Invoice created: #%d\n", iv.id);
-}
-
-static void patient_balance(){
-    int pid=input_int("Patient ID: "); if(!find_patient_by_id(pid)){ puts("Invalid patient."); return; }
-    double sum=0.0; for(int i=0;i<g_invoiceCount;i++) if(g_invoices[i].patientId==pid) sum+=g_invoices[i].amount;
-    printf("Total billed to patient %d: %.2f\n", pid, sum);
-}
-
-// --------------------- Menus ---------------------
-static void patients_menu(){
-    while(1){
-        puts("\n[Patients]\n 1) List\n 2) Add\n 3) Edit\n 4) Delete\n 5) Search by name\n 0) Back");
-        int ch=input_int("Choose: ");
-        switch(ch){
-            case 1: list_patients(); press_enter(); break;
-            case 2: add_patient(); press_enter(); break;
-            case 3: edit_patient(); press_enter(); break;
-            case 4: delete_patient(); press_enter(); break;
-            case 5: search_patient(); press_enter(); break;
-            case 0: return;
-            default: puts("Invalid.");
-        }
-    }
-}
-
-static void doctors_menu(){
-    while(1){
-        puts("\n[Doctors]\n 1) List\n 2) Add\n 3) Edit\n 4) Delete\n 0) Back");
-        int ch=input_int("Choose: ");
-        switch(ch){
-            case 1: list_doctors(); press_enter(); break;
-            case 2: add_doctor(); press_enter(); break;
-            case 3: edit_doctor(); press_enter(); break;
-            case 4: delete_doctor(); press_enter(); break;
-            case 0: return;
-            default: puts("Invalid.");
-        }
-    }
-}
-
-static void appts_menu(){
-    while(1){
-        puts("\n[Appointments]\n 1) List\n 2) Schedule\n 3) Cancel\n 0) Back");
-        int ch=input_int("Choose: ");
-        switch(ch){
-            case 1: list_appts(); press_enter(); break;
-            case 2: schedule_appt(); press_enter(); break;
-            case 3: cancel_appt(); press_enter(); break;
-            case 0: return;
-            default: puts("Invalid.");
-        }
-    }
-}
-
-static void pharmacy_menu(){
-    while(1){
-        puts("\n[Pharmacy]\n 1) List medicines\n 2) Add medicine\n 3) Restock medicine\n 4) Sell medicine (creates invoice)\n 0) Back");
-        int ch=input_int("Choose: ");
-        switch(ch){
-            case 1: list_meds(); press_enter(); break;
-            case 2: add_med(); press_enter(); break;
-            case 3: restock_med(); press_enter(); break;
-            case 4: sell_med(); press_enter(); break;
-            case 0: return;
-            default: puts("Invalid.");
-        }
-    }
-}
-
-static void billing_menu(){
-    while(1){
-        puts("\n[Billing]\n 1) List invoices\n 2) New invoice (manual)\n 3) Patient total billed\n 0) Back");
-        int ch=input_int("Choose: ");
-        switch(ch){
-            case 1: list_invoices(); press_enter(); break;
-            case 2: new_invoice(); press_enter(); break;
-            case 3: patient_balance(); press_enter(); break;
-            case 0: return;
-            default: puts("Invalid.");
-        }
-    }
-}
-
-// --------------------- Main ---------------------
-static void load_all(){
-    load_patients();
-    load_doctors();
-    load_appts();
-    load_meds();
-    load_invoices();
-}
-
-int main(void){
-    load_all();
-    puts("\n=== Hospital Management System (C) ===");
-    for(;;){
-        puts("\nMain Menu\n 1) Patients\n 2) Doctors\n 3) Appointments\n 4) Pharmacy\n 5) Billing\n 9) About\n 0) Exit");
-        int ch=input_int("Choose: ");
-        switch(ch){
-            case 1: patients_menu(); break;
-            case 2: doctors_menu(); break;
-            case 3: appts_menu(); break;
-            case 4: pharmacy_menu(); break;
-            case 5: billing_menu(); break;
-            case 9: puts("Simple text-file HMS. Extend as you like. Developed as a learning project."); press_enter(); break;
-            case 0: puts("Goodbye!"); return 0;
-            default: puts("Invalid choice.");
-        }
-    }
-}
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <stddef.h>
+#include <stdarg.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#else
+#include <io.h>
+#endif
+
+// --------------------- Config ---------------------
+#define NAME_LEN        64
+#define PHONE_LEN       20
+#define ADDR_LEN       128
+#define SPEC_LEN        64
+#define NOTES_LEN      128
+#define DATE_LEN        11   // YYYY-MM-DD
+#define TIME_LEN         6   // HH:MM
+#define DESC_LEN       128
+#define TYPE_LEN        32
+#define MONEY_LEN       24   // "-92233720368547758.07"
+
+#define DELIM           "|"  // pipe-delimited storage
+
+// --------------------- Models ---------------------
+/* Records keep dates as day numbers (days since 1970-01-01), times as
+ * minutes after midnight and small enums as bytes; the text files still
+ * hold "YYYY-MM-DD", "HH:MM" and "M"/"F"/"Other", converted at the File I/O
+ * boundary. Fixed-size fields come first, text last. Free-form text
+ * (addresses, notes, descriptions) lives in the string pool; records hold a
+ * Str handle (see Strings).
+ */
+typedef long long Money;     // amounts in cents, so sums stay exact
+typedef unsigned  Str;       // string pool handle, 0 = ""
+
+#define NO_DAY   (-0x7fffffff-1)   // date missing or unreadable
+#define NO_TIME  (-1)
+
+enum { GENDER_UNSET, GENDER_M, GENDER_F, GENDER_OTHER };
+
+typedef struct {
+    int id;
+    int age;
+    int roomNo;                // -1 if none
+    int since;                 // day of the last admission, transfer or discharge, or NO_DAY
+    unsigned char gender;      // GENDER_*
+    unsigned char admitted;    // 0/1, in roomNo (see Wards)
+    unsigned char deleted;     // soft-deleted, kept for the rows that refer to it (see Integrity)
+    Str address;
+    char name[NAME_LEN];
+    char phone[PHONE_LEN];
+} Patient;
+
+typedef struct {
+    int id;
+    unsigned char deleted;     // as Patient.deleted
+    char name[NAME_LEN];
+    char specialization[SPEC_LEN];
+    char phone[PHONE_LEN];
+} Doctor;
+
+typedef struct {
+    int id;
+    int patientId;
+    int doctorId;
+    int day;                   // or NO_DAY
+    short minute;              // or NO_TIME
+    unsigned char canceled;    // 0/1
+    Str notes;
+} Appointment;
+
+typedef struct {
+    int id;
+    char name[NAME_LEN];
+    int stock;         // units on hand, in lots or untracked (see Inventory)
+    int reorderLevel;  // 0 = no reorder alert
+    Money price;  // per unit
+} Medicine;
+
+typedef struct {
+    int id;
+    int medicineId;
+    int expiry;                // day number
+    int qty;                   // units left; 0 once sold out or written off
+} Lot;
+
+typedef struct {
+    int id;
+    int patientId;
+    Money amount;
+    int day;                   // or NO_DAY
+    Str description;
+} Invoice;
+
+// --------------------- Index ---------------------
+/* Open-addressing hash index (linear probing) from a non-negative key, usually
+ * a record id, to the record's slot in its table. Deleted keys leave
+ * tombstones that are dropped whenever the index is rehashed.
+ */
+#define IDX_EMPTY (-1LL)
+#define IDX_TOMB  (-2LL)
+
+typedef struct {
+    long long *keys;
+    int       *vals;
+    int        cap;    // power of two, 0 until first insert
+    int        live;   // keys present
+    int        used;   // keys present + tombstones
+} HashIndex;
+
+static void* xcalloc(size_t n, size_t sz){
+    void *p=calloc(n ? n : 1, sz);
+    if(!p){ fputs("Out of memory.\n", stderr); exit(1); }
+    return p;
+}
+
+static void* xrealloc(void *p, size_t sz){
+    p=realloc(p, sz ? sz : 1);
+    if(!p){ fputs("Out of memory.\n", stderr); exit(1); }
+    return p;
+}
+
+static unsigned idx_hash(long long k){
+    unsigned long long x=(unsigned long long)k*0x9E3779B97F4A7C15ULL;
+    return (unsigned)(x>>32);
+}
+
+static void idx_clear(HashIndex *ix){
+    free(ix->keys); free(ix->vals);
+    ix->keys=NULL; ix->vals=NULL; ix->cap=ix->live=ix->used=0;
+}
+
+static void idx_put(HashIndex *ix, long long key, int val);
+
+static void idx_rehash(HashIndex *ix, int cap){
+    long long *ok=ix->keys; int *ov=ix->vals; int ocap=ix->cap;
+    ix->keys=(long long*)xcalloc(cap, sizeof *ix->keys);
+    ix->vals=(int*)xcalloc(cap, sizeof *ix->vals);
+    for(int i=0;i<cap;i++) ix->keys[i]=IDX_EMPTY;
+    ix->cap=cap; ix->live=ix->used=0;
+    for(int i=0;i<ocap;i++) if(ok[i]>=0) idx_put(ix, ok[i], ov[i]);
+    free(ok); free(ov);
+}
+
+// Returns the value stored for key, or -1.
+static int idx_get(const HashIndex *ix, long long key){
+    if(!ix->cap) return -1;
+    unsigned mask=(unsigned)ix->cap-1;
+    for(unsigned h=idx_hash(key)&mask;; h=(h+1)&mask){
+        if(ix->keys[h]==key) return ix->vals[h];
+        if(ix->keys[h]==IDX_EMPTY) return -1;
+    }
+}
+
+static void idx_put(HashIndex *ix, long long key, int val){
+    if((ix->used+1)*4 > ix->cap*3){
+        int cap=ix->cap ? ix->cap : 64;
+        while((ix->live+1)*2 > cap) cap*=2;   // rehash to <=50% load
+        idx_rehash(ix, cap);
+    }
+    unsigned mask=(unsigned)ix->cap-1; int tomb=-1;
+    for(unsigned h=idx_hash(key)&mask;; h=(h+1)&mask){
+        if(ix->keys[h]==key){ ix->vals[h]=val; return; }
+        if(ix->keys[h]==IDX_TOMB){ if(tomb<0) tomb=(int)h; continue; }
+        if(ix->keys[h]==IDX_EMPTY){
+            if(tomb>=0) h=(unsigned)tomb; else ix->used++;
+            ix->keys[h]=key; ix->vals[h]=val; ix->live++;
+            return;
+        }
+    }
+}
+
+static void idx_del(HashIndex *ix, long long key){
+    if(!ix->cap) return;
+    unsigned mask=(unsigned)ix->cap-1;
+    for(unsigned h=idx_hash(key)&mask;; h=(h+1)&mask){
+        if(ix->keys[h]==key){ ix->keys[h]=IDX_TOMB; ix->live--; return; }
+        if(ix->keys[h]==IDX_EMPTY) return;
+    }
+}
+
+// --------------------- Storage ---------------------
+/* Growable table of fixed-size records, allocated TBL_CHUNK rows at a time.
+ * Chunks never move once allocated, so record pointers (find_*_by_id results)
+ * stay valid while the table grows, and each chunk is a contiguous run of rows
+ * for scans (see tbl_span).
+ *
+ * Every record starts with its int id (always >= 1). Deleting a row just zeroes
+ * that id, leaving a tombstone that scans skip; tbl_compact squeezes them out
+ * once they make up a quarter of the table. Compaction is the only thing that
+ * moves rows, so it only runs at the end of a delete, never under a caller
+ * holding record pointers.
+ *
+ * The first `mapped` chunks may point into a memory-mapped binary snapshot
+ * (see tbl_adopt); those are released with the mapping, not freed one by one.
+ */
+#define TBL_CHUNK_SHIFT  10
+#define TBL_CHUNK        (1<<TBL_CHUNK_SHIFT)
+#define TBL_COMPACT_MIN  256
+#define TABLE_OF(T)      {NULL, 0, 0, 0, 0, sizeof(T), 0, NULL, 0}
+
+typedef struct {
+    char  **chunks;
+    int     nchunks;
+    int     chunkCap;   // capacity of chunks[]
+    int     count;      // rows in use, tombstones included
+    int     dead;       // tombstones awaiting compaction
+    size_t  elem;       // sizeof one record
+    int     mapped;     // leading chunks that live inside map
+    char   *map;        // mapped snapshot backing those chunks, or NULL
+    size_t  mapLen;
+} Table;
+
+// Maps a whole file copy-on-write (or reads it where mmap is unavailable).
+static char* map_file(const char *path, size_t *len){
+#ifdef _WIN32
+    FILE *f=fopen(path,"rb"); if(!f) return NULL;
+    fseek(f, 0, SEEK_END); long n=ftell(f); fseek(f, 0, SEEK_SET);
+    char *p=NULL;
+    if(n>0){ p=(char*)malloc((size_t)n); if(p && fread(p,1,(size_t)n,f)!=(size_t)n){ free(p); p=NULL; } }
+    fclose(f); *len=(size_t)n; return p;
+#else
+    int fd=open(path, O_RDONLY); if(fd<0) return NULL;
+    struct stat st; void *p=MAP_FAILED;
+    if(fstat(fd,&st)==0 && st.st_size>0)
+        p=mmap(NULL, (size_t)st.st_size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(p==MAP_FAILED) return NULL;
+    *len=(size_t)st.st_size; return (char*)p;
+#endif
+}
+
+static void unmap_file(char *p, size_t len){
+#ifdef _WIN32
+    (void)len; free(p);
+#else
+    if(p) munmap(p, len);
+#endif
+}
+
+static void* tbl_at(const Table *t, int i){
+    return t->chunks[i>>TBL_CHUNK_SHIFT] + (size_t)(i&(TBL_CHUNK-1))*t->elem;
+}
+
+// Pointer to row i plus, in *n, how many rows from i on are contiguous.
+static void* tbl_span(const Table *t, int i, int *n){
+    int left=TBL_CHUNK-(i&(TBL_CHUNK-1)), rest=t->count-i;
+    *n = left<rest ? left : rest;
+    return tbl_at(t, i);
+}
+
+// Appends a zeroed row and returns it.
+static void* tbl_push(Table *t){
+    if(t->count==t->nchunks*TBL_CHUNK){
+        if(t->nchunks==t->chunkCap){
+            int cap=t->chunkCap ? t->chunkCap*2 : 8;
+            t->chunks=(char**)xrealloc(t->chunks, cap*sizeof *t->chunks);
+            t->chunkCap=cap;
+        }
+        t->chunks[t->nchunks++]=(char*)xcalloc(TBL_CHUNK, t->elem);
+    }
+    void *row=tbl_at(t, t->count++);
+    memset(row, 0, t->elem);
+    return row;
+}
+
+static void tbl_clear(Table *t){
+    for(int i=t->mapped;i<t->nchunks;i++) free(t->chunks[i]);
+    free(t->chunks);
+    unmap_file(t->map, t->mapLen);
+    t->chunks=NULL; t->nchunks=t->chunkCap=t->count=t->dead=t->mapped=0;
+    t->map=NULL; t->mapLen=0;
+}
+
+static int tbl_live(const Table *t){ return t->count - t->dead; }
+
+static int tbl_alive(const Table *t, int i){ return *(const int*)tbl_at(t, i)!=0; }
+
+static void tbl_kill(Table *t, int i){ *(int*)tbl_at(t, i)=0; t->dead++; }
+
+static int tbl_should_compact(const Table *t){
+    return t->dead>TBL_COMPACT_MIN && t->dead*4>t->count;
+}
+
+// Slides live rows down over tombstones and frees the chunks left empty.
+static void tbl_compact(Table *t){
+    int w=0;
+    for(int r=0;r<t->count;r++){
+        if(!tbl_alive(t, r)) continue;
+        if(w!=r) memcpy(tbl_at(t, w), tbl_at(t, r), t->elem);
+        w++;
+    }
+    t->count=w; t->dead=0;
+    int keep=(w+TBL_CHUNK-1)>>TBL_CHUNK_SHIFT;
+    while(t->nchunks>keep){
+        if(--t->nchunks<t->mapped) t->mapped=t->nchunks; else free(t->chunks[t->nchunks]);
+    }
+}
+
+/* Takes ownership of map and uses its `count` records at recs in place: every
+ * full TBL_CHUNK run becomes a chunk as-is, only the ragged tail is copied so
+ * the table can keep growing. t must be empty.
+ */
+static void tbl_adopt(Table *t, char *map, size_t len, char *recs, int count){
+    int full=count>>TBL_CHUNK_SHIFT;
+    t->chunkCap=full+8;
+    t->chunks=(char**)xcalloc(t->chunkCap, sizeof *t->chunks);
+    for(int k=0;k<full;k++) t->chunks[k]=recs+(size_t)k*TBL_CHUNK*t->elem;
+    t->nchunks=t->mapped=full; t->count=full*TBL_CHUNK;
+    t->map=map; t->mapLen=len;
+    for(int r=t->count;r<count;r++) memcpy(tbl_push(t), recs+(size_t)r*t->elem, t->elem);
+    for(int r=0;r<count;r++) if(!tbl_alive(t, r)) t->dead++;
+}
+
+// --------------------- Strings ---------------------
+/* Pool for variable-length text. A Str is an index into a chunked entry
+ * array whose entries point at NUL-terminated bytes in an arena of
+ * STR_ARENA_CHUNK blocks. str_intern hands out one entry per distinct
+ * string (by a 62-bit hash, compared in full), so repeated text such as
+ * sale descriptions is stored once; 0 stands for "".
+ *
+ * Lifetime: nothing is released explicitly. Records may be copied, edited
+ * and dropped freely; str_gc (see Tables) marks every handle still stored in
+ * a table, recycles the other entries and repacks the arena. It runs with
+ * exclusive access once the pool has doubled since the last collection.
+ * Entries and arena blocks never move between collections, so a pointer from
+ * str_get is good until then; interning is serialized by g_strMu so parallel
+ * loading and concurrent sales can use it.
+ */
+#define STR_CHUNK_SHIFT  12
+#define STR_CHUNK        (1<<STR_CHUNK_SHIFT)
+#define STR_MAX_CHUNKS   (1<<16)
+#define STR_ARENA_CHUNK  (64*1024)
+#define STR_GC_MIN       4096
+
+typedef struct {
+    const char   *p;       // NULL while on the free list
+    long long     key;     // hash, or -1 when not in the intern index
+    unsigned      next;    // free list link
+    unsigned char mark;
+} StrEntry;
+
+static struct {
+    StrEntry  *chunks[STR_MAX_CHUNKS];
+    unsigned   n;          // entries handed out, free ones included (entry 0 unused)
+    unsigned   live;       // entries in use
+    unsigned   liveAtGc;
+    unsigned   freeHead;   // 0 = none
+    HashIndex  index;      // hash -> entry
+    char     **arena;
+    int        narena, arenaCap;
+    size_t     left;       // free bytes in the last arena block
+    size_t     bytes;      // arena bytes in use
+} g_strs = {{NULL}, 1, 0, 0, 0, {NULL, NULL, 0, 0, 0}, NULL, 0, 0, 0, 0};
+
+#ifndef _WIN32
+static pthread_mutex_t g_strMu = PTHREAD_MUTEX_INITIALIZER;
+#define STR_LOCK()   pthread_mutex_lock(&g_strMu)
+#define STR_UNLOCK() pthread_mutex_unlock(&g_strMu)
+#else
+#define STR_LOCK()   ((void)0)
+#define STR_UNLOCK() ((void)0)
+#endif
+
+static StrEntry* str_entry(Str h){ return &g_strs.chunks[h>>STR_CHUNK_SHIFT][h&(STR_CHUNK-1)]; }
+
+static const char* str_get(Str h){ return h ? str_entry(h)->p : ""; }
+
+static long long str_hash(const char *s, size_t len){   // FNV-1a, kept non-negative for HashIndex
+    unsigned long long x=1469598103934665603ULL;
+    for(size_t i=0;i<len;i++){ x^=(unsigned char)s[i]; x*=1099511628211ULL; }
+    return (long long)(x>>2);
+}
+
+static const char* str_copy(const char *s, size_t len){
+    if(len+1>g_strs.left){
+        if(g_strs.narena==g_strs.arenaCap){
+            g_strs.arenaCap = g_strs.arenaCap ? g_strs.arenaCap*2 : 16;
+            g_strs.arena=(char**)xrealloc(g_strs.arena, g_strs.arenaCap*sizeof *g_strs.arena);
+        }
+        g_strs.arena[g_strs.narena++]=(char*)xcalloc(1, STR_ARENA_CHUNK);
+        g_strs.left=STR_ARENA_CHUNK;
+    }
+    char *p=g_strs.arena[g_strs.narena-1]+(STR_ARENA_CHUNK-g_strs.left);
+    memcpy(p, s, len); p[len]='\0';
+    g_strs.left-=len+1; g_strs.bytes+=len+1;
+    return p;
+}
+
+static Str str_new_locked(const char *s, size_t len, long long key){
+    Str h=g_strs.freeHead;
+    if(h) g_strs.freeHead=str_entry(h)->next;
+    else {
+        h=g_strs.n;
+        if((h>>STR_CHUNK_SHIFT)>=STR_MAX_CHUNKS){ fputs("String pool full.\n", stderr); exit(1); }
+        if(!g_strs.chunks[h>>STR_CHUNK_SHIFT]) g_strs.chunks[h>>STR_CHUNK_SHIFT]=(StrEntry*)xcalloc(STR_CHUNK, sizeof(StrEntry));
+        g_strs.n++;
+    }
+    StrEntry *e=str_entry(h);
+    e->p=str_copy(s, len); e->key=key; e->next=0; e->mark=0;
+    g_strs.live++;
+    return h;
+}
+
+// Handle for s, sharing the entry of an equal string; "" is 0.
+static Str str_intern(const char *s){
+    if(!s || !*s) return 0;
+    size_t len=strlen(s); long long key=str_hash(s, len);
+    STR_LOCK();
+    int h=idx_get(&g_strs.index, key);
+    Str r;
+    if(h>0 && !strcmp(str_entry((Str)h)->p, s)) r=(Str)h;
+    else if(h>0) r=str_new_locked(s, len, -1);   // hash collision: keep it out of the index
+    else { r=str_new_locked(s, len, key); idx_put(&g_strs.index, key, (int)r); }
+    STR_UNLOCK();
+    return r;
+}
+
+static void str_mark(Str h){ if(h) str_entry(h)->mark=1; }
+
+// Frees unmarked entries, repacks the arena and clears the marks.
+static void str_sweep(){
+    char **old=g_strs.arena; int nold=g_strs.narena;
+    g_strs.arena=NULL; g_strs.narena=g_strs.arenaCap=0; g_strs.left=g_strs.bytes=0;
+    for(Str h=1;h<g_strs.n;h++){
+        StrEntry *e=str_entry(h); if(!e->p) continue;
+        if(e->mark){ e->p=str_copy(e->p, strlen(e->p)); e->mark=0; continue; }
+        if(e->key>=0) idx_del(&g_strs.index, e->key);
+        e->p=NULL; e->next=g_strs.freeHead; g_strs.freeHead=h; g_strs.live--;
+    }
+    for(int i=0;i<nold;i++) free(old[i]);
+    free(old);
+    g_strs.liveAtGc=g_strs.live;
+}
+
+// --------------------- Globals ---------------------
+static Table       g_patients = TABLE_OF(Patient);
+static int         g_nextPatientId = 1;
+static HashIndex   g_patientIdx;   // id -> slot in g_patients
+
+static Table       g_doctors = TABLE_OF(Doctor);
+static int         g_nextDoctorId = 1;
+static HashIndex   g_doctorIdx;
+
+static Table       g_appts = TABLE_OF(Appointment);
+static int         g_nextApptId = 1;
+static HashIndex   g_apptIdx;
+
+static Table       g_meds = TABLE_OF(Medicine);
+static int         g_nextMedId = 1;
+static HashIndex   g_medIdx;
+
+static Table       g_invoices = TABLE_OF(Invoice);
+static int         g_nextInvoiceId = 1;
+static HashIndex   g_invoiceIdx;
+
+static Table       g_lots = TABLE_OF(Lot);
+static int         g_nextLotId = 1;
+static HashIndex   g_lotIdx;
+
+static Patient*     patient_at(int i){ return (Patient*)tbl_at(&g_patients, i); }
+static Doctor*      doctor_at(int i) { return (Doctor*)tbl_at(&g_doctors, i); }
+static Appointment* appt_at(int i)   { return (Appointment*)tbl_at(&g_appts, i); }
+static Medicine*    med_at(int i)    { return (Medicine*)tbl_at(&g_meds, i); }
+static Invoice*     invoice_at(int i){ return (Invoice*)tbl_at(&g_invoices, i); }
+static Lot*         lot_at(int i)    { return (Lot*)tbl_at(&g_lots, i); }
+
+// --------------------- Utils ---------------------
+/* Portable case-insensitive substring search (replacement for strcasestr).
+ * Works on Windows/MSVC and POSIX. Returns a pointer into haystack or NULL.
+ */
+static const char* strcasestr_portable(const char *haystack, const char *needle){
+    if(!haystack || !needle) return NULL;
+    if(!*needle) return haystack;
+    size_t nlen = strlen(needle);
+    for(const char *p = haystack; *p; ++p){
+        size_t i = 0;
+        while(i < nlen && p[i] &&
+              tolower((unsigned char)p[i]) == tolower((unsigned char)needle[i])){
+            ++i;
+        }
+        if(i == nlen) return p; // found match starting at p
+    }
+    return NULL;
+}
+
+static int strcasecmp_portable(const char *a, const char *b){
+    while(*a && tolower((unsigned char)*a)==tolower((unsigned char)*b)){ a++; b++; }
+    return tolower((unsigned char)*a)-tolower((unsigned char)*b);
+}
+
+static void trim_newline(char *s){
+    if(!s) return; size_t n=strlen(s); if(n && s[n-1]=='\n') s[n-1]='\0';
+}
+
+static void safe_input(const char* prompt, char *buf, size_t bufsz){
+    printf("%s", prompt); fflush(stdout);
+    if(fgets(buf, (int)bufsz, stdin)==NULL){ buf[0]='\0'; return; }
+    trim_newline(buf);
+}
+
+static int input_int(const char* prompt){
+    char tmp[64];
+    while(1){
+        safe_input(prompt, tmp, sizeof tmp);
+        char *end; long v = strtol(tmp, &end, 10);
+        if(end!=tmp && *end=='\0') return (int)v;
+        puts("  Invalid integer. Try again.");
+    }
+}
+
+/* Decimal amount -> cents: at most two decimals are kept and a third rounds
+ * half away from zero. Returns the number of characters consumed (0 if there
+ * are no digits), so callers can check what follows.
+ */
+static int parse_money(const char *s, Money *out){
+    const char *q=s; int neg=0, digits=0; Money v=0;
+    while(*q==' ') q++;
+    if(*q=='-' || *q=='+') neg = *q++=='-';
+    for(; *q>='0' && *q<='9'; q++, digits++) if(v<(Money)1e15) v=v*10+(*q-'0');
+    v*=100;
+    if(*q=='.'){
+        q++;
+        if(*q>='0' && *q<='9'){ v+=(*q++-'0')*10; digits++;
+            if(*q>='0' && *q<='9'){ v+=*q++-'0';
+                if(*q>='5' && *q<='9') v++;
+                while(*q>='0' && *q<='9') q++; } }
+    }
+    if(!digits) return 0;
+    *out = neg ? -v : v;
+    return (int)(q-s);
+}
+
+static const char* fmt_money(Money c, char out[MONEY_LEN]){
+    unsigned long long a = c<0 ? 0ULL-(unsigned long long)c : (unsigned long long)c;
+    snprintf(out, MONEY_LEN, "%s%llu.%02llu", c<0 ? "-" : "", a/100, a%100);
+    return out;
+}
+
+static Money input_money(const char* prompt){
+    char tmp[64];
+    while(1){
+        safe_input(prompt, tmp, sizeof tmp);
+        Money v; int n=parse_money(tmp, &v);
+        if(n && tmp[n]=='\0') return v;
+        puts("  Invalid amount. Try again.");
+    }
+}
+
+static int days_from_civil(int y, int m, int d);
+
+// Concurrent sales call this, so it uses the reentrant localtime.
+static int today_day(){
+    time_t t=time(NULL); struct tm lt;
+#ifdef _WIN32
+    localtime_s(&lt, &t);
+#else
+    localtime_r(&t, &lt);
+#endif
+    return days_from_civil(lt.tm_year+1900, lt.tm_mon+1, lt.tm_mday);
+}
+
+// Days since 1970-01-01 for a proleptic Gregorian date (Hinnant's algorithm).
+static int days_from_civil(int y, int m, int d){
+    y -= m<=2;
+    int era=(y>=0 ? y : y-399)/400;
+    int yoe=y-era*400;
+    int doy=(153*(m+(m>2 ? -3 : 9))+2)/5+d-1;
+    int doe=yoe*365+yoe/4-yoe/100+doy;
+    return era*146097+doe-719468;
+}
+
+static void civil_from_days(int z, int *y, int *m, int *d){
+    z += 719468;
+    int era=(z>=0 ? z : z-146096)/146097;
+    int doe=z-era*146097;
+    int yoe=(doe-doe/1460+doe/36524-doe/146096)/365;
+    int doy=doe-(365*yoe+yoe/4-yoe/100);
+    int mp=(5*doy+2)/153;
+    *d=doy-(153*mp+2)/5+1;
+    *m=mp+(mp<10 ? 3 : -9);
+    *y=yoe+era*400+(*m<=2);
+}
+
+// Strict "YYYY-MM-DD" -> day number; returns 0 if s is not a real date.
+static int parse_date(const char *s, int *day){
+    int y, m, d; char tail;
+    if(strlen(s)!=10 || s[4]!='-' || s[7]!='-' || sscanf(s, "%4d-%2d-%2d%c", &y, &m, &d, &tail)!=3) return 0;
+    if(m<1 || m>12 || d<1) return 0;
+    int days=days_from_civil(y, m, d);
+    int yy, mm, dd; civil_from_days(days, &yy, &mm, &dd);
+    if(mm!=m) return 0;   // e.g. 2026-02-30
+    *day=days; return 1;
+}
+
+// NO_DAY prints as "".
+static void fmt_date(int day, char out[DATE_LEN]){
+    if(day==NO_DAY){ out[0]='\0'; return; }
+    int y, m, d; civil_from_days(day, &y, &m, &d);
+    if(y<0) y=0; else if(y>9999) y=9999;   // parse_date's range; with the %100s, the compiler sees it fits DATE_LEN
+    snprintf(out, DATE_LEN, "%04d-%02u-%02u", y, (unsigned)m%100u, (unsigned)d%100u);
+}
+
+// Strict "HH:MM" -> minutes after midnight; returns 0 if invalid.
+static int parse_time(const char *s, int *minute){
+    if(strlen(s)!=5 || s[2]!=':') return 0;
+    for(int i=0;i<5;i++) if(i!=2 && !isdigit((unsigned char)s[i])) return 0;
+    int h=(s[0]-'0')*10+(s[1]-'0'), mi=(s[3]-'0')*10+(s[4]-'0');
+    if(h>23 || mi>59) return 0;
+    *minute=h*60+mi; return 1;
+}
+
+static void fmt_time(int minute, char out[TIME_LEN]){
+    if(minute<0){ out[0]='\0'; return; }
+    unsigned m=(unsigned)minute%(24*60);
+    snprintf(out, TIME_LEN, "%02u:%02u", m/60, m%60);
+}
+
+// "M"/"Male", "F"/"Female" (any case); anything else non-blank is Other.
+static unsigned char parse_gender(const char *s){
+    while(*s==' ') s++;
+    if(!*s) return GENDER_UNSET;
+    if(!strcasecmp_portable(s, "M") || !strcasecmp_portable(s, "Male")) return GENDER_M;
+    if(!strcasecmp_portable(s, "F") || !strcasecmp_portable(s, "Female")) return GENDER_F;
+    return GENDER_OTHER;
+}
+
+static const char* gender_name(unsigned char g){
+    return g==GENDER_M ? "M" : g==GENDER_F ? "F" : g==GENDER_OTHER ? "Other" : "";
+}
+
+// Monotonic wall clock in seconds, for timing.
+static double now_sec(){
+#ifdef _WIN32
+    return (double)clock()/CLOCKS_PER_SEC;
+#else
+    struct timespec ts; clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec/1e9;
+#endif
+}
+
+static void press_enter(){
+    printf("\nPress ENTER to continue..."); fflush(stdout);
+    int c; while((c=getchar())!='\n' && c!=EOF){}
+}
+
+// --------------------- Instrumentation ---------------------
+/* Per-operation probes: a call count, total time, bytes moved and a latency
+ * histogram for each instrumented operation (loads, saves, journal writes,
+ * lookups, searches, mutations, commands). HMS_STATS=1 turns them on at
+ * start; the Instrumentation menu, the probes command and SIGUSR2 toggle
+ * them at runtime, and SIGUSR1 dumps them to stderr.
+ *
+ * Off, a probe costs one relaxed load and a predicted branch: probe_start
+ * returns 0 and probe_end returns at once. On, it reads the monotonic clock
+ * twice and does a few relaxed atomic adds, so probes are safe from any
+ * thread.
+ *
+ * Histograms are HDR-style: a power-of-two range of nanoseconds split into
+ * 8 linear sub-buckets, so every latency lands in a bucket no more than 12.5%
+ * wide, from 1 ns up to about 18 minutes in 312 counters.
+ */
+#define PROBE_SUB_BITS  3
+#define PROBE_MAX_EXP   40
+#define PROBE_BUCKETS   ((PROBE_MAX_EXP-PROBE_SUB_BITS+2)<<PROBE_SUB_BITS)
+#define PROBE_MAX_CMDS  64
+
+typedef struct {
+    unsigned long long count, totalNs, maxNs, bytes;
+    unsigned long long hist[PROBE_BUCKETS];
+} Probe;
+
+enum {
+    PROBE_LOAD_ALL, PROBE_LOAD_SNAPSHOTS, PROBE_LOAD_REPLAY, PROBE_LOAD_INDEXES,
+    PROBE_SAVE_PATIENTS, PROBE_SAVE_DOCTORS, PROBE_SAVE_APPTS, PROBE_SAVE_MEDS, PROBE_SAVE_INVOICES, PROBE_SAVE_LOTS,
+    PROBE_JNL_APPEND, PROBE_JNL_TXN, PROBE_JNL_FSYNC,
+    PROBE_FIND_PATIENT, PROBE_FIND_DOCTOR, PROBE_FIND_APPT, PROBE_FIND_MED, PROBE_FIND_INVOICE, PROBE_FIND_LOT,
+    PROBE_SEARCH_PATIENTS, PROBE_SEARCH_DOCTORS,
+    PROBE_OP_ADD_PATIENT, PROBE_OP_EDIT_PATIENT, PROBE_OP_DELETE_PATIENT,
+    PROBE_OP_ADD_DOCTOR, PROBE_OP_EDIT_DOCTOR, PROBE_OP_DELETE_DOCTOR,
+    PROBE_OP_SCHEDULE_APPT, PROBE_OP_CANCEL_APPT, PROBE_OP_ADD_MED, PROBE_OP_RESTOCK_MED,
+    PROBE_OP_ADD_INVOICE, PROBE_OP_SELL_MED, PROBE_OP_SET_REORDER, PROBE_OP_WRITEOFF,
+    PROBE_OP_ADMIT, PROBE_OP_TRANSFER, PROBE_OP_DISCHARGE,
+    PROBE_CDC_SNAPSHOT, PROBE_CDC_APPLY, PROBE_CDC_LAG,
+    PROBE_REPORT, PROBE_EXPORT,
+    PROBE_COUNT
+};
+
+static const char *const g_probeNames[PROBE_COUNT]={
+    "load_all", "load.snapshots", "load.replay", "load.indexes",
+    "save.patients", "save.doctors", "save.appts", "save.meds", "save.invoices", "save.lots",
+    "jnl.append", "jnl.txn", "jnl.fsync",
+    "find.patient", "find.doctor", "find.appt", "find.med", "find.invoice", "find.lot",
+    "search.patients", "search.doctors",
+    "op.add_patient", "op.edit_patient", "op.delete_patient",
+    "op.add_doctor", "op.edit_doctor", "op.delete_doctor",
+    "op.schedule_appt", "op.cancel_appt", "op.add_med", "op.restock_med",
+    "op.add_invoice", "op.sell_med", "op.set_reorder", "op.writeoff",
+    "op.admit", "op.transfer", "op.discharge",
+    "cdc.snapshot", "cdc.apply", "cdc.lag",
+    "report", "export",
+};
+
+static Probe       g_probes[PROBE_COUNT];
+static Probe       g_cmdProbes[PROBE_MAX_CMDS];        // one per command, in g_commands order
+static const char *g_cmdProbeNames[PROBE_MAX_CMDS];    // set once at start
+static int         g_probesOn = 0;
+
+static long long now_ns(){
+#ifdef _WIN32
+    return (long long)clock()*(1000000000LL/CLOCKS_PER_SEC)+1;
+#else
+    struct timespec ts; clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec*1000000000LL+ts.tv_nsec+1;   // never 0, which means "off"
+#endif
+}
+
+static long long probe_start(){
+    return __atomic_load_n(&g_probesOn, __ATOMIC_RELAXED) ? now_ns() : 0;
+}
+
+static int probe_bucket(unsigned long long ns){
+    if(ns < (1u<<PROBE_SUB_BITS)) return (int)ns;
+    int e=63-__builtin_clzll(ns);
+    if(e>PROBE_MAX_EXP) return PROBE_BUCKETS-1;
+    return ((e-PROBE_SUB_BITS+1)<<PROBE_SUB_BITS) + (int)((ns>>(e-PROBE_SUB_BITS)) & ((1u<<PROBE_SUB_BITS)-1));
+}
+
+// Largest latency that falls in bucket b.
+static unsigned long long probe_bucket_top(int b){
+    if(b < (1<<PROBE_SUB_BITS)) return (unsigned long long)b;
+    int e=(b>>PROBE_SUB_BITS)+PROBE_SUB_BITS-1;
+    unsigned long long sub=(unsigned long long)(b & ((1<<PROBE_SUB_BITS)-1));
+    return (((1ULL<<PROBE_SUB_BITS)+sub+1)<<(e-PROBE_SUB_BITS))-1;
+}
+
+static void probe_record(Probe *p, long long t0, long long bytes){
+    unsigned long long ns=(unsigned long long)(now_ns()-t0), max=__atomic_load_n(&p->maxNs, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&p->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&p->totalNs, ns, __ATOMIC_RELAXED);
+    if(bytes>0) __atomic_fetch_add(&p->bytes, (unsigned long long)bytes, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&p->hist[probe_bucket(ns)], 1, __ATOMIC_RELAXED);
+    while(ns>max && !__atomic_compare_exchange_n(&p->maxNs, &max, ns, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)){}
+}
+
+// Ends a probe begun with probe_start; bytes <= 0 records no bytes.
+static void probe_end(int id, long long t0, long long bytes){ if(t0) probe_record(&g_probes[id], t0, bytes); }
+
+// As probe_end, with the size of the file at path as the bytes.
+static void probe_end_file(int id, long long t0, const char *path){
+    if(!t0) return;
+    long long t1=now_ns(), bytes=0; FILE *f=fopen(path, "rb");
+    if(f){ if(fseek(f, 0, SEEK_END)==0) bytes=ftell(f); fclose(f); }
+    probe_record(&g_probes[id], t0+(now_ns()-t1), bytes);   // the size check isn't part of the save
+}
+
+static void probe_end_cmd(int i, long long t0){ if(t0 && i>=0 && i<PROBE_MAX_CMDS) probe_record(&g_cmdProbes[i], t0, 0); }
+
+static void probe_clear(Probe *p){
+    __atomic_store_n(&p->count, 0, __ATOMIC_RELAXED); __atomic_store_n(&p->totalNs, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&p->maxNs, 0, __ATOMIC_RELAXED); __atomic_store_n(&p->bytes, 0, __ATOMIC_RELAXED);
+    for(int b=0;b<PROBE_BUCKETS;b++) __atomic_store_n(&p->hist[b], 0, __ATOMIC_RELAXED);
+}
+
+static void probes_reset(){
+    for(int i=0;i<PROBE_COUNT;i++) probe_clear(&g_probes[i]);
+    for(int i=0;i<PROBE_MAX_CMDS;i++) probe_clear(&g_cmdProbes[i]);
+}
+
+typedef struct {
+    unsigned long long count, totalNs, maxNs, bytes;
+    unsigned long long p50, p90, p99, p999;
+} ProbeSummary;
+
+// Reads p without locking (counts may be mid-update by a few calls) and computes its percentiles.
+static void probe_summary(const Probe *p, ProbeSummary *s){
+    s->count=__atomic_load_n(&p->count, __ATOMIC_RELAXED);
+    s->totalNs=__atomic_load_n(&p->totalNs, __ATOMIC_RELAXED);
+    s->maxNs=__atomic_load_n(&p->maxNs, __ATOMIC_RELAXED);
+    s->bytes=__atomic_load_n(&p->bytes, __ATOMIC_RELAXED);
+    unsigned long long n=0, seen=0;
+    for(int b=0;b<PROBE_BUCKETS;b++) n+=__atomic_load_n(&p->hist[b], __ATOMIC_RELAXED);
+    unsigned long long *out[4]={&s->p50, &s->p90, &s->p99, &s->p999};
+    const unsigned per[4]={500, 900, 990, 999};
+    int q=0;
+    for(int b=0;b<PROBE_BUCKETS && q<4;b++){
+        seen+=__atomic_load_n(&p->hist[b], __ATOMIC_RELAXED);
+        while(q<4 && n && seen*1000>=n*per[q]){ unsigned long long top=probe_bucket_top(b); *out[q++] = top<s->maxNs ? top : s->maxNs; }
+    }
+    while(q<4) *out[q++]=s->maxNs;
+}
+
+/* The dump is built by hand into a caller's buffer, without stdio or malloc,
+ * so the SIGUSR1 handler can produce it too.
+ */
+typedef struct { char *p, *end; } DumpBuf;
+
+static void db_str(DumpBuf *d, const char *s){ while(*s && d->p<d->end) *d->p++=*s++; }
+
+static void db_pad(DumpBuf *d, const char *s, int width, int left){
+    int n=(int)strlen(s);
+    if(left) db_str(d, s);
+    for(int i=n;i<width && d->p<d->end;i++) *d->p++=' ';
+    if(!left) db_str(d, s);
+}
+
+// Right-aligned in width; frac digits of v/scale after the point.
+static void db_num(DumpBuf *d, unsigned long long v, unsigned long long scale, int frac, int width){
+    char t[32]; int n=sizeof t; t[--n]='\0';
+    unsigned long long whole=v/scale, rest=v%scale;
+    for(int k=0;k<frac;k++) rest*=10;
+    unsigned long long f=rest/scale;
+    for(int k=0;k<frac;k++){ t[--n]=(char)('0'+f%10); f/=10; }
+    if(frac) t[--n]='.';
+    do t[--n]=(char)('0'+whole%10); while((whole/=10) && n>0);
+    db_pad(d, t+n, width, 0);
+}
+
+static void db_probe(DumpBuf *d, const char *name, const Probe *p){
+    ProbeSummary s; probe_summary(p, &s);
+    if(!s.count) return;
+    db_pad(d, name, 22, 1);
+    db_num(d, s.count, 1, 0, 10); db_num(d, s.totalNs, 1000000, 1, 11);
+    db_num(d, s.totalNs/s.count, 1000, 1, 10);
+    db_num(d, s.p50, 1000, 1, 10); db_num(d, s.p90, 1000, 1, 10); db_num(d, s.p99, 1000, 1, 10);
+    db_num(d, s.p999, 1000, 1, 10); db_num(d, s.maxNs, 1000, 1, 11); db_num(d, s.bytes, 1, 0, 13);
+    db_str(d, "\n");
+}
+
+// Formats every probe that has fired into buf; returns the length.
+static size_t probes_format(char *buf, size_t cap){
+    DumpBuf d={buf, buf+cap-1};
+    db_str(&d, __atomic_load_n(&g_probesOn, __ATOMIC_RELAXED) ? "-- Probes (on) --\n" : "-- Probes (off) --\n");
+    db_str(&d, "probe                      count   total_ms   mean_us    p50_us    p90_us    p99_us  p99.9_us     max_us        bytes\n");
+    for(int i=0;i<PROBE_COUNT;i++) db_probe(&d, g_probeNames[i], &g_probes[i]);
+    for(int i=0;i<PROBE_MAX_CMDS;i++) if(g_cmdProbeNames[i]) db_probe(&d, g_cmdProbeNames[i], &g_cmdProbes[i]);
+    *d.p='\0';
+    return (size_t)(d.p-buf);
+}
+
+#ifndef _WIN32
+static char g_probeDump[32768];
+
+static void on_probe_signal(int sig){
+    int saved=errno;
+    if(sig==SIGUSR2){ __atomic_xor_fetch(&g_probesOn, 1, __ATOMIC_RELAXED); errno=saved; return; }
+    size_t n=probes_format(g_probeDump, sizeof g_probeDump);
+    for(size_t off=0; off<n; ){ ssize_t w=write(2, g_probeDump+off, n-off); if(w<=0) break; off+=(size_t)w; }
+    errno=saved;
+}
+#endif
+
+// Reads HMS_STATS and installs the signal handlers.
+static void probes_start(){
+    const char *env=getenv("HMS_STATS");
+    if(env && *env && strcmp(env, "0")) g_probesOn=1;
+#ifndef _WIN32
+    struct sigaction sa; memset(&sa, 0, sizeof sa);
+    sa.sa_handler=on_probe_signal; sa.sa_flags=SA_RESTART;
+    sigaction(SIGUSR1, &sa, NULL); sigaction(SIGUSR2, &sa, NULL);
+#endif
+}
+
+// --------------------- Ledger ---------------------
+/* Per-patient billing: running balance plus the patient's invoice ids in
+ * creation order, found through g_ledgerIdx (patientId -> g_ledger slot).
+ * push_invoice and invoice updates keep it current, so a balance is O(1) and
+ * a patient's invoices are O(k) instead of a scan over every invoice.
+ */
+typedef struct {
+    Money balance;
+    int   n, cap;
+    int  *invoiceIds;
+} PatientLedger;
+
+static HashIndex      g_ledgerIdx;
+static PatientLedger *g_ledger = NULL;
+static int            g_ledgerCount = 0, g_ledgerCap = 0;
+
+static PatientLedger* ledger_of(int patientId, int create){
+    int i=idx_get(&g_ledgerIdx, patientId);
+    if(i>=0) return &g_ledger[i];
+    if(!create) return NULL;
+    if(g_ledgerCount==g_ledgerCap){
+        g_ledgerCap = g_ledgerCap ? g_ledgerCap*2 : 256;
+        g_ledger=(PatientLedger*)xrealloc(g_ledger, g_ledgerCap*sizeof *g_ledger);
+    }
+    PatientLedger *l=&g_ledger[g_ledgerCount];
+    memset(l, 0, sizeof *l);
+    idx_put(&g_ledgerIdx, patientId, g_ledgerCount++);
+    return l;
+}
+
+static void ledger_add(const Invoice *iv){
+    PatientLedger *l=ledger_of(iv->patientId, 1);
+    if(l->n==l->cap){
+        l->cap = l->cap ? l->cap*2 : 4;
+        l->invoiceIds=(int*)xrealloc(l->invoiceIds, l->cap*sizeof *l->invoiceIds);
+    }
+    l->invoiceIds[l->n++]=iv->id;
+    l->balance+=iv->amount;
+}
+
+static void ledger_remove(const Invoice *iv){
+    PatientLedger *l=ledger_of(iv->patientId, 0); if(!l) return;
+    for(int i=l->n-1;i>=0;i--){
+        if(l->invoiceIds[i]!=iv->id) continue;
+        memmove(l->invoiceIds+i, l->invoiceIds+i+1, (l->n-i-1)*sizeof *l->invoiceIds);
+        l->n--; l->balance-=iv->amount; return;
+    }
+}
+
+static void ledger_clear(){
+    for(int i=0;i<g_ledgerCount;i++) free(g_ledger[i].invoiceIds);
+    g_ledgerCount=0; idx_clear(&g_ledgerIdx);
+}
+
+// --------------------- Columns ---------------------
+/* Column-oriented mirrors of the fields reports aggregate over, so a scan
+ * reads 4-16 bytes per row instead of dragging whole records (and their
+ * description and notes text) through the cache. Element i of every column
+ * belongs to row i of its table. A deleted row stays a tombstone until its
+ * table is compacted, and compacting the invoice or appointment table
+ * refills its columns for the rows' new slots, O(rows) like the compaction.
+ * Deleted rows and canceled appointments are mirrored with day NO_DAY, which
+ * like a missing date falls outside every report range.
+ */
+typedef struct {
+    Money *amount;
+    int   *day, *patientId;
+    int    n, cap;
+} InvoiceColumns;
+
+typedef struct {
+    int   *day, *doctorId;
+    int    n, cap;
+} ApptColumns;
+
+static InvoiceColumns g_invCols;
+static ApptColumns    g_apptCols;
+
+// Grows a column set so slot i exists; new slots are zeroed.
+static void cols_reserve(int i, int *n, int *cap, void **cols[], const size_t sizes[], int ncols){
+    if(i>=*cap){
+        int c = *cap ? *cap : 1024; while(c<=i) c*=2;
+        for(int k=0;k<ncols;k++){
+            *cols[k]=xrealloc(*cols[k], (size_t)c*sizes[k]);
+            memset((char*)*cols[k]+(size_t)*cap*sizes[k], 0, (size_t)(c-*cap)*sizes[k]);
+        }
+        *cap=c;
+    }
+    if(i>=*n) *n=i+1;
+}
+
+static void invcol_set(int i, const Invoice *iv){
+    InvoiceColumns *c=&g_invCols;
+    void **cols[]={(void**)&c->amount, (void**)&c->day, (void**)&c->patientId};
+    const size_t sizes[]={sizeof *c->amount, sizeof *c->day, sizeof *c->patientId};
+    cols_reserve(i, &c->n, &c->cap, cols, sizes, 3);
+    c->amount[i] = iv->id ? iv->amount : 0; c->day[i] = iv->id ? iv->day : NO_DAY; c->patientId[i]=iv->patientId;
+}
+
+static void apptcol_set(int i, const Appointment *a){
+    ApptColumns *c=&g_apptCols;
+    void **cols[]={(void**)&c->day, (void**)&c->doctorId};
+    const size_t sizes[]={sizeof *c->day, sizeof *c->doctorId};
+    cols_reserve(i, &c->n, &c->cap, cols, sizes, 2);
+    c->day[i] = a->canceled || !a->id ? NO_DAY : a->day; c->doctorId[i]=a->doctorId;
+}
+
+// Refill a column set from its table: after loading, and after a compaction moves rows.
+static void rebuild_invoice_columns(void *unused){
+    (void)unused; g_invCols.n=0;
+    for(int i=0;i<g_invoices.count;i++) invcol_set(i, invoice_at(i));
+}
+
+static void rebuild_appt_columns(void *unused){
+    (void)unused; g_apptCols.n=0;
+    for(int i=0;i<g_appts.count;i++) apptcol_set(i, appt_at(i));
+}
+
+// --------------------- References ---------------------
+/* Reverse indexes from a parent to the appointments that point at it:
+ * g_patientAppts (patient -> appointment ids) and g_doctorAppts (doctor ->
+ * appointment ids), each found through its HashIndex like the ledger, which
+ * already serves as the patient -> invoices index. push_appt adds to them;
+ * deleting an appointment leaves its entries behind, and appt_refs drops
+ * them the next time the list is read, so a delete costs O(1) here and
+ * reading a list O(its length).
+ */
+typedef struct {
+    int  n, cap;
+    int *ids;
+} RefList;
+
+typedef struct {
+    HashIndex idx;     // parent id -> slot in lists
+    RefList  *lists;
+    int       count, cap;
+} RefIndex;
+
+static RefIndex g_patientAppts, g_doctorAppts;
+
+static RefList* ref_list(RefIndex *r, int parentId, int create){
+    int i=idx_get(&r->idx, parentId);
+    if(i>=0) return &r->lists[i];
+    if(!create) return NULL;
+    if(r->count==r->cap){
+        r->cap = r->cap ? r->cap*2 : 256;
+        r->lists=(RefList*)xrealloc(r->lists, r->cap*sizeof *r->lists);
+    }
+    RefList *l=&r->lists[r->count];
+    memset(l, 0, sizeof *l);
+    idx_put(&r->idx, parentId, r->count++);
+    return l;
+}
+
+static void ref_add(RefIndex *r, int parentId, int childId){
+    RefList *l=ref_list(r, parentId, 1);
+    if(l->n==l->cap){
+        l->cap = l->cap ? l->cap*2 : 4;
+        l->ids=(int*)xrealloc(l->ids, l->cap*sizeof *l->ids);
+    }
+    l->ids[l->n++]=childId;
+}
+
+static void ref_clear(RefIndex *r){
+    for(int i=0;i<r->count;i++) free(r->lists[i].ids);
+    r->count=0; idx_clear(&r->idx);
+}
+
+// --------------------- Text index ---------------------
+/* Trigram index for case-insensitive substring search. Every run of three
+ * case-folded bytes in an indexed string maps to a posting list of the ids
+ * containing it, kept sorted. A query of three or more characters intersects
+ * the lists of its own trigrams, starting from the shortest, and the caller
+ * confirms each candidate with strcasestr_portable (trigrams may match out of
+ * order). Shorter queries return -1 and the caller scans.
+ */
+#define TRIGRAM_MIN 3
+
+typedef struct {
+    int  n, cap;
+    int *ids;       // ascending
+} Postings;
+
+typedef struct {
+    HashIndex map;      // trigram -> lists slot
+    Postings *lists;
+    int       count, cap;
+} TextIndex;
+
+static TextIndex g_patientNameTix, g_doctorNameTix, g_doctorSpecTix;
+
+static int trigram(const char *s){
+    return tolower((unsigned char)s[0])<<16 | tolower((unsigned char)s[1])<<8 | tolower((unsigned char)s[2]);
+}
+
+static Postings* tix_list(TextIndex *t, int gram, int create){
+    int i=idx_get(&t->map, gram);
+    if(i>=0) return &t->lists[i];
+    if(!create) return NULL;
+    if(t->count==t->cap){
+        t->cap = t->cap ? t->cap*2 : 1024;
+        t->lists=(Postings*)xrealloc(t->lists, t->cap*sizeof *t->lists);
+    }
+    Postings *p=&t->lists[t->count];
+    memset(p, 0, sizeof *p);
+    idx_put(&t->map, gram, t->count++);
+    return p;
+}
+
+// First position whose id is >= id.
+static int post_lower_bound(const Postings *p, int id){
+    int lo=0, hi=p->n;
+    while(lo<hi){ int mid=(lo+hi)/2; if(p->ids[mid]<id) lo=mid+1; else hi=mid; }
+    return lo;
+}
+
+static void tix_add(TextIndex *t, int id, const char *s){
+    for(size_t i=0, n=strlen(s); i+TRIGRAM_MIN<=n; i++){
+        Postings *p=tix_list(t, trigram(s+i), 1);
+        int k=post_lower_bound(p, id);
+        if(k<p->n && p->ids[k]==id) continue;   // trigram repeats within s
+        if(p->n==p->cap){
+            p->cap = p->cap ? p->cap*2 : 4;
+            p->ids=(int*)xrealloc(p->ids, p->cap*sizeof *p->ids);
+        }
+        memmove(p->ids+k+1, p->ids+k, (p->n-k)*sizeof *p->ids);
+        p->ids[k]=id; p->n++;
+    }
+}
+
+static void tix_remove(TextIndex *t, int id, const char *s){
+    for(size_t i=0, n=strlen(s); i+TRIGRAM_MIN<=n; i++){
+        Postings *p=tix_list(t, trigram(s+i), 0); if(!p) continue;
+        int k=post_lower_bound(p, id);
+        if(k>=p->n || p->ids[k]!=id) continue;
+        memmove(p->ids+k, p->ids+k+1, (p->n-k-1)*sizeof *p->ids);
+        p->n--;
+    }
+}
+
+static void tix_clear(TextIndex *t){
+    for(int i=0;i<t->count;i++) free(t->lists[i].ids);
+    t->count=0; idx_clear(&t->map);
+}
+
+/* Candidate ids (ascending) for records whose text may contain needle, in a
+ * malloc'd *out the caller frees. Returns their count, or -1 if needle is too
+ * short for the index.
+ */
+static int tix_search(TextIndex *t, const char *needle, int **out){
+    *out=NULL;
+    int n=(int)strlen(needle)-TRIGRAM_MIN+1; if(n<1) return -1;
+    const Postings **lists=(const Postings**)xcalloc((size_t)n, sizeof *lists);
+    int best=0;
+    for(int i=0;i<n;i++){
+        lists[i]=tix_list(t, trigram(needle+i), 0);
+        if(!lists[i]){ free(lists); return 0; }
+        if(lists[i]->n<lists[best]->n) best=i;
+    }
+    int m=lists[best]->n;
+    int *ids=(int*)xcalloc(m ? (size_t)m : 1, sizeof *ids);
+    memcpy(ids, lists[best]->ids, (size_t)m*sizeof *ids);
+    for(int i=0;i<n && m;i++){
+        if(lists[i]==lists[best]) continue;
+        int kept=0;
+        for(int k=0;k<m;k++){
+            int pos=post_lower_bound(lists[i], ids[k]);
+            if(pos<lists[i]->n && lists[i]->ids[pos]==ids[k]) ids[kept++]=ids[k];
+        }
+        m=kept;
+    }
+    free(lists);
+    *out=ids; return m;
+}
+
+// --------------------- Tables ---------------------
+/* push_* appends a record and indexes it; remove_*_at tombstones a slot. Every
+ * insert and delete goes through these so the id indexes never go stale.
+ */
+// Compacts t and re-points its id index at the rows' new slots.
+static void compact_table(Table *t, HashIndex *ix){
+    tbl_compact(t);
+    idx_clear(ix);
+    for(int i=0;i<t->count;i++) idx_put(ix, *(const int*)tbl_at(t, i), i);
+}
+
+// Collects the string pool: marks the handles stored in live rows, frees the rest.
+static void str_gc(){
+    for(int i=0;i<g_patients.count;i++){ const Patient *p=patient_at(i); if(p->id) str_mark(p->address); }
+    for(int i=0;i<g_appts.count;i++){ const Appointment *a=appt_at(i); if(a->id) str_mark(a->notes); }
+    for(int i=0;i<g_invoices.count;i++){ const Invoice *iv=invoice_at(i); if(iv->id) str_mark(iv->description); }
+    str_sweep();
+}
+
+// Called after writes, with exclusive access and no unsaved handles in hand.
+static void str_maybe_gc(){
+    unsigned grown=g_strs.live-g_strs.liveAtGc;
+    if(grown>STR_GC_MIN && grown>g_strs.liveAtGc) str_gc();
+}
+
+static Patient* push_patient(const Patient *p){
+    Patient *row=(Patient*)tbl_push(&g_patients); *row=*p;
+    idx_put(&g_patientIdx, p->id, g_patients.count-1);
+    if(p->id>=g_nextPatientId) g_nextPatientId=p->id+1;
+    tix_add(&g_patientNameTix, p->id, p->name);
+    return row;
+}
+
+// Replaces a patient in place, re-indexing the name if it changed.
+static void update_patient(Patient *cur, const Patient *p){
+    if(strcmp(cur->name, p->name)!=0){
+        tix_remove(&g_patientNameTix, cur->id, cur->name); tix_add(&g_patientNameTix, p->id, p->name);
+    }
+    *cur=*p;
+}
+
+static void remove_patient_at(int idx){
+    Patient *p=patient_at(idx);
+    tix_remove(&g_patientNameTix, p->id, p->name);
+    idx_del(&g_patientIdx, p->id); tbl_kill(&g_patients, idx);
+    if(tbl_should_compact(&g_patients)) compact_table(&g_patients, &g_patientIdx);
+}
+
+static Doctor* push_doctor(const Doctor *d){
+    Doctor *row=(Doctor*)tbl_push(&g_doctors); *row=*d;
+    idx_put(&g_doctorIdx, d->id, g_doctors.count-1);
+    if(d->id>=g_nextDoctorId) g_nextDoctorId=d->id+1;
+    tix_add(&g_doctorNameTix, d->id, d->name); tix_add(&g_doctorSpecTix, d->id, d->specialization);
+    return row;
+}
+
+static void update_doctor(Doctor *cur, const Doctor *d){
+    if(strcmp(cur->name, d->name)!=0){
+        tix_remove(&g_doctorNameTix, cur->id, cur->name); tix_add(&g_doctorNameTix, d->id, d->name);
+    }
+    if(strcmp(cur->specialization, d->specialization)!=0){
+        tix_remove(&g_doctorSpecTix, cur->id, cur->specialization); tix_add(&g_doctorSpecTix, d->id, d->specialization);
+    }
+    *cur=*d;
+}
+
+static void remove_doctor_at(int idx){
+    Doctor *d=doctor_at(idx);
+    tix_remove(&g_doctorNameTix, d->id, d->name); tix_remove(&g_doctorSpecTix, d->id, d->specialization);
+    idx_del(&g_doctorIdx, d->id); tbl_kill(&g_doctors, idx);
+    if(tbl_should_compact(&g_doctors)) compact_table(&g_doctors, &g_doctorIdx);
+}
+
+static Appointment* push_appt(const Appointment *a){
+    Appointment *row=(Appointment*)tbl_push(&g_appts); *row=*a;
+    idx_put(&g_apptIdx, a->id, g_appts.count-1);
+    if(a->id>=g_nextApptId) g_nextApptId=a->id+1;
+    apptcol_set(g_appts.count-1, a);
+    ref_add(&g_patientAppts, a->patientId, a->id); ref_add(&g_doctorAppts, a->doctorId, a->id);
+    return row;
+}
+
+static void update_appt(Appointment *cur, const Appointment *a){
+    *cur=*a; apptcol_set(idx_get(&g_apptIdx, cur->id), cur);
+}
+
+static void slot_unindex_appt(const Appointment *a);
+
+static void remove_appt_at(int idx){
+    Appointment *a=appt_at(idx);
+    if(!a->canceled) slot_unindex_appt(a);
+    idx_del(&g_apptIdx, a->id); tbl_kill(&g_appts, idx);
+    apptcol_set(idx, a);
+    if(tbl_should_compact(&g_appts)){ compact_table(&g_appts, &g_apptIdx); rebuild_appt_columns(NULL); }
+}
+
+static Medicine* push_med(const Medicine *m){
+    Medicine *row=(Medicine*)tbl_push(&g_meds); *row=*m;
+    idx_put(&g_medIdx, m->id, g_meds.count-1);
+    if(m->id>=g_nextMedId) g_nextMedId=m->id+1;
+    return row;
+}
+
+static Lot* push_lot(const Lot *l){
+    Lot *row=(Lot*)tbl_push(&g_lots); *row=*l;
+    idx_put(&g_lotIdx, l->id, g_lots.count-1);
+    if(l->id>=g_nextLotId) g_nextLotId=l->id+1;
+    return row;
+}
+
+static Invoice* push_invoice(const Invoice *iv){
+    Invoice *row=(Invoice*)tbl_push(&g_invoices); *row=*iv;
+    idx_put(&g_invoiceIdx, iv->id, g_invoices.count-1);
+    if(iv->id>=g_nextInvoiceId) g_nextInvoiceId=iv->id+1;
+    ledger_add(iv); invcol_set(g_invoices.count-1, iv);
+    return row;
+}
+
+// Replaces an invoice in place, moving its amount between ledgers as needed.
+static void update_invoice(Invoice *cur, const Invoice *iv){
+    ledger_remove(cur); *cur=*iv; ledger_add(cur);
+    invcol_set(idx_get(&g_invoiceIdx, cur->id), cur);
+}
+
+static void remove_invoice_at(int idx){
+    Invoice *iv=invoice_at(idx);
+    ledger_remove(iv); idx_del(&g_invoiceIdx, iv->id); tbl_kill(&g_invoices, idx);
+    invcol_set(idx, iv);
+    if(tbl_should_compact(&g_invoices)){ compact_table(&g_invoices, &g_invoiceIdx); rebuild_invoice_columns(NULL); }
+}
+
+// --------------------- Lookups ---------------------
+static Patient* find_patient_by_id(int id){
+    long long t0=probe_start(); int i=idx_get(&g_patientIdx, id); probe_end(PROBE_FIND_PATIENT, t0, 0);
+    return i<0 ? NULL : patient_at(i);
+}
+
+static Doctor* find_doctor_by_id(int id){
+    long long t0=probe_start(); int i=idx_get(&g_doctorIdx, id); probe_end(PROBE_FIND_DOCTOR, t0, 0);
+    return i<0 ? NULL : doctor_at(i);
+}
+
+// As find_*_by_id, minus soft-deleted rows: what new references and edits may use.
+static Patient* live_patient(int id){ Patient *p=find_patient_by_id(id); return p && !p->deleted ? p : NULL; }
+static Doctor*  live_doctor(int id) { Doctor *d=find_doctor_by_id(id); return d && !d->deleted ? d : NULL; }
+
+static Appointment* find_appt_by_id(int id){
+    long long t0=probe_start(); int i=idx_get(&g_apptIdx, id); probe_end(PROBE_FIND_APPT, t0, 0);
+    return i<0 ? NULL : appt_at(i);
+}
+
+static Medicine* find_med_by_id(int id){
+    long long t0=probe_start(); int i=idx_get(&g_medIdx, id); probe_end(PROBE_FIND_MED, t0, 0);
+    return i<0 ? NULL : med_at(i);
+}
+
+static Invoice* find_invoice_by_id(int id){
+    long long t0=probe_start(); int i=idx_get(&g_invoiceIdx, id); probe_end(PROBE_FIND_INVOICE, t0, 0);
+    return i<0 ? NULL : invoice_at(i);
+}
+
+static Lot* find_lot_by_id(int id){
+    long long t0=probe_start(); int i=idx_get(&g_lotIdx, id); probe_end(PROBE_FIND_LOT, t0, 0);
+    return i<0 ? NULL : lot_at(i);
+}
+
+/* Case-insensitive substring search through the trigram indexes, calling hit
+ * for each match in id order. Queries too short for the index scan the table.
+ */
+static void search_patients(const char *q, void (*hit)(const Patient*, void*), void *ctx){
+    long long t0=probe_start();
+    int *ids; int m=tix_search(&g_patientNameTix, q, &ids);
+    for(int i=0;i<m;i++){
+        const Patient *p=find_patient_by_id(ids[i]);
+        if(p && !p->deleted && strcasestr_portable(p->name, q)) hit(p, ctx);
+    }
+    free(ids);
+    for(int i=0,n; m<0 && i<g_patients.count; i+=n){
+        const Patient *run=(const Patient*)tbl_span(&g_patients, i, &n);
+        for(int k=0;k<n;k++) if(run[k].id && !run[k].deleted && strcasestr_portable(run[k].name, q)) hit(&run[k], ctx);
+    }
+    probe_end(PROBE_SEARCH_PATIENTS, t0, 0);
+}
+
+static int doctor_matches(const Doctor *d, const char *q){
+    return d->id && !d->deleted && (strcasestr_portable(d->name, q) || strcasestr_portable(d->specialization, q));
+}
+
+// Matches on name or specialization.
+static void search_doctors(const char *q, void (*hit)(const Doctor*, void*), void *ctx){
+    long long t0=probe_start();
+    int *a, *b; int na=tix_search(&g_doctorNameTix, q, &a), nb=tix_search(&g_doctorSpecTix, q, &b);
+    if(na<0){
+        for(int i=0;i<g_doctors.count;i++){ const Doctor *d=doctor_at(i); if(doctor_matches(d, q)) hit(d, ctx); }
+    }
+    for(int i=0, j=0; na>=0 && (i<na || j<nb); ){   // union of two ascending lists
+        int id = j>=nb || (i<na && a[i]<b[j]) ? a[i] : b[j];
+        if(i<na && a[i]==id) i++;
+        if(j<nb && b[j]==id) j++;
+        const Doctor *d=find_doctor_by_id(id);
+        if(d && doctor_matches(d, q)) hit(d, ctx);
+    }
+    free(a); free(b);
+    probe_end(PROBE_SEARCH_DOCTORS, t0, 0);
+}
+
+// --------------------- File I/O ---------------------
+
+// Strings must not contain '|'. If users enter '|', it will be replaced by '/'.
+static void sanitize_pipes(char *s){
+    for(; *s; ++s) if(*s=='|') *s='/';
+}
+
+/* Single-pass field reader over one DELIM-separated line. Each fr_* call
+ * consumes one field and its delimiter, writing straight into the record.
+ * Missing or non-numeric fields mark the row bad; text longer than its buffer
+ * is truncated and counted. Empty text fields are fine, and fields past the
+ * last one a parser asks for are ignored.
+ */
+typedef struct {
+    const char *p;     // start of the next field
+    int         end;   // the last field has been consumed
+    int         bad;   // row is malformed
+    int         cut;   // fields truncated
+} FieldReader;
+
+static void fr_init(FieldReader *r, const char *line){ r->p=line; r->end=r->bad=r->cut=0; }
+
+// Moves past the field whose text stopped at q.
+static void fr_skip(FieldReader *r, const char *q){
+    while(*q && *q!=DELIM[0]) q++;
+    if(*q) r->p=q+1; else { r->p=q; r->end=1; }
+}
+
+static void fr_str(FieldReader *r, char *dst, size_t cap){
+    if(r->end){ r->bad=1; dst[0]='\0'; return; }
+    const char *q=r->p; size_t n=0;
+    while(*q && *q!=DELIM[0]){ if(n<cap-1) dst[n++]=*q; q++; }
+    if((size_t)(q-r->p)>cap-1) r->cut++;
+    dst[n]='\0';
+    fr_skip(r, q);
+}
+
+static int fr_int(FieldReader *r){
+    if(r->end){ r->bad=1; return 0; }
+    const char *q=r->p; int neg=0; long long v=0;
+    while(*q==' ') q++;
+    if(*q=='-' || *q=='+') neg = *q++=='-';
+    if(*q<'0' || *q>'9') r->bad=1;
+    while(*q>='0' && *q<='9'){ if(v<=2147483647LL) v=v*10+(*q-'0'); q++; }
+    if(v>2147483647LL || (*q && *q!=DELIM[0])) r->bad=1;
+    fr_skip(r, q);
+    return (int)(neg ? -v : v);
+}
+
+// Decimal amount ("-12.50") in cents; see parse_money.
+static Money fr_money(FieldReader *r){
+    if(r->end){ r->bad=1; return 0; }
+    Money v=0; int n=parse_money(r->p, &v);
+    const char *q=r->p+n;
+    if(!n || (*q && *q!=DELIM[0])) r->bad=1;
+    fr_skip(r, q);
+    return v;
+}
+
+// "YYYY-MM-DD" / "HH:MM" fields; blank gives NO_DAY / NO_TIME, and so does an
+// unreadable value, which is counted with the cut fields.
+static int fr_day(FieldReader *r){
+    char buf[32]; int day=NO_DAY; fr_str(r, buf, sizeof buf);
+    if(*buf && !parse_date(buf, &day)){ day=NO_DAY; r->cut++; }
+    return day;
+}
+
+static int fr_minute(FieldReader *r){
+    char buf[32]; int minute=NO_TIME; fr_str(r, buf, sizeof buf);
+    if(*buf && !parse_time(buf, &minute)){ minute=NO_TIME; r->cut++; }
+    return minute;
+}
+
+// Result of a row parser: -1 if malformed (ids must be >= 1), else fields cut.
+static int fr_done(const FieldReader *r, int id){ return (r->bad || id<1) ? -1 : r->cut; }
+
+/* Row codecs: one line (no '\n') per record, shared by the snapshot files and
+ * the journals so both always agree on the format.
+ */
+static int fmt_patient(char *out, size_t n, const Patient *p){
+    char nm[NAME_LEN]; char ph[PHONE_LEN]; char ad[ADDR_LEN];
+    strncpy(nm,p->name,NAME_LEN); sanitize_pipes(nm);
+    strncpy(ph,p->phone,PHONE_LEN); sanitize_pipes(ph);
+    strncpy(ad,str_get(p->address),ADDR_LEN); ad[ADDR_LEN-1]='\0'; sanitize_pipes(ad);
+    char since[DATE_LEN]; fmt_date(p->since, since);
+    return snprintf(out, n, "%d|%s|%d|%s|%s|%s|%d|%d|%d|%s", p->id, nm, p->age, gender_name(p->gender), ph, ad, p->admitted, p->roomNo, p->deleted, since);
+}
+
+static int parse_patient(const char *line, Patient *p){
+    // id|name|age|gender|phone|address|admitted|roomNo|deleted|since (older files stop after roomNo or deleted)
+    FieldReader r; fr_init(&r, line); memset(p,0,sizeof *p); p->since=NO_DAY; char gd[16], ad[ADDR_LEN];
+    p->id=fr_int(&r); fr_str(&r,p->name,sizeof p->name); p->age=fr_int(&r);
+    fr_str(&r,gd,sizeof gd); fr_str(&r,p->phone,sizeof p->phone); fr_str(&r,ad,sizeof ad);
+    p->gender=parse_gender(gd); p->address=str_intern(ad); p->admitted=fr_int(&r)!=0; p->roomNo=fr_int(&r);
+    if(!r.end) p->deleted=fr_int(&r)!=0;
+    if(!r.end) p->since=fr_day(&r);
+    return fr_done(&r, p->id);
+}
+
+static int fmt_doctor(char *out, size_t n, const Doctor *d){
+    char nm[NAME_LEN]; char sp[SPEC_LEN]; char ph[PHONE_LEN];
+    strncpy(nm,d->name,NAME_LEN); sanitize_pipes(nm);
+    strncpy(sp,d->specialization,SPEC_LEN); sanitize_pipes(sp);
+    strncpy(ph,d->phone,PHONE_LEN); sanitize_pipes(ph);
+    return snprintf(out, n, "%d|%s|%s|%s|%d", d->id, nm, sp, ph, d->deleted);
+}
+
+static int parse_doctor(const char *line, Doctor *d){
+    // id|name|spec|phone|deleted (older files stop after phone)
+    FieldReader r; fr_init(&r, line); memset(d,0,sizeof *d);
+    d->id=fr_int(&r); fr_str(&r,d->name,sizeof d->name); fr_str(&r,d->specialization,sizeof d->specialization); fr_str(&r,d->phone,sizeof d->phone);
+    if(!r.end) d->deleted=fr_int(&r)!=0;
+    return fr_done(&r, d->id);
+}
+
+static int fmt_appt(char *out, size_t n, const Appointment *a){
+    char nt[NOTES_LEN]; strncpy(nt,str_get(a->notes),NOTES_LEN); nt[NOTES_LEN-1]='\0'; sanitize_pipes(nt);
+    char dt[DATE_LEN], tm[TIME_LEN]; fmt_date(a->day, dt); fmt_time(a->minute, tm);
+    return snprintf(out, n, "%d|%d|%d|%s|%s|%s|%d", a->id, a->patientId, a->doctorId, dt, tm, nt, a->canceled);
+}
+
+static int parse_appt(const char *line, Appointment *a){
+    // id|patId|docId|date|time|notes|canceled
+    FieldReader r; fr_init(&r, line); memset(a,0,sizeof *a); char nt[NOTES_LEN];
+    a->id=fr_int(&r); a->patientId=fr_int(&r); a->doctorId=fr_int(&r);
+    a->day=fr_day(&r); a->minute=(short)fr_minute(&r); fr_str(&r,nt,sizeof nt); a->notes=str_intern(nt);
+    a->canceled=fr_int(&r)!=0;
+    return fr_done(&r, a->id);
+}
+
+static int fmt_med(char *out, size_t n, const Medicine *m){
+    char nm[NAME_LEN]; strncpy(nm,m->name,NAME_LEN); sanitize_pipes(nm);
+    char pr[MONEY_LEN];
+    int stock=__atomic_load_n(&m->stock, __ATOMIC_RELAXED);   // sales update it concurrently
+    return snprintf(out, n, "%d|%s|%d|%s|%d", m->id, nm, stock, fmt_money(m->price, pr), m->reorderLevel);
+}
+
+static int parse_med(const char *line, Medicine *m){
+    // id|name|stock|price|reorderLevel (older files stop after price)
+    FieldReader r; fr_init(&r, line); memset(m,0,sizeof *m);
+    m->id=fr_int(&r); fr_str(&r,m->name,sizeof m->name); m->stock=fr_int(&r); m->price=fr_money(&r);
+    if(!r.end) m->reorderLevel=fr_int(&r);
+    return fr_done(&r, m->id);
+}
+
+static int fmt_lot(char *out, size_t n, const Lot *l){
+    char ex[DATE_LEN]; fmt_date(l->expiry, ex);
+    return snprintf(out, n, "%d|%d|%s|%d", l->id, l->medicineId, ex, l->qty);
+}
+
+static int parse_lot(const char *line, Lot *l){
+    // id|medicineId|expiry|qty
+    FieldReader r; fr_init(&r, line); memset(l,0,sizeof *l);
+    l->id=fr_int(&r); l->medicineId=fr_int(&r); l->expiry=fr_day(&r); l->qty=fr_int(&r);
+    return fr_done(&r, l->id);
+}
+
+static int fmt_invoice(char *out, size_t n, const Invoice *iv){
+    char ds[DESC_LEN]; strncpy(ds,str_get(iv->description),DESC_LEN); ds[DESC_LEN-1]='\0'; sanitize_pipes(ds);
+    char am[MONEY_LEN], dt[DATE_LEN]; fmt_date(iv->day, dt);
+    return snprintf(out, n, "%d|%d|%s|%s|%s", iv->id, iv->patientId, fmt_money(iv->amount, am), ds, dt);
+}
+
+static int parse_invoice(const char *line, Invoice *iv){
+    // id|patientId|amount|description|date
+    FieldReader r; fr_init(&r, line); memset(iv,0,sizeof *iv);
+    iv->id=fr_int(&r); iv->patientId=fr_int(&r); iv->amount=fr_money(&r);
+    char ds[DESC_LEN]; fr_str(&r,ds,sizeof ds); iv->description=str_intern(ds); iv->day=fr_day(&r);
+    return fr_done(&r, iv->id);
+}
+
+// --------------------- Journal ---------------------
+/* Each table lives in a snapshot (<table>.db) plus an append-only journal
+ * (<table>.jnl). A mutation appends a single line
+ *     seq|op|row      op: I=insert, U=update, D=delete (row is then the id)
+ * so it costs O(1) I/O whatever the table size. Once the journal holds more
+ * records than the table has rows it is compacted: the snapshot is rewritten
+ * with a "#seq=N" first line and the journal truncated. Loading replays the
+ * journal on top of the snapshot, skipping records the snapshot already covers.
+ *
+ * Durability: snapshots are written to <file>.tmp, fsynced and renamed over
+ * the old one, and only then is the journal truncated, so a crash or a full
+ * disk at any point leaves either the old or the new snapshot plus a journal
+ * that covers the gap. Journal records are fsynced by group commit: a
+ * background flusher syncs every dirty journal at most HMS_SYNC_MS
+ * milliseconds after the first unsynced append, so a burst of edits costs one
+ * fsync. When a server client is waiting for its write to become durable the
+ * flusher syncs at once, and writes arriving during that fsync share the
+ * next one. HMS_SYNC_MS=0 syncs every record, a negative value never syncs.
+ *
+ * Changes spanning tables (a sale: stock plus invoice) go to txn.jnl as one
+ * group written with a single append:
+ *     seq|B|n              n parts follow, any number of them
+ *     seq|<journal>|op|row one per part, e.g. "medicines.jnl|A|3|-2"
+ *     seq|C                commit
+ * A group without its commit line is ignored on load, so either every part
+ * is replayed or none is. Loading merges all journals by seq, and txn.jnl is
+ * truncated once every table it touched has a snapshot covering it.
+ */
+#define JNL_COMPACT_MIN     1024
+#define JNL_SYNC_MS_DEFAULT   20
+#define JNL_LINE            1024   // longest journal line replay reads
+
+typedef struct {
+    const char *snap;     // text snapshot file
+    const char *bin;      // binary snapshot file (see save_bin)
+    const char *jnl;      // journal file
+    FILE       *jf;       // append handle, opened on first write
+    long long   snapSeq;  // last seq folded into the snapshot
+    int         pending;  // journal records since the last compaction
+    long long   malformed, truncated;   // rows skipped / fields cut while loading
+    int         dirty;    // appended to since the last fsync
+    long long   txnSeq;   // last txn.jnl group with a part for this table
+    int         syncFailed;   // an fsync of it failed; its records are durable only once a snapshot holds them
+} Journal;
+
+static long long g_seq = 0;   // last sequence number handed out, all tables
+static int g_deferLog = 0;    // batch mode: only count mutations; compact_all persists them
+static int g_syncMs = JNL_SYNC_MS_DEFAULT;   // group-commit window, see above
+
+static Journal g_patJnl  = {"patients.db",     "patients.bin",     "patients.jnl",     NULL, 0, 0, 0, 0};
+static Journal g_docJnl  = {"doctors.db",      "doctors.bin",      "doctors.jnl",      NULL, 0, 0, 0, 0};
+static Journal g_apptJnl = {"appointments.db", "appointments.bin", "appointments.jnl", NULL, 0, 0, 0, 0};
+static Journal g_medJnl  = {"medicines.db",    "medicines.bin",    "medicines.jnl",    NULL, 0, 0, 0, 0};
+static Journal g_invJnl  = {"invoices.db",     "invoices.bin",     "invoices.jnl",     NULL, 0, 0, 0, 0};
+static Journal g_lotJnl  = {"lots.db",         "lots.bin",         "lots.jnl",         NULL, 0, 0, 0, 0};
+static Journal g_txnJnl  = {NULL,              NULL,               "txn.jnl",          NULL, 0, 0, 0, 0};
+static Journal *g_journals[] = {&g_patJnl, &g_docJnl, &g_apptJnl, &g_medJnl, &g_invJnl, &g_lotJnl, &g_txnJnl};
+
+typedef struct {
+    Journal    *j;
+    char        op;
+    const char *row;
+} TxnPart;
+
+static int sync_fd(int fd){
+#ifdef _WIN32
+    return _commit(fd);
+#else
+    return fsync(fd);
+#endif
+}
+
+static int sync_file(FILE *f){ return fflush(f)==0 && sync_fd(fileno(f))==0 ? 0 : -1; }
+
+// Makes a rename in the working directory durable.
+static void sync_dir(){
+#ifndef _WIN32
+    int fd=open(".", O_RDONLY); if(fd>=0){ fsync(fd); close(fd); }
+#endif
+}
+
+/* Group commit state. g_syncMu guards the journal handles, dirty flags and
+ * both seqs; the flusher fsyncs dup()ed descriptors outside it, so appends
+ * never wait for the disk.
+ */
+#ifndef _WIN32
+static pthread_mutex_t g_syncMu   = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  g_syncWork = PTHREAD_COND_INITIALIZER;   // appendedSeq moved
+static pthread_cond_t  g_syncDone = PTHREAD_COND_INITIALIZER;   // durableSeq moved
+static int             g_flusher  = 0;
+static int             g_syncWaiters = 0;   // threads blocked in jnl_wait_durable
+#define SYNC_LOCK()   pthread_mutex_lock(&g_syncMu)
+#define SYNC_UNLOCK() pthread_mutex_unlock(&g_syncMu)
+#else
+#define SYNC_LOCK()   ((void)0)
+#define SYNC_UNLOCK() ((void)0)
+#endif
+static long long g_appendedSeq = 0, g_durableSeq = 0;
+static int       g_syncDoubt = 0;   // journals with syncFailed set; g_durableSeq stands still meanwhile
+
+/* Change feed. While serving, every record appended below is also kept in a
+ * ring holding the last CDC_RING of them, indexed by seq, for standbys to
+ * stream (see Replication). Records are captured under g_syncMu once they
+ * are written, before the lock is let go, so the ring holds every seq in
+ * (g_cdcBase, g_seq]. A write that fails takes no seq and is not captured; a
+ * single record's change then reaches disk through a snapshot, and
+ * g_cdcResync sends the standbys one.
+ */
+#define CDC_RING      65536   // power of two
+#define CDC_MAX_FEEDS 16
+
+typedef struct {
+    long long seq;
+    long long ns;      // wall clock at append, for the standby's lag
+    int       parts;
+    char     *text;    // "<journal>|op|row\n" per part
+} CdcRec;
+
+typedef struct {
+    int       used;
+    long long sent;    // last seq sent to this standby
+} CdcFeed;
+
+// --follow: where the standby stands; written by its apply thread under the database lock.
+typedef struct {
+    const char *leader;                  // socket path
+    int         connected;
+    long long   leaderSeq;               // newest seq the leader has reported
+    long long   lastNs;                  // leader wall clock of the last applied record
+    long long   applied, snapshots, reconnects;
+} CdcFollow;
+
+static CdcRec   *g_cdcRing = NULL;       // NULL unless serving as a leader
+static long long g_cdcBase = 0;
+static int       g_cdcResync = 0;        // bumped when a change bypasses the ring; feeds then resend a snapshot
+static CdcFeed   g_cdcFeeds[CDC_MAX_FEEDS];   // under g_syncMu
+static CdcFollow g_follow;
+
+static long long wall_ns(){
+    struct timespec ts; timespec_get(&ts, TIME_UTC);
+    return (long long)ts.tv_sec*1000000000LL+ts.tv_nsec;
+}
+
+// Keeps record seq's parts in the ring; call with g_syncMu held.
+static void cdc_capture_locked(long long seq, const TxnPart *parts, int n){
+    if(!g_cdcRing) return;
+    size_t len=1;
+    for(int i=0;i<n;i++) len+=strlen(parts[i].j->jnl)+strlen(parts[i].row)+4;
+    CdcRec *r=&g_cdcRing[seq&(CDC_RING-1)];
+    r->text=(char*)xrealloc(r->text, len);
+    char *w=r->text;
+    for(int i=0;i<n;i++) w+=sprintf(w, "%s|%c|%s\n", parts[i].j->jnl, parts[i].op, parts[i].row);
+    r->seq=seq; r->ns=wall_ns(); r->parts=n;
+    if(seq-g_cdcBase>CDC_RING) g_cdcBase=seq-CDC_RING;
+}
+
+// Newest seq a standby may be sent: durable, unless syncing is off.
+static long long cdc_ready_locked(){ return g_syncMs<0 ? g_appendedSeq : g_durableSeq; }
+
+// Cuts an incomplete tail off a journal so later appends start on a clean line.
+static void jnl_cut(const char *path, long len){
+    fprintf(stderr, "%s: dropping an incomplete record at the end\n", path);
+#ifdef _WIN32
+    FILE *f=fopen(path, "r+b"); if(f){ _chsize(_fileno(f), len); fclose(f); }
+#else
+    if(truncate(path, len)!=0) perror(path);
+#endif
+}
+
+// Opens j for appending if needed, positioned at the end; call with g_syncMu held.
+static int jnl_open_locked(Journal *j){
+    if(!j->jf){
+        j->jf=fopen(j->jnl,"a"); if(!j->jf){ perror(j->jnl); return 0; }
+        fseek(j->jf, 0, SEEK_END);   // so ftell gives the size from the start
+    }
+    return 1;
+}
+
+/* A write to j that started at offset `end` failed: drops the handle, and
+ * with it anything still buffered, and cuts off what did reach the file.
+ * Call with g_syncMu held.
+ */
+static void jnl_write_failed_locked(Journal *j, long end){
+    perror(j->jnl);
+    fclose(j->jf); j->jf=NULL; j->dirty=0;
+    if(end>=0) jnl_cut(j->jnl, end);
+}
+
+/* An fsync of j failed: the kernel may have dropped its unsynced pages, and
+ * a later fsync can succeed without them, so its records stay in doubt until
+ * a snapshot is saved (jnl_truncate). Call with g_syncMu held.
+ */
+static void jnl_sync_failed_locked(Journal *j){
+    perror(j->jnl);
+    if(!j->syncFailed){ j->syncFailed=1; g_syncDoubt++; }
+}
+
+// Hands a flushed append of record seq to group commit; call with g_syncMu held.
+static void jnl_written_locked(Journal *j, long long seq){
+    j->dirty=1; g_appendedSeq=seq;
+#ifndef _WIN32
+    int inline_sync = g_syncMs==0 || (g_syncMs>0 && !g_flusher);
+    if(!inline_sync) pthread_cond_signal(&g_syncWork);
+#else
+    int inline_sync = g_syncMs>=0;
+#endif
+    if(inline_sync){
+        long long t0=probe_start();
+        if(sync_fd(fileno(j->jf))!=0) jnl_sync_failed_locked(j);
+        probe_end(PROBE_JNL_FSYNC, t0, 0);
+        j->dirty=0; if(!g_syncDoubt) g_durableSeq=seq;
+    }
+#ifndef _WIN32
+    if(g_cdcRing && (inline_sync || g_syncMs<0)) pthread_cond_broadcast(&g_syncDone);   // wake the feeds (the flusher does otherwise)
+#endif
+}
+
+/* Appends one record; returns 1 when the caller must save the table now:
+ * it is due for compaction, or the record could not be written. In the
+ * second case nothing of the record is left in the journal and it takes no
+ * seq, so the snapshot the caller saves is what keeps the change. With
+ * HMS_SYNC_MS=0 (or no flusher thread) the record is fsynced before returning.
+ */
+static int jnl_append(Journal *j, char op, const char *row, int rows){
+    if(g_deferLog){ j->pending++; return 0; }
+    SYNC_LOCK();
+    if(!jnl_open_locked(j)){ SYNC_UNLOCK(); return 1; }
+    long long t0=probe_start(), seq=++g_seq;
+    long end=ftell(j->jf);
+    int bytes=fprintf(j->jf, "%lld|%c|%s\n", seq, op, row);
+    if(bytes<0 || fflush(j->jf)!=0){
+        jnl_write_failed_locked(j, end); g_seq--;
+        g_cdcResync++;   // the change reaches disk without a record: standbys start over from a snapshot
+        SYNC_UNLOCK();
+        return 1;
+    }
+    TxnPart part={j, op, row}; cdc_capture_locked(seq, &part, 1);
+    jnl_written_locked(j, seq);
+    j->pending++;
+    int due = j->pending>JNL_COMPACT_MIN && j->pending>rows;
+    SYNC_UNLOCK();
+    probe_end(PROBE_JNL_APPEND, t0, bytes);
+    return due;
+}
+
+/* Appends a group of parts to txn.jnl as one write; returns 0 if it could not
+ * be written, in which case nothing of it is left in txn.jnl and it takes no
+ * seq, so later groups never follow a torn one. *due is set when txn.jnl has
+ * outgrown rows and the tables it touches should be saved (txn_compact).
+ */
+static int jnl_append_txn(const TxnPart *parts, int n, int rows, int *due){
+    Journal *t=&g_txnJnl;
+    *due=0;
+    SYNC_LOCK();
+    if(g_deferLog){
+        for(int i=0;i<n;i++) parts[i].j->pending++;
+        SYNC_UNLOCK(); return 1;
+    }
+    if(!jnl_open_locked(t)){ SYNC_UNLOCK(); return 0; }
+    long long t0=probe_start(), seq=++g_seq, bytes=0;
+    long end=ftell(t->jf);
+    int w=fprintf(t->jf, "%lld|B|%d\n", seq, n), ok = w>0; bytes+=w;
+    for(int i=0;ok && i<n;i++){ w=fprintf(t->jf, "%lld|%s|%c|%s\n", seq, parts[i].j->jnl, parts[i].op, parts[i].row); ok = w>0; bytes+=w; }
+    if(ok){ w=fprintf(t->jf, "%lld|C\n", seq); bytes+=w; }
+    ok = ok && w>0 && fflush(t->jf)==0;
+    if(!ok){
+        jnl_write_failed_locked(t, end); g_seq--;
+        SYNC_UNLOCK();
+        return 0;
+    }
+    cdc_capture_locked(seq, parts, n);
+    jnl_written_locked(t, seq);
+    for(int i=0;i<n;i++){ parts[i].j->pending++; parts[i].j->txnSeq=seq; }
+    t->pending++;
+    *due = t->pending>JNL_COMPACT_MIN && t->pending>rows;
+    SYNC_UNLOCK();
+    probe_end(PROBE_JNL_TXN, t0, bytes);
+    return ok;
+}
+
+#ifndef _WIN32
+static void* jnl_flusher(void *unused){
+    (void)unused;
+    for(;;){
+        SYNC_LOCK();
+        while(g_appendedSeq==g_durableSeq) pthread_cond_wait(&g_syncWork, &g_syncMu);
+        // Let the rest of the group arrive, unless somebody is already waiting
+        // on it; appends made during the fsync then form the next group.
+        struct timespec until; clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_sec+=g_syncMs/1000; until.tv_nsec+=(long)(g_syncMs%1000)*1000000L;
+        if(until.tv_nsec>=1000000000L){ until.tv_sec++; until.tv_nsec-=1000000000L; }
+        while(!g_syncWaiters && pthread_cond_timedwait(&g_syncWork, &g_syncMu, &until)==0){}
+        int fds[sizeof g_journals/sizeof g_journals[0]], failed[sizeof g_journals/sizeof g_journals[0]], n=0;
+        Journal *js[sizeof g_journals/sizeof g_journals[0]];
+        long long target=g_appendedSeq;
+        for(size_t i=0;i<sizeof g_journals/sizeof g_journals[0];i++){
+            Journal *j=g_journals[i];
+            if(j->dirty && j->jf){ int fd=dup(fileno(j->jf)); if(fd>=0){ js[n]=j; fds[n++]=fd; } j->dirty=0; }
+        }
+        SYNC_UNLOCK();
+        long long t0=probe_start();
+        for(int i=0;i<n;i++){ failed[i] = fsync(fds[i])!=0; close(fds[i]); }
+        probe_end(PROBE_JNL_FSYNC, t0, 0);
+        SYNC_LOCK();
+        for(int i=0;i<n;i++) if(failed[i]) jnl_sync_failed_locked(js[i]);
+        if(!g_syncDoubt && target>g_durableSeq) g_durableSeq=target;
+        pthread_cond_broadcast(&g_syncDone);
+        SYNC_UNLOCK();
+    }
+    return NULL;
+}
+#endif
+
+// Reads HMS_SYNC_MS and starts the flusher if group commit is on.
+static void jnl_sync_start(){
+    const char *env=getenv("HMS_SYNC_MS");
+    if(env && *env) g_syncMs=atoi(env);
+    g_appendedSeq=g_durableSeq=g_seq;
+#ifndef _WIN32
+    if(g_syncMs>0 && !g_flusher){
+        pthread_t th;
+        if(pthread_create(&th, NULL, jnl_flusher, NULL)==0){ pthread_detach(th); g_flusher=1; }
+    }
+#endif
+}
+
+// g_seq as seen by other threads appending concurrently.
+static long long jnl_last_seq(){
+    SYNC_LOCK(); long long seq=g_seq; SYNC_UNLOCK();
+    return seq;
+}
+
+/* Blocks until every record up to seq is on disk; returns 0 if it cannot
+ * say so because an fsync failed (see jnl_sync_failed_locked). Without the
+ * flusher appends sync themselves, so there is nothing to wait for.
+ */
+static int jnl_wait_durable(long long seq){
+#ifndef _WIN32
+    if(g_syncMs<0) return 1;
+    SYNC_LOCK();
+    if(g_flusher && g_durableSeq<seq && !g_syncDoubt){
+        g_syncWaiters++; pthread_cond_signal(&g_syncWork);
+        while(g_durableSeq<seq && !g_syncDoubt) pthread_cond_wait(&g_syncDone, &g_syncMu);
+        g_syncWaiters--;
+    }
+    int ok = g_durableSeq>=seq;
+    SYNC_UNLOCK();
+    return ok;
+#else
+    (void)seq; return 1;
+#endif
+}
+
+// Called once the snapshot covering every record is durable.
+static void jnl_truncate(Journal *j){
+    SYNC_LOCK();
+    if(j->jf){ fclose(j->jf); j->jf=NULL; }
+    j->dirty=0;
+    if(j->syncFailed){ j->syncFailed=0; g_syncDoubt--; }   // the snapshot holds its records now
+    FILE *f=fopen(j->jnl,"w"); if(f) fclose(f);
+    SYNC_UNLOCK();
+    j->pending=0;
+}
+
+// Seq recorded in a text snapshot's header: -1 if there is no file, 0 if no header.
+static long long text_snap_seq(const char *path){
+    FILE *f=fopen(path,"r"); if(!f) return -1;
+    long long seq=0; if(fscanf(f, "#seq=%lld", &seq)!=1) seq=0;
+    fclose(f); return seq;
+}
+
+// Drops txn.jnl once no table still needs it for replay.
+static void txn_maybe_truncate(){
+    if(!g_txnJnl.pending) return;
+    for(size_t i=0;i<sizeof g_journals/sizeof g_journals[0];i++)
+        if(g_journals[i]!=&g_txnJnl && g_journals[i]->txnSeq>g_journals[i]->snapSeq) return;
+    jnl_truncate(&g_txnJnl);
+}
+
+// Renames a finished, fsynced <path>.tmp over path; on failure the old file stays.
+static int snap_commit(const char *path, const char *tmp, int ok){
+#ifdef _WIN32
+    if(ok) remove(path);
+#endif
+    if(!ok || rename(tmp, path)!=0){ perror(path); remove(tmp); return 0; }
+    sync_dir();
+    return 1;
+}
+
+/* Held snapshots. While g_snapHold is set (the end of a batch), a finished
+ * <file>.tmp is not renamed but kept in g_held, and snap_release swaps them
+ * all in as one unit: it first lists their paths in SNAP_COMMIT, written to
+ * a temp file, fsynced and renamed into place, then renames each tmp. A
+ * crash after the list is in place is rolled forward by snap_roll_forward
+ * on the next start; one before it leaves every old snapshot in force.
+ */
+#define SNAP_COMMIT   "snapshots.commit"
+#define SNAP_HELD_MAX 8
+
+typedef struct { Journal *j; const char *path; } HeldSnap;
+
+static int      g_snapHold = 0;
+static HeldSnap g_held[SNAP_HELD_MAX];
+static int      g_heldCount = 0;
+
+// Keeps a finished <path>.tmp for snap_release; a failed one is dropped.
+static int snap_hold(Journal *j, const char *path, const char *tmp, int ok){
+    if(!ok || g_heldCount==SNAP_HELD_MAX){ perror(path); remove(tmp); return 0; }
+    g_held[g_heldCount].j=j; g_held[g_heldCount].path=path; g_heldCount++;
+    return 1;
+}
+
+// Renames <path>.tmp over path for every path listed in SNAP_COMMIT.
+static void snap_roll_forward(){
+    FILE *f=fopen(SNAP_COMMIT, "r"); if(!f) return;
+    char path[64], tmp[80];
+    while(fgets(path, sizeof path, f)){
+        path[strcspn(path, "\n")]='\0';
+        snprintf(tmp, sizeof tmp, "%s.tmp", path);
+        FILE *t=fopen(tmp, "r"); if(!t) continue;   // already renamed
+        fclose(t);
+#ifdef _WIN32
+        remove(path);
+#endif
+        if(rename(tmp, path)!=0) perror(path);
+    }
+    fclose(f);
+    sync_dir(); remove(SNAP_COMMIT); sync_dir();
+}
+
+/* Ends holding: with ok, swaps in every held snapshot and truncates their
+ * journals; otherwise drops them all, leaving the old files. Returns 1 if
+ * the new snapshots are in place.
+ */
+static int snap_release(int ok){
+    g_snapHold=0;
+    char tmp[80];
+    FILE *f = ok && g_heldCount ? fopen(SNAP_COMMIT ".tmp", "w") : NULL;
+    if(f){
+        for(int i=0;i<g_heldCount;i++) fprintf(f, "%s\n", g_held[i].path);
+        ok = !ferror(f) && sync_file(f)==0;
+        if(fclose(f)!=0) ok=0;
+        ok = snap_commit(SNAP_COMMIT, SNAP_COMMIT ".tmp", ok);
+    } else if(g_heldCount) ok=0;
+    if(!ok){
+        for(int i=0;i<g_heldCount;i++){ snprintf(tmp, sizeof tmp, "%s.tmp", g_held[i].path); remove(tmp); }
+        g_heldCount=0; return 0;
+    }
+    snap_roll_forward();
+    for(int i=0;i<g_heldCount;i++){ g_held[i].j->snapSeq=g_seq; jnl_truncate(g_held[i].j); }
+    txn_maybe_truncate();
+    g_heldCount=0; return 1;
+}
+
+// Snapshots are written to <snap>.tmp; snap_close swaps it in.
+static FILE* snap_create(Journal *j){
+    char tmp[64]; snprintf(tmp, sizeof tmp, "%s.tmp", j->snap);
+    FILE *f=fopen(tmp,"w"); if(!f){ perror(tmp); return NULL; }
+    fprintf(f, "#seq=%lld\n", g_seq);
+    return f;
+}
+
+// The journal is kept unless the new snapshot made it to disk. Returns 1 on success.
+static int snap_close(Journal *j, FILE *f){
+    char tmp[64]; snprintf(tmp, sizeof tmp, "%s.tmp", j->snap);
+    int ok = !ferror(f) && sync_file(f)==0;
+    if(fclose(f)!=0) ok=0;
+    if(g_snapHold) return snap_hold(j, j->snap, tmp, ok);
+    if(!snap_commit(j->snap, tmp, ok)) return 0;
+    j->snapSeq=g_seq; jnl_truncate(j); txn_maybe_truncate();
+    return 1;
+}
+
+// --------------------- Binary snapshots ---------------------
+/* Optional fixed-record snapshot (<table>.bin), written instead of the text
+ * one when started with --binary. A 64-byte header is followed by the raw live
+ * records back to back, so loading maps the file copy-on-write and hands each
+ * full TBL_CHUNK run to the table as a chunk (tbl_adopt): no parsing, no
+ * copying, only the id index is rebuilt. The header's record size guards
+ * against layout changes; on any mismatch, or when the text snapshot is newer,
+ * the text snapshot is loaded instead.
+ *
+ * A table with a pooled text field (strOff >= 0) stores each distinct string
+ * once after the records, NUL-terminated; in the file the record's Str holds
+ * the string's offset in that section plus one. Loading re-interns them.
+ */
+#define BIN_MAGIC   "HMSB"
+#define BIN_VERSION 7   // 2: cents; 3: packed dates and enums; 4: pooled strings; 5: reorder levels; 6: soft deletes; 7: admission days
+
+typedef struct {
+    char      magic[4];
+    int       version;
+    int       recSize;
+    int       nextId;
+    long long count;
+    long long seq;      // same meaning as a text snapshot's "#seq=N"
+    long long strBytes; // string section after the records
+    char      pad[24];
+} BinHeader;
+
+static int g_binaryStore = 0;   // --binary: compact into .bin snapshots
+
+static int load_bin(Journal *j, Table *t, HashIndex *ix, int *nextId, int strOff){
+    size_t len=0; char *map=map_file(j->bin, &len); if(!map) return 0;
+    const BinHeader *h=(const BinHeader*)map;
+    if(len<sizeof *h || memcmp(h->magic, BIN_MAGIC, 4)!=0 || h->version!=BIN_VERSION ||
+       h->recSize!=(int)t->elem || h->count<0 || h->count>(long long)((len-sizeof *h)/t->elem) ||
+       h->strBytes!=(long long)(len-sizeof *h-(size_t)h->count*t->elem) ||
+       h->seq<text_snap_seq(j->snap)){
+        unmap_file(map, len); return 0;
+    }
+    j->snapSeq=h->seq;
+    *nextId=h->nextId;
+    const char *strs=map+sizeof *h+(size_t)h->count*t->elem; size_t nstr=(size_t)h->strBytes;
+    tbl_adopt(t, map, len, map+sizeof *h, (int)h->count);
+    if(strOff>=0){
+        HashIndex seen={NULL, NULL, 0, 0, 0};   // file offset -> handle
+        for(int i=0;i<t->count;i++){
+            Str *f=(Str*)((char*)tbl_at(t, i)+strOff); Str off=*f;
+            if(!off) continue;
+            int got=idx_get(&seen, off);
+            if(got<0){
+                got = off<=nstr && memchr(strs+off-1, '\0', nstr-(off-1)) ? (int)str_intern(strs+off-1) : 0;
+                idx_put(&seen, off, got);
+            }
+            *f=(Str)got;
+        }
+        idx_clear(&seen);
+    }
+    for(int i=0;i<t->count;i++){
+        int id=*(const int*)tbl_at(t, i); if(!id) continue;
+        idx_put(ix, id, i); if(id>=*nextId) *nextId=id+1;
+    }
+    return 1;
+}
+
+// Written to a temp file, fsynced and renamed, so the live (possibly mapped) file is never truncated.
+static int save_bin(Journal *j, const Table *t, int nextId, int strOff){
+    char tmp[64]; snprintf(tmp, sizeof tmp, "%s.tmp", j->bin);
+    FILE *f=fopen(tmp,"wb"); if(!f){ perror(tmp); return 0; }
+    BinHeader h; memset(&h, 0, sizeof h);
+    memcpy(h.magic, BIN_MAGIC, 4); h.version=BIN_VERSION; h.recSize=(int)t->elem;
+    h.nextId=nextId; h.count=tbl_live(t); h.seq=g_seq;
+    // String section layout first, so the header can carry its size.
+    HashIndex offs={NULL, NULL, 0, 0, 0};   // handle -> offset+1 in the section
+    Str *order=NULL; int norder=0, cap=0;
+    for(int i=0;strOff>=0 && i<t->count;i++){
+        const char *rec=(const char*)tbl_at(t, i); Str s=*(const Str*)(rec+strOff);
+        if(!*(const int*)rec || !s || idx_get(&offs, s)>=0) continue;
+        idx_put(&offs, s, (int)h.strBytes+1); h.strBytes+=(long long)strlen(str_get(s))+1;
+        if(norder==cap){ cap = cap ? cap*2 : 256; order=(Str*)xrealloc(order, cap*sizeof *order); }
+        order[norder++]=s;
+    }
+    int ok = h.strBytes<0x7fffffff && fwrite(&h, sizeof h, 1, f)==1;
+    char *buf=(char*)xcalloc(1, t->elem);
+    for(int i=0,n;ok && i<t->count;i+=n){
+        char *run=(char*)tbl_span(t, i, &n);
+        for(int k=0;ok && k<n;k++){
+            char *rec=run+(size_t)k*t->elem;
+            if(!*(int*)rec) continue;
+            if(strOff>=0){
+                memcpy(buf, rec, t->elem); Str *s=(Str*)(buf+strOff);
+                *s = *s ? (Str)idx_get(&offs, *s) : 0;
+                rec=buf;
+            }
+            ok = fwrite(rec, t->elem, 1, f)==1;
+        }
+    }
+    for(int k=0;ok && k<norder;k++){ const char *p=str_get(order[k]); ok = fwrite(p, strlen(p)+1, 1, f)==1; }
+    free(buf); free(order); idx_clear(&offs);
+    if(ok && sync_file(f)!=0) ok=0;
+    if(fclose(f)!=0) ok=0;
+    if(g_snapHold) return snap_hold(j, j->bin, tmp, ok);
+    if(!snap_commit(j->bin, tmp, ok)) return 0;
+    j->snapSeq=g_seq; jnl_truncate(j); txn_maybe_truncate();
+    return 1;
+}
+
+// Journal replay: I/U are upserts so a record can be replayed more than once.
+// Returns the row parser's result (-1 malformed, else fields truncated).
+static int apply_patient(char op, const char *row){
+    if(op=='D'){ int i=idx_get(&g_patientIdx, atoi(row)); if(i>=0) remove_patient_at(i); return 0; }
+    Patient p; int rc=parse_patient(row,&p); if(rc<0) return rc;
+    Patient *cur=find_patient_by_id(p.id); if(cur) update_patient(cur, &p); else push_patient(&p);
+    return rc;
+}
+
+static int apply_doctor(char op, const char *row){
+    if(op=='D'){ int i=idx_get(&g_doctorIdx, atoi(row)); if(i>=0) remove_doctor_at(i); return 0; }
+    Doctor d; int rc=parse_doctor(row,&d); if(rc<0) return rc;
+    Doctor *cur=find_doctor_by_id(d.id); if(cur) update_doctor(cur, &d); else push_doctor(&d);
+    return rc;
+}
+
+static int apply_appt(char op, const char *row){
+    if(op=='D'){ int i=idx_get(&g_apptIdx, atoi(row)); if(i>=0) remove_appt_at(i); return 0; }
+    Appointment a; int rc=parse_appt(row,&a); if(rc<0) return rc;
+    Appointment *cur=find_appt_by_id(a.id); if(cur) update_appt(cur, &a); else push_appt(&a);
+    return rc;
+}
+
+static int apply_med(char op, const char *row){
+    if(op=='D') return 0;
+    if(op=='A'){   // stock adjustment from a sale: id|delta
+        FieldReader r; fr_init(&r, row);
+        int id=fr_int(&r), delta=fr_int(&r), rc=fr_done(&r, id); if(rc<0) return rc;
+        Medicine *cur=find_med_by_id(id); if(cur) cur->stock+=delta;
+        return rc;
+    }
+    Medicine m; int rc=parse_med(row,&m); if(rc<0) return rc;
+    Medicine *cur=find_med_by_id(m.id); if(cur) *cur=m; else push_med(&m);
+    return rc;
+}
+
+static int apply_lot(char op, const char *row){
+    if(op=='D') return 0;
+    if(op=='A'){   // units sold or written off: id|delta
+        FieldReader r; fr_init(&r, row);
+        int id=fr_int(&r), delta=fr_int(&r), rc=fr_done(&r, id); if(rc<0) return rc;
+        Lot *cur=find_lot_by_id(id); if(cur) cur->qty+=delta;
+        return rc;
+    }
+    Lot l; int rc=parse_lot(row,&l); if(rc<0) return rc;
+    Lot *cur=find_lot_by_id(l.id); if(cur) *cur=l; else push_lot(&l);
+    return rc;
+}
+
+static int apply_invoice(char op, const char *row){
+    if(op=='D'){ int i=idx_get(&g_invoiceIdx, atoi(row)); if(i>=0) remove_invoice_at(i); return 0; }
+    Invoice iv; int rc=parse_invoice(row,&iv); if(rc<0) return rc;
+    Invoice *cur=find_invoice_by_id(iv.id); if(cur) update_invoice(cur, &iv); else push_invoice(&iv);
+    return rc;
+}
+
+static int save_patients(){
+    long long t0=probe_start();
+    if(g_binaryStore){ int ok=save_bin(&g_patJnl, &g_patients, g_nextPatientId, (int)offsetof(Patient, address)); probe_end_file(PROBE_SAVE_PATIENTS, t0, g_patJnl.bin); return ok; }
+    FILE *f=snap_create(&g_patJnl); if(!f) return 0;
+    char row[512];
+    for(int i=0;i<g_patients.count;i++){
+        if(!tbl_alive(&g_patients, i)) continue;
+        fmt_patient(row, sizeof row, patient_at(i)); fprintf(f, "%s\n", row);
+    }
+    int ok=snap_close(&g_patJnl, f); probe_end_file(PROBE_SAVE_PATIENTS, t0, g_patJnl.snap);
+    return ok;
+}
+
+static int save_doctors(){
+    long long t0=probe_start();
+    if(g_binaryStore){ int ok=save_bin(&g_docJnl, &g_doctors, g_nextDoctorId, -1); probe_end_file(PROBE_SAVE_DOCTORS, t0, g_docJnl.bin); return ok; }
+    FILE *f=snap_create(&g_docJnl); if(!f) return 0;
+    char row[512];
+    for(int i=0;i<g_doctors.count;i++){
+        if(!tbl_alive(&g_doctors, i)) continue;
+        fmt_doctor(row, sizeof row, doctor_at(i)); fprintf(f, "%s\n", row);
+    }
+    int ok=snap_close(&g_docJnl, f); probe_end_file(PROBE_SAVE_DOCTORS, t0, g_docJnl.snap);
+    return ok;
+}
+
+static int save_appts(){
+    long long t0=probe_start();
+    if(g_binaryStore){ int ok=save_bin(&g_apptJnl, &g_appts, g_nextApptId, (int)offsetof(Appointment, notes)); probe_end_file(PROBE_SAVE_APPTS, t0, g_apptJnl.bin); return ok; }
+    FILE *f=snap_create(&g_apptJnl); if(!f) return 0;
+    char row[768];
+    for(int i=0;i<g_appts.count;i++){
+        if(!tbl_alive(&g_appts, i)) continue;
+        fmt_appt(row, sizeof row, appt_at(i)); fprintf(f, "%s\n", row);
+    }
+    int ok=snap_close(&g_apptJnl, f); probe_end_file(PROBE_SAVE_APPTS, t0, g_apptJnl.snap);
+    return ok;
+}
+
+static int save_meds(){
+    long long t0=probe_start();
+    if(g_binaryStore){ int ok=save_bin(&g_medJnl, &g_meds, g_nextMedId, -1); probe_end_file(PROBE_SAVE_MEDS, t0, g_medJnl.bin); return ok; }
+    FILE *f=snap_create(&g_medJnl); if(!f) return 0;
+    char row[512];
+    for(int i=0;i<g_meds.count;i++){
+        if(!tbl_alive(&g_meds, i)) continue;
+        fmt_med(row, sizeof row, med_at(i)); fprintf(f, "%s\n", row);
+    }
+    int ok=snap_close(&g_medJnl, f); probe_end_file(PROBE_SAVE_MEDS, t0, g_medJnl.snap);
+    return ok;
+}
+
+static int save_invoices(){
+    long long t0=probe_start();
+    if(g_binaryStore){ int ok=save_bin(&g_invJnl, &g_invoices, g_nextInvoiceId, (int)offsetof(Invoice, description)); probe_end_file(PROBE_SAVE_INVOICES, t0, g_invJnl.bin); return ok; }
+    FILE *f=snap_create(&g_invJnl); if(!f) return 0;
+    char row[768];
+    for(int i=0;i<g_invoices.count;i++){
+        if(!tbl_alive(&g_invoices, i)) continue;
+        fmt_invoice(row, sizeof row, invoice_at(i)); fprintf(f, "%s\n", row);
+    }
+    int ok=snap_close(&g_invJnl, f); probe_end_file(PROBE_SAVE_INVOICES, t0, g_invJnl.snap);
+    return ok;
+}
+
+static int save_lots(){
+    long long t0=probe_start();
+    if(g_binaryStore){ int ok=save_bin(&g_lotJnl, &g_lots, g_nextLotId, -1); probe_end_file(PROBE_SAVE_LOTS, t0, g_lotJnl.bin); return ok; }
+    FILE *f=snap_create(&g_lotJnl); if(!f) return 0;
+    char row[128];
+    for(int i=0;i<g_lots.count;i++){
+        if(!tbl_alive(&g_lots, i)) continue;
+        fmt_lot(row, sizeof row, lot_at(i)); fprintf(f, "%s\n", row);
+    }
+    int ok=snap_close(&g_lotJnl, f); probe_end_file(PROBE_SAVE_LOTS, t0, g_lotJnl.snap);
+    return ok;
+}
+
+// Mutation hooks: append to the journal, compacting once it outgrows the table.
+static void log_patient(char op, const Patient *p){
+    char row[512];
+    if(op=='D') snprintf(row, sizeof row, "%d", p->id); else fmt_patient(row, sizeof row, p);
+    if(jnl_append(&g_patJnl, op, row, tbl_live(&g_patients))) save_patients();
+    str_maybe_gc();
+}
+
+static void log_doctor(char op, const Doctor *d){
+    char row[512];
+    if(op=='D') snprintf(row, sizeof row, "%d", d->id); else fmt_doctor(row, sizeof row, d);
+    if(jnl_append(&g_docJnl, op, row, tbl_live(&g_doctors))) save_doctors();
+}
+
+static void log_appt(char op, const Appointment *a){
+    char row[768];
+    if(op=='D') snprintf(row, sizeof row, "%d", a->id); else fmt_appt(row, sizeof row, a);
+    if(jnl_append(&g_apptJnl, op, row, tbl_live(&g_appts))) save_appts();
+    str_maybe_gc();
+}
+
+static void log_med(char op, const Medicine *m){
+    char row[512]; fmt_med(row, sizeof row, m);
+    if(jnl_append(&g_medJnl, op, row, tbl_live(&g_meds))) save_meds();
+}
+
+static void log_invoice(char op, const Invoice *iv){
+    char row[768];
+    if(op=='D') snprintf(row, sizeof row, "%d", iv->id); else fmt_invoice(row, sizeof row, iv);
+    if(jnl_append(&g_invJnl, op, row, tbl_live(&g_invoices))) save_invoices();
+    str_maybe_gc();
+}
+
+// Folds every journal into its snapshot so the next start has nothing to replay,
+// and squeezes out tombstones left by deletes. Returns the number of tables
+// whose snapshot could not be written (their journals are kept).
+static int compact_all(){
+    int failed=0;
+    if(g_patients.dead) compact_table(&g_patients, &g_patientIdx);
+    if(g_doctors.dead)  compact_table(&g_doctors, &g_doctorIdx);
+    if(g_appts.dead){    compact_table(&g_appts, &g_apptIdx); rebuild_appt_columns(NULL); }
+    if(g_invoices.dead){ compact_table(&g_invoices, &g_invoiceIdx); rebuild_invoice_columns(NULL); }
+    if(g_patJnl.pending  && !save_patients()) failed++;
+    if(g_docJnl.pending  && !save_doctors())  failed++;
+    if(g_apptJnl.pending && !save_appts())    failed++;
+    if(g_medJnl.pending  && !save_meds())     failed++;
+    if(g_invJnl.pending  && !save_invoices()) failed++;
+    if(g_lotJnl.pending  && !save_lots())     failed++;
+    return failed;
+}
+
+// --------------------- Schedule index ---------------------
+/* Interval index over live (not canceled) appointments, keyed by
+ * (doctorId, day). Each key maps to that doctor's day: start minutes sorted
+ * ascending with the matching appointment ids. Every appointment occupies
+ * APPT_SLOT_MIN minutes, so two overlap when their starts are closer than
+ * that; a booking is checked with one binary search, O(log n).
+ */
+#define APPT_SLOT_MIN   30
+#define WORKDAY_START   (8*60)
+#define WORKDAY_END     (18*60)
+#define FREE_SLOT_DAYS  366     // how far ahead next_free_slot looks
+
+typedef struct {
+    int  n, cap;
+    int *start;     // minutes after midnight, ascending
+    int *apptId;
+} DaySlots;
+
+static HashIndex g_slotIdx;        // (doctorId<<32 | day) -> g_slotDays slot
+static DaySlots *g_slotDays = NULL;
+static int       g_slotDayCount = 0, g_slotDayCap = 0;
+
+static long long slot_key(int doctorId, int day){ return ((long long)doctorId<<32) | (unsigned)day; }
+
+static DaySlots* slot_day(int doctorId, int day, int create){
+    int i=idx_get(&g_slotIdx, slot_key(doctorId, day));
+    if(i>=0) return &g_slotDays[i];
+    if(!create) return NULL;
+    if(g_slotDayCount==g_slotDayCap){
+        g_slotDayCap = g_slotDayCap ? g_slotDayCap*2 : 256;
+        g_slotDays=(DaySlots*)xrealloc(g_slotDays, g_slotDayCap*sizeof *g_slotDays);
+    }
+    DaySlots *ds=&g_slotDays[g_slotDayCount];
+    memset(ds, 0, sizeof *ds);
+    idx_put(&g_slotIdx, slot_key(doctorId, day), g_slotDayCount++);
+    return ds;
+}
+
+// First position whose start is >= minute.
+static int slot_lower_bound(const DaySlots *ds, int minute){
+    int lo=0, hi=ds->n;
+    while(lo<hi){ int mid=(lo+hi)/2; if(ds->start[mid]<minute) lo=mid+1; else hi=mid; }
+    return lo;
+}
+
+// Id of an appointment overlapping [minute, minute+APPT_SLOT_MIN), or 0.
+static int slot_conflict(int doctorId, int day, int minute){
+    const DaySlots *ds=slot_day(doctorId, day, 0); if(!ds) return 0;
+    int i=slot_lower_bound(ds, minute-APPT_SLOT_MIN+1);
+    return (i<ds->n && ds->start[i]<minute+APPT_SLOT_MIN) ? ds->apptId[i] : 0;
+}
+
+static void slot_add(int doctorId, int day, int minute, int apptId){
+    DaySlots *ds=slot_day(doctorId, day, 1);
+    if(ds->n==ds->cap){
+        ds->cap = ds->cap ? ds->cap*2 : 8;
+        ds->start=(int*)xrealloc(ds->start, ds->cap*sizeof *ds->start);
+        ds->apptId=(int*)xrealloc(ds->apptId, ds->cap*sizeof *ds->apptId);
+    }
+    int i=slot_lower_bound(ds, minute);
+    memmove(ds->start+i+1, ds->start+i, (ds->n-i)*sizeof *ds->start);
+    memmove(ds->apptId+i+1, ds->apptId+i, (ds->n-i)*sizeof *ds->apptId);
+    ds->start[i]=minute; ds->apptId[i]=apptId; ds->n++;
+}
+
+static void slot_remove(int doctorId, int day, int minute, int apptId){
+    DaySlots *ds=slot_day(doctorId, day, 0); if(!ds) return;
+    for(int i=slot_lower_bound(ds, minute); i<ds->n && ds->start[i]==minute; i++){
+        if(ds->apptId[i]!=apptId) continue;
+        memmove(ds->start+i, ds->start+i+1, (ds->n-i-1)*sizeof *ds->start);
+        memmove(ds->apptId+i, ds->apptId+i+1, (ds->n-i-1)*sizeof *ds->apptId);
+        ds->n--; return;
+    }
+}
+
+// Day and minute an appointment occupies; 0 if its date or time is missing.
+static int appt_slot(const Appointment *a, int *day, int *minute){
+    *day=a->day; *minute=a->minute;
+    return a->day!=NO_DAY && a->minute!=NO_TIME;
+}
+
+static void slot_index_appt(const Appointment *a){
+    int day, minute;
+    if(a->id && !a->canceled && appt_slot(a, &day, &minute)) slot_add(a->doctorId, day, minute, a->id);
+}
+
+static void slot_unindex_appt(const Appointment *a){
+    int day, minute;
+    if(appt_slot(a, &day, &minute)) slot_remove(a->doctorId, day, minute, a->id);
+}
+
+// Rebuilt after loading; existing double-bookings are indexed as they are.
+static void slot_rebuild(){
+    for(int i=0;i<g_slotDayCount;i++){ free(g_slotDays[i].start); free(g_slotDays[i].apptId); }
+    g_slotDayCount=0; idx_clear(&g_slotIdx);
+    for(int i=0;i<g_appts.count;i++) slot_index_appt(appt_at(i));
+}
+
+/* Earliest start >= (day, minute) inside working hours where the doctor has
+ * APPT_SLOT_MIN free minutes. Walks forward past each booking that is in the
+ * way, so the cost is O(log n + bookings skipped) per day examined.
+ */
+static int next_free_slot(int doctorId, int day, int minute, int *outDay, int *outMinute){
+    for(int d=day; d<day+FREE_SLOT_DAYS; d++, minute=0){
+        int t = minute>WORKDAY_START ? minute : WORKDAY_START;
+        const DaySlots *ds=slot_day(doctorId, d, 0);
+        if(ds){
+            for(int i=slot_lower_bound(ds, t-APPT_SLOT_MIN+1); i<ds->n && ds->start[i]<t+APPT_SLOT_MIN; i++)
+                t=ds->start[i]+APPT_SLOT_MIN;
+        }
+        if(t+APPT_SLOT_MIN<=WORKDAY_END){ *outDay=d; *outMinute=t; return 1; }
+    }
+    return 0;
+}
+
+// --------------------- Inventory ---------------------
+/* Lot-level stock. A medicine's units sit in lots (g_lots), each with its own
+ * expiry; Medicine.stock is the total on hand, and whatever part of it is in
+ * no lot (stock from before lots existed, or restocked without an expiry) is
+ * untracked and sold after every lot.
+ *
+ * Each medicine's open lots (qty > 0) form a min-heap of g_lots slots ordered
+ * by (expiry, id), so a sale takes the first-expiring units first (FEFO) at
+ * O(log n) per lot it touches. Two indexed heaps run over the medicines:
+ * Q_REORDER keyed by stock minus reorder level, so everything at or below
+ * its level sits at the top, and Q_EXPIRY keyed by each medicine's first
+ * expiry. Every medicine remembers its place in both, so a sale or restock
+ * re-keys it in O(log n), and the low-stock and expiry reports walk the heaps
+ * from the top (see Walk), touching O(k log n) entries for k results instead
+ * of scanning every row.
+ *
+ * Lots are never deleted: a sold-out lot stays in g_lots with qty 0, so lot
+ * slots never move and the heaps can hold them. In server mode sales run
+ * under the shared database lock, so several go at once: a sale holds
+ * g_stockLock shared and the lock of its own medicine (MedStock.mu) while it
+ * takes lots, and g_queueMu only for the O(log n) re-key, so sales of
+ * different medicines run in parallel. Readers of the heaps hold g_stockLock
+ * exclusive, which stops sales for the walk. Everything else that changes
+ * stock runs under the exclusive database lock and takes none of these.
+ */
+enum { Q_REORDER, Q_EXPIRY, NQUEUES };
+
+typedef struct {
+    int        medicineId;
+    int        n, cap;
+    int       *lots;            // g_lots slots of the open lots, a min-heap by (expiry, id)
+    int        lotQty;          // units in those lots
+    long long  key[NQUEUES];
+    int        pos[NQUEUES];    // place in g_medQueue[q], -1 if not queued
+#ifndef _WIN32
+    pthread_mutex_t *mu;        // held by a sale of this medicine; allocated apart so g_stock can move
+#endif
+} MedStock;
+
+typedef struct {
+    int  n, cap;
+    int *items;                 // g_stock slots, a min-heap by key
+} MedQueue;
+
+static HashIndex  g_stockIdx;   // medicineId -> g_stock slot
+static MedStock  *g_stock = NULL;
+static int        g_stockCount = 0, g_stockCap = 0;
+static MedQueue   g_medQueue[NQUEUES];
+
+#ifndef _WIN32
+#ifdef __GLIBC__
+static pthread_rwlock_t g_stockLock = PTHREAD_RWLOCK_WRITER_NONRECURSIVE_INITIALIZER_NP;   // reports are not starved by sales
+#else
+static pthread_rwlock_t g_stockLock = PTHREAD_RWLOCK_INITIALIZER;
+#endif
+static pthread_mutex_t g_queueMu = PTHREAD_MUTEX_INITIALIZER;
+#define STOCK_LOCK()    pthread_rwlock_wrlock(&g_stockLock)
+#define STOCK_SHARED()  pthread_rwlock_rdlock(&g_stockLock)
+#define STOCK_UNLOCK()  pthread_rwlock_unlock(&g_stockLock)
+#define MED_LOCK(ms)    pthread_mutex_lock((ms)->mu)
+#define MED_UNLOCK(ms)  pthread_mutex_unlock((ms)->mu)
+#define QUEUE_LOCK()    pthread_mutex_lock(&g_queueMu)
+#define QUEUE_UNLOCK()  pthread_mutex_unlock(&g_queueMu)
+#else
+#define STOCK_LOCK()    ((void)0)
+#define STOCK_SHARED()  ((void)0)
+#define STOCK_UNLOCK()  ((void)0)
+#define MED_LOCK(ms)    ((void)0)
+#define MED_UNLOCK(ms)  ((void)0)
+#define QUEUE_LOCK()    ((void)0)
+#define QUEUE_UNLOCK()  ((void)0)
+#endif
+
+// g_stock slot of a medicine, or -1. Creating one may move g_stock, so only
+// exclusive writers and the loader create.
+static int stock_slot(int medicineId, int create){
+    int i=idx_get(&g_stockIdx, medicineId);
+    if(i>=0 || !create) return i;
+    if(g_stockCount==g_stockCap){
+        g_stockCap = g_stockCap ? g_stockCap*2 : 256;
+        g_stock=(MedStock*)xrealloc(g_stock, g_stockCap*sizeof *g_stock);
+    }
+    MedStock *ms=&g_stock[g_stockCount];
+    memset(ms, 0, sizeof *ms);
+    ms->medicineId=medicineId;
+    for(int q=0;q<NQUEUES;q++) ms->pos[q]=-1;
+#ifndef _WIN32
+    ms->mu=(pthread_mutex_t*)xcalloc(1, sizeof *ms->mu); pthread_mutex_init(ms->mu, NULL);
+#endif
+    idx_put(&g_stockIdx, medicineId, g_stockCount);
+    return g_stockCount++;
+}
+
+// Lot slot a sells before lot slot b.
+static int lot_first(int a, int b){
+    const Lot *x=lot_at(a), *y=lot_at(b);
+    return x->expiry!=y->expiry ? x->expiry<y->expiry : x->id<y->id;
+}
+
+static void lots_up(MedStock *ms, int i){
+    int v=ms->lots[i];
+    while(i>0){ int p=(i-1)/2; if(!lot_first(v, ms->lots[p])) break; ms->lots[i]=ms->lots[p]; i=p; }
+    ms->lots[i]=v;
+}
+
+static void lots_down(MedStock *ms, int i){
+    int v=ms->lots[i];
+    for(;;){
+        int c=2*i+1; if(c>=ms->n) break;
+        if(c+1<ms->n && lot_first(ms->lots[c+1], ms->lots[c])) c++;
+        if(!lot_first(ms->lots[c], v)) break;
+        ms->lots[i]=ms->lots[c]; i=c;
+    }
+    ms->lots[i]=v;
+}
+
+static void lots_push(MedStock *ms, int slot){
+    if(ms->n==ms->cap){
+        ms->cap = ms->cap ? ms->cap*2 : 4;
+        ms->lots=(int*)xrealloc(ms->lots, ms->cap*sizeof *ms->lots);
+    }
+    ms->lots[ms->n++]=slot; lots_up(ms, ms->n-1);
+}
+
+static int lots_pop(MedStock *ms){
+    int top=ms->lots[0];
+    ms->lots[0]=ms->lots[--ms->n];
+    if(ms->n) lots_down(ms, 0);
+    return top;
+}
+
+static int mq_less(int q, int a, int b){
+    const MedStock *x=&g_stock[a], *y=&g_stock[b];
+    return x->key[q]!=y->key[q] ? x->key[q]<y->key[q] : x->medicineId<y->medicineId;
+}
+
+static void mq_place(int q, int i, int s){ g_medQueue[q].items[i]=s; g_stock[s].pos[q]=i; }
+
+static void mq_up(int q, int i){
+    MedQueue *h=&g_medQueue[q]; int s=h->items[i];
+    while(i>0){ int p=(i-1)/2; if(!mq_less(q, s, h->items[p])) break; mq_place(q, i, h->items[p]); i=p; }
+    mq_place(q, i, s);
+}
+
+static void mq_down(int q, int i){
+    MedQueue *h=&g_medQueue[q]; int s=h->items[i];
+    for(;;){
+        int c=2*i+1; if(c>=h->n) break;
+        if(c+1<h->n && mq_less(q, h->items[c+1], h->items[c])) c++;
+        if(!mq_less(q, h->items[c], s)) break;
+        mq_place(q, i, h->items[c]); i=c;
+    }
+    mq_place(q, i, s);
+}
+
+// Queues medicine slot s under key, or moves it there if already queued.
+static void mq_set(int q, int s, long long key){
+    MedStock *ms=&g_stock[s]; MedQueue *h=&g_medQueue[q];
+    if(ms->pos[q]>=0){
+        long long old=ms->key[q]; ms->key[q]=key;
+        if(key<old) mq_up(q, ms->pos[q]); else mq_down(q, ms->pos[q]);
+        return;
+    }
+    if(h->n==h->cap){
+        h->cap = h->cap ? h->cap*2 : 256;
+        h->items=(int*)xrealloc(h->items, h->cap*sizeof *h->items);
+    }
+    ms->key[q]=key; mq_place(q, h->n++, s); mq_up(q, h->n-1);
+}
+
+static void mq_remove(int q, int s){
+    MedQueue *h=&g_medQueue[q]; int i=g_stock[s].pos[q]; if(i<0) return;
+    g_stock[s].pos[q]=-1;
+    int last=h->items[--h->n]; if(i==h->n) return;
+    mq_place(q, i, last); mq_up(q, i); mq_down(q, g_stock[last].pos[q]);
+}
+
+// Re-keys a medicine after its stock, reorder level or first lot changed.
+static void stock_requeue(int s, const Medicine *m){
+    const MedStock *ms=&g_stock[s];
+    if(m->reorderLevel>0) mq_set(Q_REORDER, s, (long long)__atomic_load_n(&m->stock, __ATOMIC_RELAXED)-m->reorderLevel);
+    else mq_remove(Q_REORDER, s);
+    if(ms->n) mq_set(Q_EXPIRY, s, lot_at(ms->lots[0])->expiry); else mq_remove(Q_EXPIRY, s);
+}
+
+// A freshly pushed lot (exclusive writers only).
+static void stock_add_lot(int s, int slot){
+    MedStock *ms=&g_stock[s];
+    lots_push(ms, slot); ms->lotQty+=lot_at(slot)->qty;
+}
+
+/* A standby applied a record to lot slot, which held before units (0 if it
+ * is new): moves the lot into or out of its medicine's heap and re-keys the
+ * medicine. Records only change a lot's qty, so an open lot keeps its place.
+ */
+static void stock_lot_changed(int slot, int before){
+    const Lot *l=lot_at(slot);
+    int s=stock_slot(l->medicineId, 1), now = l->qty>0 ? l->qty : 0; MedStock *ms=&g_stock[s];
+    if(before<0) before=0;
+    ms->lotQty+=now-before;
+    if(!before && now) lots_push(ms, slot);
+    else if(before && !now){
+        for(int i=0;i<ms->n;i++) if(ms->lots[i]==slot){   // sold out lots are near the top
+            ms->lots[i]=ms->lots[--ms->n];
+            if(i<ms->n){ int v=ms->lots[i]; lots_up(ms, i); if(ms->lots[i]==v) lots_down(ms, i); }
+            break;
+        }
+    }
+    const Medicine *m=find_med_by_id(l->medicineId); if(m) stock_requeue(s, m);
+}
+
+typedef struct { int slot, qty; } LotTake;
+
+// Puts units taken from lots back, reopening lots that were sold out.
+static void stock_give_back(MedStock *ms, const LotTake *take, int n){
+    for(int k=n-1;k>=0;k--){
+        Lot *l=lot_at(take[k].slot);
+        l->qty+=take[k].qty; ms->lotQty+=take[k].qty;
+        if(l->qty==take[k].qty) lots_push(ms, take[k].slot);
+    }
+}
+
+/* Takes qty units of m for a sale on day: first-expiring lots first, skipping
+ * lots that expired before day, then untracked stock. Returns NULL with the
+ * lots drawn on in (*take)[0..*n), which the caller frees, or an error and
+ * changes nothing. Call with
+ * g_stockLock held, shared or not; the medicine is locked here.
+ */
+static const char* stock_take(Medicine *m, int qty, int day, LotTake **take, int *n){
+    *take=NULL; *n=0;
+    int s=stock_slot(m->id, 0); if(s<0) return "Invalid medicine.";
+    MedStock *ms=&g_stock[s];
+    MED_LOCK(ms);
+    int *aside=NULL, naside=0, cap=0;
+    while(ms->n && lot_at(ms->lots[0])->expiry<day){   // expired lots stay for the write-off
+        if(naside==cap){ cap = cap ? cap*2 : 8; aside=(int*)xrealloc(aside, cap*sizeof *aside); }
+        aside[naside++]=lots_pop(ms);
+    }
+    const char *err=NULL; int left=qty, ntake=0;
+    while(left>0 && ms->n){
+        if(*n==ntake){ ntake = ntake ? ntake*2 : 4; *take=(LotTake*)xrealloc(*take, ntake*sizeof **take); }
+        Lot *l=lot_at(ms->lots[0]); int t = l->qty<left ? l->qty : left;
+        (*take)[*n].slot=ms->lots[0]; (*take)[*n].qty=t; (*n)++;
+        l->qty-=t; ms->lotQty-=t; left-=t;
+        if(!l->qty) lots_pop(ms);
+    }
+    int stock=__atomic_load_n(&m->stock, __ATOMIC_RELAXED);
+    if(!err && left>0 && left>stock-(ms->lotQty+qty-left)) err="Insufficient stock.";   // untracked units
+    if(err){ stock_give_back(ms, *take, *n); free(*take); *take=NULL; *n=0; }
+    else __atomic_sub_fetch(&m->stock, qty, __ATOMIC_RELAXED);
+    for(int k=0;k<naside;k++) lots_push(ms, aside[k]);
+    free(aside);
+    if(!err){ QUEUE_LOCK(); stock_requeue(s, m); QUEUE_UNLOCK(); }
+    MED_UNLOCK(ms);
+    return err;
+}
+
+// Undoes stock_take when the sale could not be journaled. Call with g_stockLock held.
+static void stock_untake(Medicine *m, int qty, const LotTake *take, int n){
+    int s=stock_slot(m->id, 0); MedStock *ms=&g_stock[s];
+    MED_LOCK(ms);
+    stock_give_back(ms, take, n);
+    __atomic_add_fetch(&m->stock, qty, __ATOMIC_RELAXED);
+    QUEUE_LOCK(); stock_requeue(s, m); QUEUE_UNLOCK();
+    MED_UNLOCK(ms);
+}
+
+/* Report walks: the smallest k entries of a binary heap come out in order by
+ * keeping a small heap of candidates, seeded with the root; each pop yields
+ * the next entry and adds its two children, so k results cost O(k log k)
+ * whatever the heap's size. Expiry walks descend from Q_EXPIRY into each
+ * medicine's lot heap the same way.
+ */
+typedef struct { long long key; int tie, s, i; } WalkItem;   // s < 0: Q_* position i; else lot heap position i of g_stock[s]
+
+typedef struct { WalkItem *v; int n, cap; } Walk;
+
+static int walk_less(const WalkItem *a, const WalkItem *b){ return a->key!=b->key ? a->key<b->key : a->tie<b->tie; }
+
+static void walk_push(Walk *w, WalkItem it){
+    if(w->n==w->cap){ w->cap = w->cap ? w->cap*2 : 64; w->v=(WalkItem*)xrealloc(w->v, w->cap*sizeof *w->v); }
+    int i=w->n++;
+    while(i>0){ int p=(i-1)/2; if(!walk_less(&it, &w->v[p])) break; w->v[i]=w->v[p]; i=p; }
+    w->v[i]=it;
+}
+
+static WalkItem walk_pop(Walk *w){
+    WalkItem top=w->v[0], last=w->v[--w->n]; int i=0;
+    for(;;){
+        int c=2*i+1; if(c>=w->n) break;
+        if(c+1<w->n && walk_less(&w->v[c+1], &w->v[c])) c++;
+        if(!walk_less(&w->v[c], &last)) break;
+        w->v[i]=w->v[c]; i=c;
+    }
+    if(w->n) w->v[i]=last;
+    return top;
+}
+
+static void walk_queue(Walk *w, int q, int i){
+    if(i>=g_medQueue[q].n) return;
+    const MedStock *ms=&g_stock[g_medQueue[q].items[i]];
+    WalkItem it={ms->key[q], q==Q_EXPIRY ? lot_at(ms->lots[0])->id : ms->medicineId, -1, i};
+    walk_push(w, it);
+}
+
+static void walk_lots(Walk *w, int s, int i){
+    if(i>=g_stock[s].n) return;
+    const Lot *l=lot_at(g_stock[s].lots[i]);
+    WalkItem it={l->expiry, l->id, s, i};
+    walk_push(w, it);
+}
+
+/* Calls hit for up to k medicines at or below their reorder level, shortest
+ * (stock minus level) first; returns how many. Call with g_stockLock held.
+ */
+static int stock_low(int k, void (*hit)(int medicineId, void*), void *ctx){
+    Walk w={NULL, 0, 0}; int found=0;
+    walk_queue(&w, Q_REORDER, 0);
+    while(w.n && found<k){
+        WalkItem it=walk_pop(&w); if(it.key>0) break;
+        hit(g_stock[g_medQueue[Q_REORDER].items[it.i]].medicineId, ctx); found++;
+        walk_queue(&w, Q_REORDER, 2*it.i+1); walk_queue(&w, Q_REORDER, 2*it.i+2);
+    }
+    free(w.v); return found;
+}
+
+/* Calls hit for up to k open lots expiring on or before day (already expired
+ * ones first), earliest first; returns how many. Call with g_stockLock held.
+ */
+static int stock_expiring(int day, int k, void (*hit)(const Lot*, void*), void *ctx){
+    Walk w={NULL, 0, 0}; int found=0;
+    walk_queue(&w, Q_EXPIRY, 0);
+    while(w.n && found<k){
+        WalkItem it=walk_pop(&w); if(it.key>day) break;
+        int s = it.s<0 ? g_medQueue[Q_EXPIRY].items[it.i] : it.s, at = it.s<0 ? 0 : it.i;
+        hit(lot_at(g_stock[s].lots[at]), ctx); found++;
+        if(it.s<0){ walk_queue(&w, Q_EXPIRY, 2*it.i+1); walk_queue(&w, Q_EXPIRY, 2*it.i+2); }
+        walk_lots(&w, s, 2*at+1); walk_lots(&w, s, 2*at+2);
+    }
+    free(w.v); return found;
+}
+
+static int cmp_lot_slot(const void *a, const void *b){
+    int x=*(const int*)a, y=*(const int*)b;
+    return x==y ? 0 : lot_first(x, y) ? -1 : 1;
+}
+
+// Calls hit for a medicine's open lots in the order they sell; returns how many.
+// Call with g_stockLock held.
+static int stock_lots(int medicineId, void (*hit)(const Lot*, void*), void *ctx){
+    int s=stock_slot(medicineId, 0); if(s<0 || !g_stock[s].n) return 0;
+    const MedStock *ms=&g_stock[s];
+    int *order=(int*)xcalloc((size_t)ms->n, sizeof *order);
+    memcpy(order, ms->lots, (size_t)ms->n*sizeof *order);
+    qsort(order, (size_t)ms->n, sizeof *order, cmp_lot_slot);
+    for(int i=0;i<ms->n;i++) hit(lot_at(order[i]), ctx);
+    free(order); return ms->n;
+}
+
+// Rebuilt after loading: one entry per medicine, open lots heapified in place.
+static void stock_rebuild(){
+    for(int i=0;i<g_stockCount;i++){
+        free(g_stock[i].lots);
+#ifndef _WIN32
+        pthread_mutex_destroy(g_stock[i].mu); free(g_stock[i].mu);
+#endif
+    }
+    g_stockCount=0; idx_clear(&g_stockIdx);
+    for(int q=0;q<NQUEUES;q++) g_medQueue[q].n=0;
+    for(int i=0;i<g_meds.count;i++){ const Medicine *m=med_at(i); if(m->id) stock_slot(m->id, 1); }
+    for(int i=0;i<g_lots.count;i++){
+        const Lot *l=lot_at(i); if(!l->id || l->qty<=0) continue;
+        int s=stock_slot(l->medicineId, 0); if(s<0) continue;
+        MedStock *ms=&g_stock[s];
+        if(ms->n==ms->cap){
+            ms->cap = ms->cap ? ms->cap*2 : 4;
+            ms->lots=(int*)xrealloc(ms->lots, ms->cap*sizeof *ms->lots);
+        }
+        ms->lots[ms->n++]=i; ms->lotQty+=l->qty;
+    }
+    for(int s=0;s<g_stockCount;s++) for(int i=g_stock[s].n/2-1;i>=0;i--) lots_down(&g_stock[s], i);
+    for(int i=0;i<g_meds.count;i++){ const Medicine *m=med_at(i); if(m->id) stock_requeue(stock_slot(m->id, 0), m); }
+}
+
+// --------------------- Integrity ---------------------
+/* Referential rules for the three references between tables: an
+ * appointment's patient and doctor, and an invoice's patient. Deleting a
+ * patient or doctor applies the rule of each reference to it:
+ *   restrict  the delete is refused while any row refers to the parent
+ *   cascade   the referring rows are deleted with it
+ *   soft      if referring rows remain, the parent is only marked deleted:
+ *             it drops out of listings, searches and new references but
+ *             still resolves for the rows and reports that name it
+ * Every rule defaults to soft, which keeps history intact; HMS_REFS (e.g.
+ * "appointments.patient=cascade,invoices.patient=restrict") or the refs
+ * command changes them.
+ *
+ * The dependents come from the reverse indexes (References) and the ledger,
+ * so a delete costs O(rows it affects), never a scan of the child tables. A
+ * cascade journals the dependents before the parent: a crash part way
+ * leaves the parent with fewer dependents, never an orphan. Orphans already
+ * on disk, from before these rules or edited files, are counted at load and
+ * reported.
+ */
+enum { REF_APPT_PATIENT, REF_APPT_DOCTOR, REF_INVOICE_PATIENT, NREFS };
+enum { REF_RESTRICT, REF_CASCADE, REF_SOFT };
+
+typedef struct {
+    const char *name;          // <child table>.<parent>
+    const char *busy;          // refusal message under restrict
+    int         action;        // REF_*
+    long long   orphans;       // rows found pointing at a missing parent at load
+    int         firstOrphan;   // id of the first such row
+} RefRule;
+
+static RefRule g_refRules[NREFS]={
+    {"appointments.patient", "The patient has appointments.", REF_SOFT, 0, 0},
+    {"appointments.doctor",  "The doctor has appointments.",  REF_SOFT, 0, 0},
+    {"invoices.patient",     "The patient has invoices.",     REF_SOFT, 0, 0},
+};
+static const char *g_refActions[]={"restrict", "cascade", "soft"};
+
+// Sets rule `name` to `action`; returns 0 if either is unknown.
+static int ref_set(const char *name, const char *action){
+    for(int r=0;r<NREFS;r++){
+        if(strcmp(g_refRules[r].name, name)!=0) continue;
+        for(int a=0;a<3;a++) if(!strcmp(g_refActions[a], action)){ g_refRules[r].action=a; return 1; }
+        return 0;
+    }
+    return 0;
+}
+
+// Reads HMS_REFS: comma-separated name=action pairs.
+static void refs_config(){
+    const char *env=getenv("HMS_REFS"); if(!env) return;
+    char buf[256]; snprintf(buf, sizeof buf, "%s", env);
+    for(char *tok=strtok(buf, ","); tok; tok=strtok(NULL, ",")){
+        char *eq=strchr(tok, '=');
+        if(eq) *eq='\0';
+        if(!eq || !ref_set(tok, eq+1)) fprintf(stderr, "HMS_REFS: ignoring '%s'\n", tok);
+    }
+}
+
+// The appointments still referring to parentId under rule r, stale entries dropped.
+static RefList* appt_refs(int r, int parentId){
+    RefList *l=ref_list(r==REF_APPT_DOCTOR ? &g_doctorAppts : &g_patientAppts, parentId, 0);
+    if(!l) return NULL;
+    int w=0;
+    for(int k=0;k<l->n;k++){
+        int i=idx_get(&g_apptIdx, l->ids[k]); if(i<0) continue;
+        const Appointment *a=appt_at(i);
+        if((r==REF_APPT_DOCTOR ? a->doctorId : a->patientId)==parentId) l->ids[w++]=l->ids[k];
+    }
+    l->n=w;
+    return l;
+}
+
+static int ref_count(int r, int parentId){
+    if(r==REF_INVOICE_PATIENT){ const PatientLedger *l=ledger_of(parentId, 0); return l ? l->n : 0; }
+    const RefList *l=appt_refs(r, parentId);
+    return l ? l->n : 0;
+}
+
+// Deletes every row referring to parentId under rule r.
+static void ref_cascade(int r, int parentId){
+    if(r==REF_INVOICE_PATIENT){
+        PatientLedger *l=ledger_of(parentId, 0); if(!l) return;
+        int n=l->n; l->n=0; l->balance=0;   // emptied first, so remove_invoice_at has nothing to unlink
+        for(int k=0;k<n;k++){
+            int i=idx_get(&g_invoiceIdx, l->invoiceIds[k]); if(i<0) continue;
+            Invoice gone=*invoice_at(i);
+            remove_invoice_at(i); log_invoice('D', &gone);
+        }
+        return;
+    }
+    RefList *l=appt_refs(r, parentId); if(!l) return;
+    int n=l->n; l->n=0;
+    for(int k=0;k<n;k++){
+        int i=idx_get(&g_apptIdx, l->ids[k]); if(i<0) continue;
+        Appointment gone=*appt_at(i);
+        remove_appt_at(i); log_appt('D', &gone);
+    }
+}
+
+/* Applies the rules in rules[0..n) to deleting parentId: refuses (returning
+ * the message) if a restrict rule has rows, runs the cascades, and sets
+ * *soft when a soft rule still has rows, in which case the caller marks the
+ * parent deleted instead of removing it.
+ */
+static const char* ref_delete(const int *rules, int n, int parentId, int *soft){
+    *soft=0;
+    for(int k=0;k<n;k++){
+        const RefRule *r=&g_refRules[rules[k]];
+        if(r->action==REF_RESTRICT && ref_count(rules[k], parentId)) return r->busy;
+    }
+    for(int k=0;k<n;k++) if(g_refRules[rules[k]].action==REF_CASCADE) ref_cascade(rules[k], parentId);
+    for(int k=0;k<n;k++) if(g_refRules[rules[k]].action==REF_SOFT && ref_count(rules[k], parentId)) *soft=1;
+    return NULL;
+}
+
+static void ref_orphan(int r, int childId){
+    if(!g_refRules[r].orphans++) g_refRules[r].firstOrphan=childId;
+}
+
+// Rebuilt after loading, counting the orphans on the way.
+static void ref_rebuild(){
+    ref_clear(&g_patientAppts); ref_clear(&g_doctorAppts);
+    for(int r=0;r<NREFS;r++){ g_refRules[r].orphans=0; g_refRules[r].firstOrphan=0; }
+    for(int i=0;i<g_appts.count;i++){
+        const Appointment *a=appt_at(i); if(!a->id) continue;
+        ref_add(&g_patientAppts, a->patientId, a->id); ref_add(&g_doctorAppts, a->doctorId, a->id);
+        if(idx_get(&g_patientIdx, a->patientId)<0) ref_orphan(REF_APPT_PATIENT, a->id);
+        if(idx_get(&g_doctorIdx, a->doctorId)<0) ref_orphan(REF_APPT_DOCTOR, a->id);
+    }
+    for(int i=0;i<g_invoices.count;i++){
+        const Invoice *iv=invoice_at(i);
+        if(iv->id && idx_get(&g_patientIdx, iv->patientId)<0) ref_orphan(REF_INVOICE_PATIENT, iv->id);
+    }
+}
+
+static void ref_report(){
+    for(int r=0;r<NREFS;r++){
+        const RefRule *rr=&g_refRules[r];
+        if(rr->orphans) fprintf(stderr, "%s: %lld row(s) refer to a missing parent (first: id %d)\n", rr->name, rr->orphans, rr->firstOrphan);
+    }
+}
+
+// --------------------- Wards ---------------------
+/* Admissions. Room n of ward w is room number w*ROOM_STRIDE+n, n counting
+ * from 1; HMS_WARDS lists the rooms of each ward ("30,30,12" is wards 1-3,
+ * default WARDS_DEFAULT wards of WARD_ROOMS_DEFAULT). A room holds one
+ * patient. What persists is the patient row: admitted, roomNo and since, the
+ * day of the last admission, transfer or discharge, so each move is one
+ * journal record. The rest is rebuilt at load and kept up by the ops:
+ *   - per ward, a bitmap of its free rooms, and one of the wards that have
+ *     any, so a vacancy is the lowest set bit of a word or two;
+ *   - per room, its occupant and a timeline of stays. The timeline starts
+ *     with the current stay at load; earlier ones are not kept on disk.
+ * Admitted patients whose room does not exist or is already taken are
+ * counted at load and reported, and stay out of the bitmaps.
+ */
+#define ROOM_STRIDE        100
+#define WARD_ROOMS_MAX     (ROOM_STRIDE-1)
+#define WARD_MAX           99
+#define WARD_WORDS         ((WARD_ROOMS_MAX+63)/64)
+#define WARDS_DEFAULT      5
+#define WARD_ROOMS_DEFAULT 40
+
+typedef struct {
+    int patientId;
+    int from, to;              // days; to = NO_DAY while the stay goes on
+} Stay;
+
+typedef struct {
+    int   occupant;            // patient id, 0 = free
+    int   n, cap;
+    Stay *stays;               // oldest first
+} Room;
+
+typedef struct {
+    int rooms, free;
+    unsigned long long freeBits[WARD_WORDS];   // bit n-1 set: room n is free
+    Room room[WARD_ROOMS_MAX];
+} Ward;
+
+static Ward g_wards[WARD_MAX+1];             // [0] unused
+static int  g_nwards = 0;                    // highest configured ward
+static unsigned long long g_wardsFree[(WARD_MAX+63)/64];   // bit w-1 set: ward w has a free room
+static long long g_roomConflicts = 0;        // admitted patients found without a room of their own
+static int g_firstConflict = 0;
+
+static int bit_first(const unsigned long long *words, int n){
+    for(int k=0;k<n;k++) if(words[k]) return k*64+__builtin_ctzll(words[k]);
+    return -1;
+}
+static void bit_set(unsigned long long *words, int i)  { words[i/64] |= 1ULL<<(i%64); }
+static void bit_clear(unsigned long long *words, int i){ words[i/64] &= ~(1ULL<<(i%64)); }
+
+// Reads HMS_WARDS: comma-separated room counts, one per ward from ward 1.
+static void wards_config(){
+    const char *env=getenv("HMS_WARDS");
+    g_nwards=0;
+    if(env){
+        char buf[512]; snprintf(buf, sizeof buf, "%s", env);
+        for(char *tok=strtok(buf, ","); tok && g_nwards<WARD_MAX; tok=strtok(NULL, ",")){
+            int rooms=atoi(tok);
+            if(rooms<0 || rooms>WARD_ROOMS_MAX){ fprintf(stderr, "HMS_WARDS: ward %d gets 0..%d rooms, not '%s'\n", g_nwards+1, WARD_ROOMS_MAX, tok); rooms=0; }
+            g_wards[++g_nwards].rooms=rooms;
+        }
+    }
+    if(!g_nwards) for(g_nwards=0; g_nwards<WARDS_DEFAULT; ) g_wards[++g_nwards].rooms=WARD_ROOMS_DEFAULT;
+}
+
+// The room numbered roomNo, with its ward and place in it, or NULL.
+static Room* room_of(int roomNo, int *w, int *n){
+    if(roomNo<ROOM_STRIDE) return NULL;
+    *w=roomNo/ROOM_STRIDE; *n=roomNo%ROOM_STRIDE;
+    if(*w>g_nwards || *n<1 || *n>g_wards[*w].rooms) return NULL;
+    return &g_wards[*w].room[*n-1];
+}
+
+// First free room of ward w, or 0.
+static int ward_vacancy(int w){ return bit_first(g_wards[w].freeBits, WARD_WORDS)+1; }
+
+static void room_take(int w, int n, int patientId, int day){
+    Ward *wd=&g_wards[w]; Room *r=&wd->room[n-1];
+    r->occupant=patientId;
+    bit_clear(wd->freeBits, n-1);
+    if(!--wd->free) bit_clear(g_wardsFree, w-1);
+    if(r->n==r->cap){ r->cap = r->cap ? r->cap*2 : 4; r->stays=(Stay*)xrealloc(r->stays, r->cap*sizeof *r->stays); }
+    Stay st={patientId, day, NO_DAY}; r->stays[r->n++]=st;
+}
+
+static void room_leave(int w, int n, int day){
+    Ward *wd=&g_wards[w]; Room *r=&wd->room[n-1];
+    r->occupant=0;
+    bit_set(wd->freeBits, n-1);
+    if(!wd->free++) bit_set(g_wardsFree, w-1);
+    if(r->n) r->stays[r->n-1].to=day;
+}
+
+static void room_conflict(int patientId){
+    if(!g_roomConflicts++) g_firstConflict=patientId;
+}
+
+/* Moves the room state from patient row `before` to `after` (either may be
+ * NULL: added or removed). Rows that replay or replication rewrite go
+ * through here as well as the ops.
+ */
+static void ward_sync(const Patient *before, const Patient *after){
+    if(before && after && before->admitted==after->admitted && before->roomNo==after->roomNo &&
+       before->since==after->since && before->deleted==after->deleted) return;
+    int w, n, day = after && after->since!=NO_DAY ? after->since : today_day();
+    Room *r;
+    if(before && before->admitted && !before->deleted && (r=room_of(before->roomNo, &w, &n))!=NULL && r->occupant==before->id) room_leave(w, n, day);
+    if(after && after->admitted && !after->deleted){
+        if((r=room_of(after->roomNo, &w, &n))!=NULL && !r->occupant) room_take(w, n, after->id, day);
+        else room_conflict(after->id);
+    }
+}
+
+/* Picks room roomNo, or else the first free room of ward, or of any ward
+ * when ward is 0 too. Returns NULL with *w and *n set, or why not.
+ */
+static const char* ward_pick(int ward, int roomNo, int *w, int *n){
+    if(roomNo){
+        const Room *r=room_of(roomNo, w, n);
+        if(!r) return "No such room.";
+        return r->occupant ? "Room is occupied." : NULL;
+    }
+    if(ward<0 || ward>g_nwards || (ward && !g_wards[ward].rooms)) return "No such ward.";
+    *w = ward ? ward : bit_first(g_wardsFree, (WARD_MAX+63)/64)+1;
+    if(*w<1 || !g_wards[*w].free) return ward ? "No free room on that ward." : "No free room.";
+    *n=ward_vacancy(*w);
+    return NULL;
+}
+
+// Rebuilt after loading, counting the conflicts on the way.
+static void ward_rebuild(){
+    memset(g_wardsFree, 0, sizeof g_wardsFree);
+    g_roomConflicts=0; g_firstConflict=0;
+    for(int w=1;w<=g_nwards;w++){
+        Ward *wd=&g_wards[w];
+        memset(wd->freeBits, 0, sizeof wd->freeBits);
+        for(int n=1;n<=wd->rooms;n++){ bit_set(wd->freeBits, n-1); wd->room[n-1].occupant=0; wd->room[n-1].n=0; }
+        wd->free=wd->rooms;
+        if(wd->free) bit_set(g_wardsFree, w-1);
+    }
+    for(int i=0;i<g_patients.count;i++){ const Patient *p=patient_at(i); if(p->id) ward_sync(NULL, p); }
+}
+
+static void ward_report(){
+    if(g_roomConflicts) fprintf(stderr, "wards: %lld admitted patient(s) in a missing or shared room (first: id %d)\n", g_roomConflicts, g_firstConflict);
+}
+
+// --------------------- Operations ---------------------
+/* Validated mutations shared by the menus and batch mode. Each one checks its
+ * input, applies the change through the Tables helpers, logs it and returns
+ * NULL, or returns a message and leaves everything untouched.
+ *
+ * In server mode everything except op_sell_med runs under the exclusive
+ * database lock. Sales run under the shared one so several counters can sell
+ * at once: stock is taken under the lock of the one medicine sold (see
+ * Inventory), and the invoice table, ledger and invoice ids are guarded by
+ * g_billingLock, which invoice readers take shared.
+ */
+#ifndef _WIN32
+static pthread_rwlock_t g_billingLock = PTHREAD_RWLOCK_INITIALIZER;
+#define BILLING_READ()   pthread_rwlock_rdlock(&g_billingLock)
+#define BILLING_WRITE()  pthread_rwlock_wrlock(&g_billingLock)
+#define BILLING_UNLOCK() pthread_rwlock_unlock(&g_billingLock)
+#else
+#define BILLING_READ()   ((void)0)
+#define BILLING_WRITE()  ((void)0)
+#define BILLING_UNLOCK() ((void)0)
+#endif
+
+static int g_concurrentSales = 0;   // server: sales may not compact; they set g_txnCompactDue
+static int g_txnCompactDue = 0;
+
+// Saves every table that still needs txn.jnl, which then gets truncated.
+static void txn_compact(){
+    if(g_medJnl.txnSeq>g_medJnl.snapSeq) save_meds();
+    if(g_invJnl.txnSeq>g_invJnl.snapSeq) save_invoices();
+    if(g_lotJnl.txnSeq>g_lotJnl.snapSeq) save_lots();
+}
+
+static const char* op_add_patient(Patient *p){
+    long long t0=probe_start();
+    p->id=g_nextPatientId++; p->admitted=0; p->roomNo=-1; p->since=NO_DAY;   // see op_admit
+    push_patient(p); log_patient('I',p);
+    probe_end(PROBE_OP_ADD_PATIENT, t0, 0);
+    return NULL;
+}
+
+static const char* op_edit_patient(const Patient *u){
+    long long t0=probe_start();
+    Patient *p=live_patient(u->id); if(!p) return "Not found.";
+    Patient e=*u; e.admitted=p->admitted; e.roomNo=p->roomNo; e.since=p->since;   // rooms change only through op_admit and co.
+    update_patient(p, &e); log_patient('U',p);
+    probe_end(PROBE_OP_EDIT_PATIENT, t0, 0);
+    return NULL;
+}
+
+// Deletes, soft-deletes or refuses under the patient's rules (see Integrity).
+static const char* op_delete_patient(int id){
+    long long t0=probe_start();
+    static const int rules[]={REF_APPT_PATIENT, REF_INVOICE_PATIENT};
+    int idx=idx_get(&g_patientIdx, id), soft; if(idx<0 || patient_at(idx)->deleted) return "Not found.";
+    if(patient_at(idx)->admitted) return "The patient is admitted; discharge first.";
+    const char *err=ref_delete(rules, 2, id, &soft); if(err) return err;
+    Patient gone=*patient_at(idx);
+    if(soft){ patient_at(idx)->deleted=1; log_patient('U', patient_at(idx)); }
+    else { remove_patient_at(idx); log_patient('D',&gone); }
+    probe_end(PROBE_OP_DELETE_PATIENT, t0, 0);
+    return NULL;
+}
+
+// Sets the patient's room state and journals it as one patient record (see Wards).
+static void ward_move(Patient *p, int admitted, int roomNo, int day){
+    Patient before=*p;
+    p->admitted=(unsigned char)admitted; p->roomNo=roomNo; p->since=day;
+    ward_sync(&before, p); log_patient('U', p);
+}
+
+/* Admits patient id on day to room roomNo, or to the first free room of
+ * ward, or of any ward when both are 0 (see ward_pick).
+ */
+static const char* op_admit(int id, int ward, int roomNo, int day){
+    long long t0=probe_start();
+    Patient *p=live_patient(id); if(!p) return "Not found.";
+    if(p->admitted) return "The patient is already admitted.";
+    if(day==NO_DAY) return "Invalid date. Use YYYY-MM-DD.";
+    int w, n; const char *err=ward_pick(ward, roomNo, &w, &n); if(err) return err;
+    ward_move(p, 1, w*ROOM_STRIDE+n, day);
+    probe_end(PROBE_OP_ADMIT, t0, 0);
+    return NULL;
+}
+
+// Moves an admitted patient on day, choosing the room as op_admit does.
+static const char* op_transfer(int id, int ward, int roomNo, int day){
+    long long t0=probe_start();
+    Patient *p=live_patient(id); if(!p) return "Not found.";
+    if(!p->admitted) return "The patient is not admitted.";
+    if(day==NO_DAY) return "Invalid date. Use YYYY-MM-DD.";
+    if(p->since!=NO_DAY && day<p->since) return "That is before the patient's last move.";
+    if(roomNo && roomNo==p->roomNo) return "The patient is already in that room.";
+    int w, n; const char *err=ward_pick(ward, roomNo, &w, &n); if(err) return err;
+    ward_move(p, 1, w*ROOM_STRIDE+n, day);
+    probe_end(PROBE_OP_TRANSFER, t0, 0);
+    return NULL;
+}
+
+static const char* op_discharge(int id, int day){
+    long long t0=probe_start();
+    Patient *p=live_patient(id); if(!p) return "Not found.";
+    if(!p->admitted) return "The patient is not admitted.";
+    if(day==NO_DAY) return "Invalid date. Use YYYY-MM-DD.";
+    if(p->since!=NO_DAY && day<p->since) return "That is before the patient's last move.";
+    ward_move(p, 0, -1, day);
+    probe_end(PROBE_OP_DISCHARGE, t0, 0);
+    return NULL;
+}
+
+static const char* op_add_doctor(Doctor *d){
+    long long t0=probe_start();
+    d->id=g_nextDoctorId++;
+    push_doctor(d); log_doctor('I',d);
+    probe_end(PROBE_OP_ADD_DOCTOR, t0, 0);
+    return NULL;
+}
+
+static const char* op_edit_doctor(const Doctor *u){
+    long long t0=probe_start();
+    Doctor *d=live_doctor(u->id); if(!d) return "Not found.";
+    update_doctor(d, u); log_doctor('U',d);
+    probe_end(PROBE_OP_EDIT_DOCTOR, t0, 0);
+    return NULL;
+}
+
+static const char* op_delete_doctor(int id){
+    long long t0=probe_start();
+    static const int rules[]={REF_APPT_DOCTOR};
+    int idx=idx_get(&g_doctorIdx, id), soft; if(idx<0 || doctor_at(idx)->deleted) return "Not found.";
+    const char *err=ref_delete(rules, 1, id, &soft); if(err) return err;
+    Doctor gone=*doctor_at(idx);
+    if(soft){ doctor_at(idx)->deleted=1; log_doctor('U', doctor_at(idx)); }
+    else { remove_doctor_at(idx); log_doctor('D',&gone); }
+    probe_end(PROBE_OP_DELETE_DOCTOR, t0, 0);
+    return NULL;
+}
+
+static const char* op_schedule_appt(Appointment *a){
+    long long t0=probe_start();
+    if(!live_patient(a->patientId)) return "Invalid patient.";
+    if(!live_doctor(a->doctorId)) return "Invalid doctor.";
+    if(a->day==NO_DAY) return "Invalid date. Use YYYY-MM-DD.";
+    if(a->minute<0 || a->minute>=24*60) return "Invalid time. Use HH:MM.";
+    if(slot_conflict(a->doctorId, a->day, a->minute)) return "Doctor is already booked then.";
+    a->id=g_nextApptId++; a->canceled=0;
+    push_appt(a); slot_add(a->doctorId, a->day, a->minute, a->id); log_appt('I',a);
+    probe_end(PROBE_OP_SCHEDULE_APPT, t0, 0);
+    return NULL;
+}
+
+static const char* op_cancel_appt(int id){
+    long long t0=probe_start();
+    Appointment *a=find_appt_by_id(id); if(!a) return "Not found.";
+    if(a->canceled) return "Already canceled.";
+    Appointment c=*a; c.canceled=1;
+    slot_unindex_appt(a); update_appt(a, &c); log_appt('U',a);
+    probe_end(PROBE_OP_CANCEL_APPT, t0, 0);
+    return NULL;
+}
+
+/* Adds qty units to a medicine. With an expiry they arrive as a new lot,
+ * journaled in txn.jnl together with the stock adjustment; with NO_DAY they
+ * are untracked stock.
+ */
+static const char* op_restock_med(int id, int qty, int expiry){
+    long long t0=probe_start();
+    Medicine *m=find_med_by_id(id); if(!m) return "Not found.";
+    if(qty<0 || (expiry!=NO_DAY && qty==0)) return "Invalid.";
+    if(expiry!=NO_DAY && expiry<today_day()) return "That lot has already expired.";
+    int s=stock_slot(id, 1);
+    if(expiry==NO_DAY){
+        m->stock += qty; log_med('U',m);
+    } else {
+        Lot l={0}; l.id=g_nextLotId; l.medicineId=id; l.expiry=expiry; l.qty=qty;
+        char row[128], adj[32]; fmt_lot(row, sizeof row, &l); snprintf(adj, sizeof adj, "%d|%d", id, qty);
+        TxnPart parts[2]={{&g_lotJnl, 'I', row}, {&g_medJnl, 'A', adj}};
+        int due;
+        if(!jnl_append_txn(parts, 2, tbl_live(&g_lots), &due)) return "Could not write the journal.";
+        push_lot(&l); stock_add_lot(s, g_lots.count-1);
+        __atomic_add_fetch(&m->stock, qty, __ATOMIC_RELAXED);
+        if(due) txn_compact();
+    }
+    stock_requeue(s, m);
+    probe_end(PROBE_OP_RESTOCK_MED, t0, 0);
+    return NULL;
+}
+
+/* The initial stock goes in as a lot when expiry is given, else untracked.
+ * A medicine with a lot is journaled in txn.jnl together with it, so a
+ * failed write leaves neither behind.
+ */
+static const char* op_add_med(Medicine *m, int expiry){
+    long long t0=probe_start();
+    if(m->stock<0 || m->reorderLevel<0) return "Invalid.";
+    if(expiry!=NO_DAY && m->stock>0 && expiry<today_day()) return "That lot has already expired.";
+    if(expiry==NO_DAY || m->stock==0){
+        m->id=g_nextMedId++;
+        Medicine *row=push_med(m); log_med('I',m);
+        stock_requeue(stock_slot(m->id, 1), row);
+    } else {
+        m->id=g_nextMedId;
+        Lot l={0}; l.id=g_nextLotId; l.medicineId=m->id; l.expiry=expiry; l.qty=m->stock;
+        char medRow[512], lotRow[128]; fmt_med(medRow, sizeof medRow, m); fmt_lot(lotRow, sizeof lotRow, &l);
+        TxnPart parts[2]={{&g_medJnl, 'I', medRow}, {&g_lotJnl, 'I', lotRow}};
+        int due;
+        if(!jnl_append_txn(parts, 2, tbl_live(&g_meds), &due)){ m->id=0; return "Could not write the journal."; }
+        Medicine *row=push_med(m); push_lot(&l);
+        int s=stock_slot(m->id, 1); stock_add_lot(s, g_lots.count-1); stock_requeue(s, row);
+        if(due) txn_compact();
+    }
+    probe_end(PROBE_OP_ADD_MED, t0, 0);
+    return NULL;
+}
+
+static const char* op_set_reorder(int id, int level){
+    long long t0=probe_start();
+    Medicine *m=find_med_by_id(id); if(!m) return "Not found.";
+    if(level<0) return "Invalid.";
+    m->reorderLevel=level; log_med('U',m);
+    stock_requeue(stock_slot(id, 1), m);
+    probe_end(PROBE_OP_SET_REORDER, t0, 0);
+    return NULL;
+}
+
+/* Empties every open lot that expired before day, earliest first, each as
+ * its own txn.jnl group (lot and stock adjustment; just the lot when its
+ * medicine is gone). Counts what went in *lots and *units, also when a
+ * journal write fails part way.
+ */
+static const char* op_writeoff_expired(int day, int *lots, int *units){
+    long long t0=probe_start();
+    *lots=*units=0;
+    MedQueue *h=&g_medQueue[Q_EXPIRY];
+    while(h->n && g_stock[h->items[0]].key[Q_EXPIRY]<day){
+        int s=h->items[0]; MedStock *ms=&g_stock[s];
+        Lot *l=lot_at(ms->lots[0]); Medicine *m=find_med_by_id(ms->medicineId);
+        char ladj[32], madj[32]; int qty=l->qty;
+        snprintf(ladj, sizeof ladj, "%d|%d", l->id, -qty); snprintf(madj, sizeof madj, "%d|%d", ms->medicineId, -qty);
+        TxnPart parts[2]={{&g_lotJnl, 'A', ladj}, {&g_medJnl, 'A', madj}};
+        int due;
+        if(!jnl_append_txn(parts, m ? 2 : 1, tbl_live(&g_lots), &due)) return "Could not write the journal.";
+        lots_pop(ms); ms->lotQty-=qty; l->qty=0;
+        if(m){ __atomic_sub_fetch(&m->stock, qty, __ATOMIC_RELAXED); stock_requeue(s, m); }
+        else if(ms->n) mq_set(Q_EXPIRY, s, lot_at(ms->lots[0])->expiry);   // its other lots still drain
+        else mq_remove(Q_EXPIRY, s);
+        (*lots)++; *units+=qty;
+        if(due) txn_compact();
+    }
+    probe_end(PROBE_OP_WRITEOFF, t0, 0);
+    return NULL;
+}
+
+static const char* op_add_invoice(Invoice *iv){
+    long long t0=probe_start();
+    if(!live_patient(iv->patientId)) return "Invalid patient.";
+    iv->id=g_nextInvoiceId++; if(iv->day==NO_DAY) iv->day=today_day();
+    push_invoice(iv); log_invoice('I',iv);
+    probe_end(PROBE_OP_ADD_INVOICE, t0, 0);
+    return NULL;
+}
+
+/* Takes qty out of stock (FEFO, see stock_take) and bills it to the patient
+ * in *iv, as one transaction: the stock adjustment, one adjustment per lot
+ * drawn on and the invoice are journaled together in txn.jnl before the
+ * invoice is added, and a failed write gives the units back. Adjustments
+ * are logged as deltas ("A"), so concurrent sales can reach the journal in
+ * any order.
+ */
+static const char* op_sell_med(int pid, int mid, int qty, Invoice *iv){
+    long long t0=probe_start();
+    if(!live_patient(pid)) return "Invalid patient.";
+    Medicine *m=find_med_by_id(mid); if(!m) return "Invalid medicine.";
+    if(qty<=0) return "Invalid quantity.";
+    int today=today_day(), nt; LotTake *take;
+    STOCK_SHARED();
+    const char *err=stock_take(m, qty, today, &take, &nt);
+    STOCK_UNLOCK();
+    if(err) return err;
+
+    char desc[DESC_LEN]; snprintf(desc, sizeof desc, "Medicine: %s x %d", m->name, qty);
+    memset(iv, 0, sizeof *iv); iv->patientId=pid; iv->amount=m->price*qty; iv->description=str_intern(desc);
+    char adj[32], (*lotAdj)[32]=(char(*)[32])xcalloc((size_t)nt+1, 32), row[768];
+    snprintf(adj, sizeof adj, "%d|%d", mid, -qty);
+    TxnPart *parts=(TxnPart*)xcalloc((size_t)nt+2, sizeof *parts);   // as many lots as the sale spans
+    parts[0].j=&g_medJnl; parts[0].op='A'; parts[0].row=adj;
+    for(int k=0;k<nt;k++){
+        snprintf(lotAdj[k], sizeof lotAdj[k], "%d|%d", lot_at(take[k].slot)->id, -take[k].qty);
+        parts[k+1].j=&g_lotJnl; parts[k+1].op='A'; parts[k+1].row=lotAdj[k];
+    }
+    BILLING_WRITE();
+    iv->id=g_nextInvoiceId++; iv->day=today;
+    fmt_invoice(row, sizeof row, iv);
+    parts[nt+1].j=&g_invJnl; parts[nt+1].op='I'; parts[nt+1].row=row;
+    int due, ok=jnl_append_txn(parts, nt+2, tbl_live(&g_invoices), &due);
+    if(ok) push_invoice(iv);
+    BILLING_UNLOCK();
+    free(parts); free(lotAdj);
+    if(!ok){
+        STOCK_SHARED(); stock_untake(m, qty, take, nt); STOCK_UNLOCK();
+        free(take);
+        return "Could not write the journal.";
+    }
+    free(take);
+    if(due){
+        if(g_concurrentSales) __atomic_store_n(&g_txnCompactDue, 1, __ATOMIC_RELEASE);
+        else txn_compact();
+    }
+    probe_end(PROBE_OP_SELL_MED, t0, 0);
+    return NULL;
+}
+
+// --------------------- Listing ---------------------
+/* Listings and exports format rows into one large OutBuf that goes out in a
+ * single fwrite per page (console) or per megabyte (files), instead of a
+ * printf per row. Filters test the column mirrors before touching a record,
+ * and a page resumes from the slot where the previous one stopped, so paging
+ * through a table is one pass however many pages are shown.
+ */
+#define OUT_BUF_CAP     (1<<20)
+#define LIST_PAGE       50      // rows per console page, and the list commands' default limit
+#define LIST_LIMIT_MAX  10000   // most rows one list command returns
+
+typedef struct {
+    FILE   *f;
+    char   *buf;
+    size_t  len, cap;
+    long long written;
+    int     err;      // a write failed
+} OutBuf;
+
+static void ob_open(OutBuf *o, FILE *f){
+    o->f=f; o->cap=OUT_BUF_CAP; o->buf=(char*)xrealloc(NULL, o->cap); o->len=0; o->written=0; o->err=0;
+}
+
+static void ob_flush(OutBuf *o){
+    if(o->len && fwrite(o->buf, 1, o->len, o->f)!=o->len) o->err=1;
+    o->written+=(long long)o->len; o->len=0;
+}
+
+// Room for n more bytes at the end of the buffer; n is at most a row.
+static char* ob_room(OutBuf *o, size_t n){
+    if(o->len+n>o->cap) ob_flush(o);
+    return o->buf+o->len;
+}
+
+static void ob_put(OutBuf *o, const char *s, size_t n){ memcpy(ob_room(o, n), s, n); o->len+=n; }
+static void ob_puts(OutBuf *o, const char *s)         { ob_put(o, s, strlen(s)); }
+static void ob_char(OutBuf *o, char c)                { *ob_room(o, 1)=c; o->len++; }
+
+static void ob_printf(OutBuf *o, const char *fmt, ...){
+    for(int pass=0;pass<2;pass++){
+        size_t room=o->cap-o->len; va_list ap;
+        va_start(ap, fmt); int n=vsnprintf(o->buf+o->len, room, fmt, ap); va_end(ap);
+        if(n<0) return;
+        if((size_t)n<room){ o->len+=n; return; }
+        if(pass){ o->len=o->cap-1; return; }   // longer than the whole buffer: truncated
+        ob_flush(o);
+    }
+}
+
+static void ob_uint(OutBuf *o, unsigned long long v, int width){
+    char t[24]; int n=0;
+    do t[n++]=(char)('0'+v%10); while((v/=10) || n<width);
+    char *p=ob_room(o, n); for(int i=0;i<n;i++) p[i]=t[n-1-i];
+    o->len+=n;
+}
+
+static void ob_int(OutBuf *o, long long v){
+    if(v<0){ ob_char(o, '-'); ob_uint(o, 0ULL-(unsigned long long)v, 1); } else ob_uint(o, (unsigned long long)v, 1);
+}
+
+// Same text as fmt_money / fmt_date / fmt_time, without going through snprintf.
+static void ob_money(OutBuf *o, Money c){
+    unsigned long long a = c<0 ? 0ULL-(unsigned long long)c : (unsigned long long)c;
+    if(c<0) ob_char(o, '-');
+    ob_uint(o, a/100, 1); ob_char(o, '.'); ob_uint(o, a%100, 2);
+}
+
+static void ob_date(OutBuf *o, int day){
+    if(day==NO_DAY) return;
+    int y, m, d; civil_from_days(day, &y, &m, &d);
+    ob_uint(o, (unsigned)y, 4); ob_char(o, '-'); ob_uint(o, (unsigned)m, 2); ob_char(o, '-'); ob_uint(o, (unsigned)d, 2);
+}
+
+static void ob_time(OutBuf *o, int minute){
+    if(minute<0) return;
+    unsigned m=(unsigned)minute%(24*60);
+    ob_uint(o, m/60, 2); ob_char(o, ':'); ob_uint(o, m%60, 2);
+}
+
+// Flushes and releases the buffer (not the stream); returns 0, or -1 if any write failed.
+static int ob_close(OutBuf *o){
+    ob_flush(o);
+    if(fflush(o->f)) o->err=1;
+    free(o->buf); o->buf=NULL;
+    return o->err ? -1 : 0;
+}
+
+enum { LIST_PATIENTS, LIST_APPTS, LIST_INVOICES };
+
+typedef struct {
+    int lo, hi;               // inclusive day range; NO_DAY / INT_MAX leave an end open
+    int doctorId, patientId;  // 0 = any
+    int canceled;             // -1 = any, 0 = active only, 1 = canceled only
+} ListFilter;
+
+static void filter_all(ListFilter *f){
+    f->lo=NO_DAY; f->hi=0x7fffffff; f->doctorId=f->patientId=0; f->canceled=-1;
+}
+
+/* Slot of the first row at or after pos that passes f, or -1. Patients only
+ * filter by id. Callers listing invoices hold BILLING_READ.
+ */
+static int list_next(int kind, const ListFilter *f, int pos){
+    if(kind==LIST_PATIENTS){
+        for(; pos<g_patients.count; pos++){
+            const Patient *p=patient_at(pos);
+            if(p->id && !p->deleted && (!f->patientId || p->id==f->patientId)) return pos;
+        }
+    } else if(kind==LIST_APPTS){
+        const int *doc=g_apptCols.doctorId;
+        for(; pos<g_appts.count; pos++){
+            if(f->doctorId && doc[pos]!=f->doctorId) continue;
+            const Appointment *a=appt_at(pos);
+            if(!a->id || a->day<f->lo || a->day>f->hi) continue;
+            if((f->patientId && a->patientId!=f->patientId) || (f->canceled>=0 && a->canceled!=f->canceled)) continue;
+            return pos;
+        }
+    } else {
+        const int *day=g_invCols.day, *pat=g_invCols.patientId;
+        for(; pos<g_invoices.count; pos++){
+            if(day[pos]<f->lo || day[pos]>f->hi || (f->patientId && pat[pos]!=f->patientId)) continue;
+            if(invoice_at(pos)->id) return pos;
+        }
+    }
+    return -1;
+}
+
+static const char* list_title(int kind){
+    return kind==LIST_PATIENTS ? "Patients" : kind==LIST_APPTS ? "Appointments" : "Invoices";
+}
+
+static int list_live(int kind){
+    return tbl_live(kind==LIST_PATIENTS ? &g_patients : kind==LIST_APPTS ? &g_appts : &g_invoices);
+}
+
+static void list_header(OutBuf *o, int kind){
+    if(kind==LIST_PATIENTS)   ob_printf(o, "%-5s %-20s %-3s %-7s %-14s %-s\n", "ID","Name","Age","Gender","Phone","Address");
+    else if(kind==LIST_APPTS) ob_printf(o, "%-4s %-6s %-6s %-10s %-5s %-s %-s\n", "ID","PatID","DocID","Date","Time","Canceled","Notes");
+    else                      ob_printf(o, "%-4s %-6s %-10s %-s\n", "ID","PatID","Amount","Description");
+}
+
+static void list_row(OutBuf *o, int kind, int slot){
+    char d[DATE_LEN], t[TIME_LEN], am[MONEY_LEN];
+    if(kind==LIST_PATIENTS){
+        const Patient *p=patient_at(slot);
+        ob_printf(o, "%-5d %-20.20s %-3d %-7.7s %-14.14s %-40.40s\n", p->id, p->name, p->age, gender_name(p->gender), p->phone, str_get(p->address));
+    } else if(kind==LIST_APPTS){
+        const Appointment *a=appt_at(slot); fmt_date(a->day, d); fmt_time(a->minute, t);
+        ob_printf(o, "%-4d %-6d %-6d %-10s %-5s %-7s %-40.40s\n", a->id, a->patientId, a->doctorId, d, t, a->canceled?"Yes":"No", str_get(a->notes));
+    } else {
+        const Invoice *iv=invoice_at(slot); fmt_date(iv->day, d);
+        ob_printf(o, "%-4d %-6d %-10s %-40.40s (%s)\n", iv->id, iv->patientId, fmt_money(iv->amount, am), str_get(iv->description), d);
+    }
+}
+
+// Console listing, LIST_PAGE rows at a time: Enter shows the next page, 'a' the rest, 'q' stops.
+static void list_paged(int kind, const ListFilter *f){
+    OutBuf o; ob_open(&o, stdout);
+    ob_printf(&o, "\n-- %s (%d) --\n", list_title(kind), list_live(kind));
+    list_header(&o, kind);
+    int pos=list_next(kind, f, 0), shown=0, page=LIST_PAGE;
+    while(pos>=0){
+        for(int n=0; pos>=0 && (page<0 || n<page); n++, shown++){ list_row(&o, kind, pos); pos=list_next(kind, f, pos+1); }
+        if(pos<0) break;
+        ob_flush(&o);
+        char ans[8]; safe_input("-- Enter = more, a = all, q = stop: ", ans, sizeof ans);
+        if(*ans=='q' || *ans=='Q') break;
+        if(*ans=='a' || *ans=='A') page=-1;
+    }
+    ob_printf(&o, "(%d shown)\n", shown);
+    ob_close(&o);
+}
+
+// --- Export ---
+/* CSV (RFC 4180, header row first) or a JSON array with one object per row.
+ * Rows are written straight from the tables through an OutBuf: no
+ * intermediate row strings and no printf. Text is written as stored (UTF-8
+ * passes through); missing dates and times are empty in CSV and null in JSON.
+ */
+enum { EXPORT_CSV, EXPORT_JSON };
+
+typedef struct {
+    OutBuf o;
+    int    format, col;
+} Export;
+
+static void ex_csv_text(OutBuf *o, const char *s){
+    if(!s[strcspn(s, ",\"\r\n")]){ ob_puts(o, s); return; }
+    ob_char(o, '"');
+    for(; *s; s++){ if(*s=='"') ob_char(o, '"'); ob_char(o, *s); }
+    ob_char(o, '"');
+}
+
+static void ex_json_text(OutBuf *o, const char *s){
+    static const char hex[]="0123456789abcdef";
+    ob_char(o, '"');
+    for(; *s; s++){
+        unsigned char c=(unsigned char)*s;
+        if(c=='"' || c=='\\'){ ob_char(o, '\\'); ob_char(o, (char)c); }
+        else if(c<0x20){ ob_puts(o, "\\u00"); ob_char(o, hex[c>>4]); ob_char(o, hex[c&15]); }
+        else ob_char(o, (char)c);
+    }
+    ob_char(o, '"');
+}
+
+// Starts a field: the separator, and in JSON the key.
+static void ex_key(Export *x, const char *key){
+    if(x->format==EXPORT_JSON){ ob_puts(&x->o, x->col ? ",\"" : "{\""); ob_puts(&x->o, key); ob_put(&x->o, "\":", 2); }
+    else if(x->col) ob_char(&x->o, ',');
+    x->col++;
+}
+
+static void ex_text(Export *x, const char *key, const char *s){
+    ex_key(x, key);
+    if(x->format==EXPORT_JSON) ex_json_text(&x->o, s); else ex_csv_text(&x->o, s);
+}
+
+static void ex_int(Export *x, const char *key, long long v){ ex_key(x, key); ob_int(&x->o, v); }
+static void ex_money(Export *x, const char *key, Money v)  { ex_key(x, key); ob_money(&x->o, v); }
+
+static void ex_date(Export *x, const char *key, int day){
+    ex_key(x, key);
+    if(x->format!=EXPORT_JSON){ ob_date(&x->o, day); return; }
+    if(day==NO_DAY){ ob_puts(&x->o, "null"); return; }
+    ob_char(&x->o, '"'); ob_date(&x->o, day); ob_char(&x->o, '"');
+}
+
+static void ex_time(Export *x, const char *key, int minute){
+    ex_key(x, key);
+    if(x->format!=EXPORT_JSON){ ob_time(&x->o, minute); return; }
+    if(minute<0){ ob_puts(&x->o, "null"); return; }
+    ob_char(&x->o, '"'); ob_time(&x->o, minute); ob_char(&x->o, '"');
+}
+
+static void ex_row(Export *x, int kind, int slot, long n){
+    if(x->format==EXPORT_JSON) ob_puts(&x->o, n ? ",\n" : "\n");
+    x->col=0;
+    if(kind==LIST_PATIENTS){
+        const Patient *p=patient_at(slot);
+        ex_int(x, "id", p->id); ex_text(x, "name", p->name); ex_int(x, "age", p->age);
+        ex_text(x, "gender", gender_name(p->gender)); ex_text(x, "phone", p->phone); ex_text(x, "address", str_get(p->address));
+        ex_int(x, "admitted", p->admitted); ex_int(x, "roomNo", p->roomNo); ex_date(x, "since", p->since);
+    } else if(kind==LIST_APPTS){
+        const Appointment *a=appt_at(slot);
+        ex_int(x, "id", a->id); ex_int(x, "patientId", a->patientId); ex_int(x, "doctorId", a->doctorId);
+        ex_date(x, "date", a->day); ex_time(x, "time", a->minute); ex_text(x, "notes", str_get(a->notes)); ex_int(x, "canceled", a->canceled);
+    } else {
+        const Invoice *iv=invoice_at(slot);
+        ex_int(x, "id", iv->id); ex_int(x, "patientId", iv->patientId); ex_money(x, "amount", iv->amount);
+        ex_text(x, "description", str_get(iv->description)); ex_date(x, "date", iv->day);
+    }
+    if(x->format==EXPORT_JSON) ob_char(&x->o, '}'); else ob_put(&x->o, "\r\n", 2);
+}
+
+static const char *const g_exportHeader[]={
+    "id,name,age,gender,phone,address,admitted,roomNo,since",
+    "id,patientId,doctorId,date,time,notes,canceled",
+    "id,patientId,amount,description,date",
+};
+
+/* Writes the rows of kind passing f to path ("-" = stdout). Returns the
+ * number of rows, or -1 if the file could not be written.
+ */
+static long export_rows(int kind, int format, const ListFilter *f, const char *path){
+    int toStdout=!strcmp(path, "-");
+    FILE *fp = toStdout ? stdout : fopen(path, "wb");
+    if(!fp) return -1;
+    long long t0=probe_start();
+    Export x; ob_open(&x.o, fp); x.format=format; x.col=0;
+    if(format==EXPORT_JSON) ob_char(&x.o, '['); else { ob_puts(&x.o, g_exportHeader[kind]); ob_put(&x.o, "\r\n", 2); }
+    long n=0;
+    if(kind==LIST_INVOICES) BILLING_READ();
+    for(int pos=list_next(kind, f, 0); pos>=0; pos=list_next(kind, f, pos+1)) ex_row(&x, kind, pos, n++);
+    if(kind==LIST_INVOICES) BILLING_UNLOCK();
+    if(format==EXPORT_JSON) ob_puts(&x.o, n ? "\n]\n" : "]\n");
+    ob_flush(&x.o); long long bytes=x.o.written;
+    int err=ob_close(&x.o);
+    if(!toStdout && fclose(fp)) err=-1;
+    probe_end(PROBE_EXPORT, t0, bytes);
+    return err ? -1 : n;
+}
+
+static int parse_list_kind(const char *s){
+    if(!strcmp(s, "patients")) return LIST_PATIENTS;
+    if(!strcmp(s, "appointments") || !strcmp(s, "appts")) return LIST_APPTS;
+    if(!strcmp(s, "invoices")) return LIST_INVOICES;
+    return -1;
+}
+
+// Prompts until a valid date / time is entered; blank keeps *day / *minute as is.
+static void input_date(const char *prompt, int *day){
+    char buf[32];
+    for(;;){
+        safe_input(prompt, buf, sizeof buf);
+        if(!*buf || parse_date(buf, day)) return;
+        puts("  Invalid date. Use YYYY-MM-DD.");
+    }
+}
+
+static void input_time(const char *prompt, int *minute){
+    char buf[32];
+    for(;;){
+        safe_input(prompt, buf, sizeof buf);
+        if(!*buf || parse_time(buf, minute)) return;
+        puts("  Invalid time. Use HH:MM.");
+    }
+}
+
+// Inclusive [*lo, *hi] for filtering listings by day; blank ends are open.
+static void input_date_range(int *lo, int *hi){
+    *lo=*hi=NO_DAY;
+    input_date("From (YYYY-MM-DD, blank = all): ", lo);
+    input_date("To   (YYYY-MM-DD, blank = all): ", hi);
+    if(*hi==NO_DAY) *hi=0x7fffffff;
+}
+
+// Prompts for an id; blank (or 0) means any.
+static int input_opt_id(const char *prompt){
+    char buf[32];
+    for(;;){
+        safe_input(prompt, buf, sizeof buf);
+        char *end; long v=strtol(buf, &end, 10);
+        if(!*buf || (*end=='\0' && v>=0)) return (int)v;
+        puts("  Invalid id. Try again.");
+    }
+}
+
+// Asks for the filters that apply to kind.
+static void input_list_filter(int kind, ListFilter *f){
+    filter_all(f);
+    if(kind==LIST_PATIENTS) return;
+    input_date_range(&f->lo, &f->hi);
+    if(kind==LIST_APPTS) f->doctorId=input_opt_id("Doctor ID (blank = all): ");
+    f->patientId=input_opt_id("Patient ID (blank = all): ");
+    if(kind==LIST_APPTS){
+        char buf[8]; safe_input("Canceled? (y = only canceled, n = only active, blank = all): ", buf, sizeof buf);
+        if(*buf=='y' || *buf=='Y') f->canceled=1; else if(*buf=='n' || *buf=='N') f->canceled=0;
+    }
+}
+
+static void list_menu_view(int kind){
+    ListFilter f; input_list_filter(kind, &f); list_paged(kind, &f);
+}
+
+static void export_menu(int kind){
+    ListFilter f; input_list_filter(kind, &f);
+    char fmt[8], path[256];
+    safe_input("Format (csv/json): ", fmt, sizeof fmt);
+    int format = (*fmt=='j' || *fmt=='J') ? EXPORT_JSON : EXPORT_CSV;
+    safe_input("File: ", path, sizeof path);
+    if(!*path){ puts("No file given."); return; }
+    double t0=now_sec(); long n=export_rows(kind, format, &f, path);
+    if(n<0) printf("Could not write %s.\n", path);
+    else printf("Exported %ld %s to %s in %.1f ms.\n", n, list_title(kind), path, (now_sec()-t0)*1e3);
+}
+
+// --------------------- Patients ---------------------
+static void add_patient(){
+    Patient p={0}; p.admitted=0; p.roomNo=-1; char gd[16];
+    safe_input("Name: ", p.name, sizeof p.name);
+    p.age = input_int("Age: ");
+    safe_input("Gender (M/F/Other): ", gd, sizeof gd); p.gender=parse_gender(gd);
+    safe_input("Phone: ", p.phone, sizeof p.phone);
+    char ad[ADDR_LEN]; safe_input("Address: ", ad, sizeof ad); p.address=str_intern(ad);
+    op_add_patient(&p);
+    printf("Added patient with ID %d\n", p.id);
+}
+
+static void edit_patient(){
+    int id=input_int("Enter patient ID to edit: "); Patient *p=live_patient(id);
+    if(!p){ puts("Not found."); return; }
+    char tmp[8];
+    printf("Editing patient %d (%s). Leave blank to keep.\n", p->id, p->name);
+    Patient u=*p; char buf[ADDR_LEN];
+    safe_input("Name: ", buf, sizeof buf); if(strlen(buf)) strncpy(u.name,buf,sizeof u.name);
+    safe_input("Age: ", buf, sizeof buf); if(strlen(buf)) u.age=atoi(buf);
+    safe_input("Gender: ", buf, sizeof buf); if(strlen(buf)) u.gender=parse_gender(buf);
+    safe_input("Phone: ", buf, sizeof buf); if(strlen(buf)) strncpy(u.phone,buf,sizeof u.phone);
+    safe_input("Address: ", buf, sizeof buf); if(strlen(buf)) u.address=str_intern(buf);
+    op_edit_patient(&u); puts("Updated.");
+}
+
+static void delete_patient(){
+    const char *err=op_delete_patient(input_int("Enter patient ID to delete: "));
+    puts(err ? err : "Deleted.");
+}
+
+static void print_patient_hit(const Patient *p, void *unused){
+    (void)unused; printf("  #%d  %s, %d, %s, %s\n", p->id, p->name, p->age, gender_name(p->gender), p->phone);
+}
+
+static void search_patient(){
+    char name[NAME_LEN]; safe_input("Enter name (partial ok): ", name, sizeof name);
+    printf("Results for '%s':\n", name);
+    search_patients(name, print_patient_hit, NULL);
+}
+
+// --------------------- Doctors ---------------------
+static void list_doctors(){
+    printf("\n-- Doctors (%d) --\n", tbl_live(&g_doctors));
+    printf("%-5s %-22s %-18s %-14s\n", "ID","Name","Specialization","Phone");
+    for(int i=0;i<g_doctors.count;i++){
+        Doctor *d=doctor_at(i); if(!d->id || d->deleted) continue;
+        printf("%-5d %-22.22s %-18.18s %-14.14s\n", d->id, d->name, d->specialization, d->phone);
+    }
+}
+
+static void add_doctor(){
+    Doctor d={0};
+    safe_input("Name: ", d.name, sizeof d.name);
+    safe_input("Specialization: ", d.specialization, sizeof d.specialization);
+    safe_input("Phone: ", d.phone, sizeof d.phone);
+    op_add_doctor(&d);
+    printf("Added doctor with ID %d\n", d.id);
+}
+
+static void edit_doctor(){
+    int id=input_int("Enter doctor ID to edit: "); Doctor *d=live_doctor(id);
+    if(!d){ puts("Not found."); return; }
+    Doctor u=*d; char buf[128];
+    printf("Editing doctor %d (%s). Leave blank to keep.\n", d->id, d->name);
+    safe_input("Name: ", buf, sizeof buf); if(strlen(buf)) strncpy(u.name,buf,sizeof u.name);
+    safe_input("Specialization: ", buf, sizeof buf); if(strlen(buf)) strncpy(u.specialization,buf,sizeof u.specialization);
+    safe_input("Phone: ", buf, sizeof buf); if(strlen(buf)) strncpy(u.phone,buf,sizeof u.phone);
+    op_edit_doctor(&u); puts("Updated.");
+}
+
+static void print_doctor_hit(const Doctor *d, void *unused){
+    (void)unused; printf("  #%d  %s, %s, %s\n", d->id, d->name, d->specialization, d->phone);
+}
+
+static void search_doctor(){
+    char q[NAME_LEN]; safe_input("Enter name or specialization (partial ok): ", q, sizeof q);
+    printf("Results for '%s':\n", q);
+    search_doctors(q, print_doctor_hit, NULL);
+}
+
+static void delete_doctor(){
+    const char *err=op_delete_doctor(input_int("Enter doctor ID to delete: "));
+    puts(err ? err : "Deleted.");
+}
+
+// --------------------- Appointments ---------------------
+static void schedule_appt(){
+    int pid=input_int("Patient ID: "); if(!live_patient(pid)){ puts("Invalid patient."); return; }
+    int did=input_int("Doctor ID: "); if(!live_doctor(did)){ puts("Invalid doctor."); return; }
+    int day=NO_DAY, minute=-1;
+    while(day==NO_DAY) input_date("Date (YYYY-MM-DD): ", &day);
+    while(minute<0) input_time("Time (HH:MM): ", &minute);
+    int clash=slot_conflict(did, day, minute);
+    if(clash){
+        char d[DATE_LEN], t[TIME_LEN]; int fd, fm;
+        printf("Doctor %d is already booked then (appointment #%d).\n", did, clash);
+        if(next_free_slot(did, day, minute, &fd, &fm)){ fmt_date(fd, d); fmt_time(fm, t); printf("Next free slot: %s %s\n", d, t); }
+        return;
+    }
+    Appointment a={0}; a.patientId=pid; a.doctorId=did; a.day=day; a.minute=(short)minute;
+    char nt[NOTES_LEN]; safe_input("Notes: ", nt, sizeof nt); a.notes=str_intern(nt);
+    const char *err=op_schedule_appt(&a);
+    puts(err ? err : "Appointment scheduled.");
+}
+
+static void cancel_appt(){
+    const char *err=op_cancel_appt(input_int("Appointment ID to cancel: "));
+    puts(err ? err : "Canceled.");
+}
+
+static void doctor_day(){
+    int did=input_int("Doctor ID: "); Doctor *d=find_doctor_by_id(did); if(!d){ puts("Invalid doctor."); return; }
+    char date[DATE_LEN]; int day=today_day();
+    input_date("Date (YYYY-MM-DD, blank = today): ", &day);
+    fmt_date(day, date);
+    const DaySlots *ds=slot_day(did, day, 0);
+    printf("\n-- %s on %s (%d) --\n", d->name, date, ds ? ds->n : 0);
+    for(int i=0; ds && i<ds->n; i++){
+        const Appointment *a=find_appt_by_id(ds->apptId[i]); Patient *p=a ? find_patient_by_id(a->patientId) : NULL;
+        char t[TIME_LEN]; fmt_time(ds->start[i], t);
+        printf("  %s  #%-5d %-20.20s %-40.40s\n", t, ds->apptId[i], p ? p->name : "?", a ? str_get(a->notes) : "");
+    }
+}
+
+static void find_free_slot(){
+    int did=input_int("Doctor ID: "); if(!live_doctor(did)){ puts("Invalid doctor."); return; }
+    int day=today_day(), minute=0;
+    input_date("From date (YYYY-MM-DD, blank = today): ", &day);
+    input_time("From time (HH:MM, blank = start of day): ", &minute);
+    int fd, fm;
+    if(!next_free_slot(did, day, minute, &fd, &fm)){ puts("No free slot in the next year."); return; }
+    char d[DATE_LEN], t[TIME_LEN]; fmt_date(fd, d); fmt_time(fm, t);
+    printf("Next free slot for doctor %d: %s %s\n", did, d, t);
+}
+
+// --------------------- Pharmacy ---------------------
+static void list_meds(){
+    printf("\n-- Medicines (%d) --\n", tbl_live(&g_meds));
+    printf("%-4s %-22s %-8s %-8s %-8s\n", "ID","Name","Stock","Reorder","Price");
+    for(int i=0;i<g_meds.count;i++){
+        Medicine *m=med_at(i); if(!m->id) continue;
+        char pr[MONEY_LEN];
+        printf("%-4d %-22.22s %-8d %-8d %-8s\n", m->id, m->name, m->stock, m->reorderLevel, fmt_money(m->price, pr));
+    }
+}
+
+static void add_med(){
+    Medicine m={0}; int expiry=NO_DAY;
+    safe_input("Name: ", m.name, sizeof m.name);
+    m.stock = input_int("Initial stock: ");
+    if(m.stock>0) input_date("Expiry of that stock (YYYY-MM-DD, blank = untracked): ", &expiry);
+    m.price = input_money("Price per unit: ");
+    m.reorderLevel = input_int("Reorder level (0 = none): ");
+    const char *err=op_add_med(&m, expiry);
+    if(err){ puts(err); return; }
+    printf("Added medicine ID %d\n", m.id);
+}
+
+static void restock_med(){
+    int id=input_int("Medicine ID: "); if(!find_med_by_id(id)){ puts("Not found."); return; }
+    int qty=input_int("Add quantity: "), expiry=NO_DAY;
+    input_date("Lot expiry (YYYY-MM-DD, blank = untracked): ", &expiry);
+    const char *err=op_restock_med(id, qty, expiry);
+    puts(err ? err : "Restocked.");
+}
+
+static void set_reorder(){
+    int id=input_int("Medicine ID: "); if(!find_med_by_id(id)){ puts("Not found."); return; }
+    const char *err=op_set_reorder(id, input_int("Reorder level (0 = none): "));
+    puts(err ? err : "Updated.");
+}
+
+static void print_lot(const Lot *l, void *today){
+    char ex[DATE_LEN]; fmt_date(l->expiry, ex);
+    const Medicine *m=find_med_by_id(l->medicineId);
+    printf("%-6d %-22.22s %-10s %8d%s\n", l->id, m ? m->name : "(deleted)", ex, l->qty,
+           l->expiry<*(const int*)today ? "  expired" : "");
+}
+
+static void med_lots(){
+    int id=input_int("Medicine ID: "); const Medicine *m=find_med_by_id(id); if(!m){ puts("Not found."); return; }
+    int today=today_day();
+    printf("%-6s %-22s %-10s %8s\n", "Lot", "Medicine", "Expiry", "Units");
+    STOCK_LOCK(); int n=stock_lots(id, print_lot, &today), s=stock_slot(id, 0), inLots = s<0 ? 0 : g_stock[s].lotQty; STOCK_UNLOCK();
+    printf("%d open lot(s), %d unit(s); %d untracked\n", n, inLots, m->stock>inLots ? m->stock-inLots : 0);
+}
+
+static void writeoff_expired(){
+    int lots, units; const char *err=op_writeoff_expired(today_day(), &lots, &units);
+    printf("Wrote off %d expired lot(s), %d unit(s).\n", lots, units);
+    if(err) puts(err);
+}
+
+static void sell_med(){
+    int pid=input_int("Patient ID: "); if(!live_patient(pid)){ puts("Invalid patient."); return; }
+    int mid=input_int("Medicine ID: "); if(!find_med_by_id(mid)){ puts("Invalid medicine."); return; }
+    Invoice iv; const char *err=op_sell_med(pid, mid, input_int("Quantity: "), &iv);
+    if(err){ puts(err); return; }
+    char am[MONEY_LEN];
+    printf("Sold. Invoice #%d Amount: %s\n", iv.id, fmt_money(iv.amount, am));
+}
+
+// --------------------- Billing ---------------------
+static void new_invoice(){
+    int pid=input_int("Patient ID: "); if(!live_patient(pid)){ puts("Invalid patient."); return; }
+    Money amt=input_money("Amount: ");
+    char desc[DESC_LEN]; safe_input("Description: ", desc, sizeof desc);
+    Invoice iv={0}; iv.patientId=pid; iv.amount=amt; iv.day=NO_DAY; iv.description=str_intern(desc);
+    op_add_invoice(&iv); printf("Invoice created: #%d\n", iv.id);
+}
+
+static void patient_balance(){
+    int pid=input_int("Patient ID: "); if(!find_patient_by_id(pid)){ puts("Invalid patient."); return; }
+    const PatientLedger *l=ledger_of(pid, 0);
+    char am[MONEY_LEN];
+    printf("Total billed to patient %d: %s\n", pid, fmt_money(l ? l->balance : 0, am));
+}
+
+static void patient_invoices(){
+    int pid=input_int("Patient ID: "); Patient *p=find_patient_by_id(pid); if(!p){ puts("Invalid patient."); return; }
+    const PatientLedger *l=ledger_of(pid, 0);
+    char am[MONEY_LEN], d[DATE_LEN];
+    printf("\n-- Invoices for %s (%d) --\n", p->name, l ? l->n : 0);
+    printf("%-4s %-10s %-s\n", "ID","Amount","Description");
+    for(int i=0; l && i<l->n; i++){
+        const Invoice *iv=find_invoice_by_id(l->invoiceIds[i]); if(!iv) continue;
+        fmt_date(iv->day, d); printf("%-4d %-10s %-40.40s (%s)\n", iv->id, fmt_money(iv->amount, am), str_get(iv->description), d);
+    }
+    printf("Balance: %s\n", fmt_money(l ? l->balance : 0, am));
+}
+
+// Rebuilt after loading: snapshot rows reach the table without push_invoice.
+static void ledger_rebuild(){
+    ledger_clear();
+    for(int i=0;i<g_invoices.count;i++){ const Invoice *iv=invoice_at(i); if(iv->id) ledger_add(iv); }
+}
+
+// --------------------- Admissions ---------------------
+static void ward_overview(){
+    printf("\n-- Wards (%d) --\n%-5s %-6s %-9s %-5s\n", g_nwards, "Ward", "Rooms", "Occupied", "Free");
+    for(int w=1;w<=g_nwards;w++) if(g_wards[w].rooms) printf("%-5d %-6d %-9d %-5d\n", w, g_wards[w].rooms, g_wards[w].rooms-g_wards[w].free, g_wards[w].free);
+}
+
+static void free_rooms(){
+    int w=input_int("Ward: "); if(w<1 || w>g_nwards){ puts("No such ward."); return; }
+    const Ward *wd=&g_wards[w];
+    printf("Free rooms on ward %d (%d):", w, wd->free);
+    for(int n=1;n<=wd->rooms;n++) if(!wd->room[n-1].occupant) printf(" %d", w*ROOM_STRIDE+n);
+    putchar('\n');
+}
+
+// Room, else first free room of the ward, else of any ward.
+static const char* admit_or_transfer(int transfer){
+    int pid=input_int("Patient ID: ");
+    int room=input_int("Room (0 = first free): "), ward = room ? 0 : input_int("Ward (0 = any): "), day=today_day();
+    input_date("Date (YYYY-MM-DD, blank = today): ", &day);
+    const char *err = transfer ? op_transfer(pid, ward, room, day) : op_admit(pid, ward, room, day);
+    if(!err) printf("Patient %d is in room %d.\n", pid, find_patient_by_id(pid)->roomNo);
+    return err;
+}
+
+static void admit_patient()   { const char *err=admit_or_transfer(0); if(err) puts(err); }
+static void transfer_patient(){ const char *err=admit_or_transfer(1); if(err) puts(err); }
+
+static void discharge_patient(){
+    int pid=input_int("Patient ID: "), day=today_day();
+    input_date("Date (YYYY-MM-DD, blank = today): ", &day);
+    const char *err=op_discharge(pid, day);
+    puts(err ? err : "Discharged.");
+}
+
+static void room_timeline(){
+    int no=input_int("Room: "), w, n; const Room *r=room_of(no, &w, &n);
+    if(!r){ puts("No such room."); return; }
+    char from[DATE_LEN], to[DATE_LEN];
+    printf("\n-- Room %d (%d stays since start) --\n%-8s %-10s %-10s %s\n", no, r->n, "Patient", "From", "To", "Name");
+    for(int i=0;i<r->n;i++){
+        const Stay *st=&r->stays[i]; const Patient *p=find_patient_by_id(st->patientId);
+        fmt_date(st->from, from); fmt_date(st->to, to);
+        printf("%-8d %-10s %-10s %s\n", st->patientId, from, st->to==NO_DAY ? "(now)" : to, p ? p->name : "?");
+    }
+}
+
+// --------------------- Menus ---------------------
+static void patients_menu(){
+    while(1){
+        puts("\n[Patients]\n 1) List\n 2) Add\n 3) Edit\n 4) Delete\n 5) Search by name\n 6) Export (CSV/JSON)\n 0) Back");
+        int ch=input_int("Choose: ");
+        switch(ch){
+            case 1: list_menu_view(LIST_PATIENTS); press_enter(); break;
+            case 2: add_patient(); press_enter(); break;
+            case 3: edit_patient(); press_enter(); break;
+            case 4: delete_patient(); press_enter(); break;
+            case 5: search_patient(); press_enter(); break;
+            case 6: export_menu(LIST_PATIENTS); press_enter(); break;
+            case 0: return;
+            default: puts("Invalid.");
+        }
+    }
+}
+
+static void doctors_menu(){
+    while(1){
+        puts("\n[Doctors]\n 1) List\n 2) Add\n 3) Edit\n 4) Delete\n 5) Search by name or specialization\n 0) Back");
+        int ch=input_int("Choose: ");
+        switch(ch){
+            case 1: list_doctors(); press_enter(); break;
+            case 2: add_doctor(); press_enter(); break;
+            case 3: edit_doctor(); press_enter(); break;
+            case 4: delete_doctor(); press_enter(); break;
+            case 5: search_doctor(); press_enter(); break;
+            case 0: return;
+            default: puts("Invalid.");
+        }
+    }
+}
+
+static void appts_menu(){
+    while(1){
+        puts("\n[Appointments]\n 1) List\n 2) Schedule\n 3) Cancel\n 4) Doctor's day\n 5) Next free slot for doctor\n 6) Export (CSV/JSON)\n 0) Back");
+        int ch=input_int("Choose: ");
+        switch(ch){
+            case 1: list_menu_view(LIST_APPTS); press_enter(); break;
+            case 2: schedule_appt(); press_enter(); break;
+            case 3: cancel_appt(); press_enter(); break;
+            case 4: doctor_day(); press_enter(); break;
+            case 5: find_free_slot(); press_enter(); break;
+            case 6: export_menu(LIST_APPTS); press_enter(); break;
+            case 0: return;
+            default: puts("Invalid.");
+        }
+    }
+}
+
+static void pharmacy_menu(){
+    while(1){
+        puts("\n[Pharmacy]\n 1) List medicines\n 2) Add medicine\n 3) Restock medicine\n 4) Sell medicine (creates invoice)\n"
+             " 5) Set reorder level\n 6) Lots of a medicine\n 7) Write off expired lots\n 0) Back");
+        int ch=input_int("Choose: ");
+        switch(ch){
+            case 1: list_meds(); press_enter(); break;
+            case 2: add_med(); press_enter(); break;
+            case 3: restock_med(); press_enter(); break;
+            case 4: sell_med(); press_enter(); break;
+            case 5: set_reorder(); press_enter(); break;
+            case 6: med_lots(); press_enter(); break;
+            case 7: writeoff_expired(); press_enter(); break;
+            case 0: return;
+            default: puts("Invalid.");
+        }
+    }
+}
+
+static void billing_menu(){
+    while(1){
+        puts("\n[Billing]\n 1) List invoices\n 2) New invoice (manual)\n 3) Patient total billed\n 4) Patient invoices\n 5) Export (CSV/JSON)\n 0) Back");
+        int ch=input_int("Choose: ");
+        switch(ch){
+            case 1: list_menu_view(LIST_INVOICES); press_enter(); break;
+            case 2: new_invoice(); press_enter(); break;
+            case 3: patient_balance(); press_enter(); break;
+            case 4: patient_invoices(); press_enter(); break;
+            case 5: export_menu(LIST_INVOICES); press_enter(); break;
+            case 0: return;
+            default: puts("Invalid.");
+        }
+    }
+}
+
+static void wards_menu(){
+    while(1){
+        puts("\n[Wards]\n 1) Occupancy\n 2) Free rooms on a ward\n 3) Admit\n 4) Transfer\n 5) Discharge\n 6) Room timeline\n 0) Back");
+        int ch=input_int("Choose: ");
+        switch(ch){
+            case 1: ward_overview(); press_enter(); break;
+            case 2: free_rooms(); press_enter(); break;
+            case 3: admit_patient(); press_enter(); break;
+            case 4: transfer_patient(); press_enter(); break;
+            case 5: discharge_patient(); press_enter(); break;
+            case 6: room_timeline(); press_enter(); break;
+            case 0: return;
+            default: puts("Invalid.");
+        }
+    }
+}
+
+static void probes_menu(){
+    static char dump[32768];
+    while(1){
+        printf("\n[Instrumentation] (probes are %s)\n 1) Show probes\n 2) Turn %s\n 3) Reset\n 0) Back\n",
+               g_probesOn ? "on" : "off", g_probesOn ? "off" : "on");
+        int ch=input_int("Choose: ");
+        switch(ch){
+            case 1: probes_format(dump, sizeof dump); fputs(dump, stdout); press_enter(); break;
+            case 2: __atomic_xor_fetch(&g_probesOn, 1, __ATOMIC_RELAXED); break;
+            case 3: probes_reset(); puts("Cleared."); break;
+            case 0: return;
+            default: puts("Invalid.");
+        }
+    }
+}
+
+// --------------------- Thread pool ---------------------
+/* Small fixed pool of worker threads fed from one queue. Tasks may submit
+ * further tasks; pool_wait returns once everything queued so far, including
+ * those, has run. Without pthreads (_WIN32) or with HMS_THREADS=1, tasks run
+ * inline on the caller's thread.
+ */
+typedef struct { void (*fn)(void*); void *arg; } Task;
+
+#ifndef _WIN32
+static struct {
+    int             nth;           // worker threads, 0 until pool_start
+    Task           *q;             // ring buffer
+    int             qcap, qhead, qlen;
+    int             busy;          // tasks queued or running
+    pthread_mutex_t mu;
+    pthread_cond_t  work, idle;
+} g_pool = {0, NULL, 0, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER};
+
+static void* pool_worker(void *unused){
+    (void)unused;
+    pthread_mutex_lock(&g_pool.mu);
+    for(;;){
+        while(!g_pool.qlen) pthread_cond_wait(&g_pool.work, &g_pool.mu);
+        Task t=g_pool.q[g_pool.qhead];
+        g_pool.qhead=(g_pool.qhead+1)%g_pool.qcap; g_pool.qlen--;
+        pthread_mutex_unlock(&g_pool.mu);
+        t.fn(t.arg);
+        pthread_mutex_lock(&g_pool.mu);
+        if(--g_pool.busy==0) pthread_cond_broadcast(&g_pool.idle);
+    }
+    return NULL;
+}
+#endif
+
+static int pool_threads(){
+    const char *env=getenv("HMS_THREADS");
+    if(env && atoi(env)>0) return atoi(env);
+#ifdef _WIN32
+    return 1;
+#else
+    long n=sysconf(_SC_NPROCESSORS_ONLN);
+    return n>0 ? (int)n : 1;
+#endif
+}
+
+static void pool_start(){
+#ifndef _WIN32
+    if(g_pool.nth) return;
+    int n=pool_threads(); if(n<2) return;
+    for(int i=0;i<n;i++){
+        pthread_t th;
+        if(pthread_create(&th, NULL, pool_worker, NULL)!=0) break;
+        pthread_detach(th); g_pool.nth++;
+    }
+#endif
+}
+
+static void pool_submit(void (*fn)(void*), void *arg){
+#ifndef _WIN32
+    if(g_pool.nth){
+        pthread_mutex_lock(&g_pool.mu);
+        if(g_pool.qlen==g_pool.qcap){
+            int cap=g_pool.qcap ? g_pool.qcap*2 : 64;
+            Task *q=(Task*)xcalloc(cap, sizeof *q);
+            for(int i=0;i<g_pool.qlen;i++) q[i]=g_pool.q[(g_pool.qhead+i)%g_pool.qcap];
+            free(g_pool.q); g_pool.q=q; g_pool.qcap=cap; g_pool.qhead=0;
+        }
+        g_pool.q[(g_pool.qhead+g_pool.qlen)%g_pool.qcap].fn=fn;
+        g_pool.q[(g_pool.qhead+g_pool.qlen)%g_pool.qcap].arg=arg;
+        g_pool.qlen++; g_pool.busy++;
+        pthread_cond_signal(&g_pool.work);
+        pthread_mutex_unlock(&g_pool.mu);
+        return;
+    }
+#endif
+    fn(arg);
+}
+
+static void pool_wait(){
+#ifndef _WIN32
+    pthread_mutex_lock(&g_pool.mu);
+    while(g_pool.busy) pthread_cond_wait(&g_pool.idle, &g_pool.mu);
+    pthread_mutex_unlock(&g_pool.mu);
+#endif
+}
+
+// --------------------- Startup load ---------------------
+/* The tables load concurrently on the pool. A binary snapshot is adopted
+ * in place (tbl_adopt). A text snapshot is mapped and cut into byte ranges of
+ * at least LOAD_RANGE_MIN that end on a newline; each range is parsed into a
+ * private table, and the ranges are then appended to the real table in file
+ * order, so slots, ids and g_next*Id come out exactly as a serial read would
+ * leave them. Journals are replayed afterwards, merged by seq.
+ */
+#define LOAD_RANGE_MIN  (1<<20)
+#define LOAD_MAX_RANGES 64
+
+static int parse_patient_rec(const char *l, void *r){ return parse_patient(l, (Patient*)r); }
+static int parse_doctor_rec(const char *l, void *r) { return parse_doctor(l, (Doctor*)r); }
+static int parse_appt_rec(const char *l, void *r)   { return parse_appt(l, (Appointment*)r); }
+static int parse_med_rec(const char *l, void *r)    { return parse_med(l, (Medicine*)r); }
+static int parse_invoice_rec(const char *l, void *r){ return parse_invoice(l, (Invoice*)r); }
+static int parse_lot_rec(const char *l, void *r)    { return parse_lot(l, (Lot*)r); }
+
+static int fmt_patient_rec(char *o, size_t n, const void *r){ return fmt_patient(o, n, (const Patient*)r); }
+static int fmt_doctor_rec(char *o, size_t n, const void *r) { return fmt_doctor(o, n, (const Doctor*)r); }
+static int fmt_appt_rec(char *o, size_t n, const void *r)   { return fmt_appt(o, n, (const Appointment*)r); }
+static int fmt_med_rec(char *o, size_t n, const void *r)    { return fmt_med(o, n, (const Medicine*)r); }
+static int fmt_invoice_rec(char *o, size_t n, const void *r){ return fmt_invoice(o, n, (const Invoice*)r); }
+static int fmt_lot_rec(char *o, size_t n, const void *r)    { return fmt_lot(o, n, (const Lot*)r); }
+
+typedef struct {
+    Journal    *jnl;
+    Table      *tbl;
+    HashIndex  *idx;
+    int        *nextId;
+    int       (*parse)(const char *line, void *rec);
+    int       (*apply)(char op, const char *row);
+    int       (*fmt)(char *out, size_t n, const void *rec);
+    int       (*save)();
+    int         strOff;   // offset of the record's Str field, or -1
+} TableDef;
+
+#define NTABLES 6
+static TableDef g_tables[NTABLES] = {
+    {&g_patJnl,  &g_patients, &g_patientIdx, &g_nextPatientId, parse_patient_rec, apply_patient, fmt_patient_rec, save_patients, (int)offsetof(Patient, address)},
+    {&g_docJnl,  &g_doctors,  &g_doctorIdx,  &g_nextDoctorId,  parse_doctor_rec,  apply_doctor,  fmt_doctor_rec,  save_doctors,  -1},
+    {&g_apptJnl, &g_appts,    &g_apptIdx,    &g_nextApptId,    parse_appt_rec,    apply_appt,    fmt_appt_rec,    save_appts,    (int)offsetof(Appointment, notes)},
+    {&g_medJnl,  &g_meds,     &g_medIdx,     &g_nextMedId,     parse_med_rec,     apply_med,     fmt_med_rec,     save_meds,     -1},
+    {&g_invJnl,  &g_invoices, &g_invoiceIdx, &g_nextInvoiceId, parse_invoice_rec, apply_invoice, fmt_invoice_rec, save_invoices, (int)offsetof(Invoice, description)},
+    {&g_lotJnl,  &g_lots,     &g_lotIdx,     &g_nextLotId,     parse_lot_rec,     apply_lot,     fmt_lot_rec,     save_lots,     -1},
+};
+
+typedef struct {
+    const TableDef *def;
+    char           *begin, *end;
+    Table           rows;
+    long long       malformed, truncated;
+} LoadRange;
+
+typedef struct {
+    const TableDef *def;
+    char           *map;
+    size_t          len;
+    int             nranges;
+    LoadRange       ranges[LOAD_MAX_RANGES];
+} TableLoad;
+
+// Appends a parsed record to its table, keeping the index and next id current.
+static void table_insert(const TableDef *d, const void *rec){
+    memcpy(tbl_push(d->tbl), rec, d->tbl->elem);
+    int id=*(const int*)rec;
+    idx_put(d->idx, id, d->tbl->count-1);
+    if(id>=*d->nextId) *d->nextId=id+1;
+}
+
+static void parse_range(void *arg){
+    LoadRange *r=(LoadRange*)arg;
+    char *p=r->begin;
+    while(p<r->end){
+        char *nl=(char*)memchr(p, '\n', (size_t)(r->end-p));
+        char tail[1024];
+        const char *line=p;
+        if(nl) *nl='\0';
+        else {  // unterminated last line: there is no byte to put the '\0' in
+            size_t n=(size_t)(r->end-p); if(n>=sizeof tail) n=sizeof tail-1;
+            memcpy(tail, p, n); tail[n]='\0'; line=tail;
+        }
+        if(*line){
+            void *rec=tbl_push(&r->rows);
+            int rc=r->def->parse(line, rec);
+            if(rc<0){ r->rows.count--; r->malformed++; } else r->truncated+=rc;
+        }
+        p = nl ? nl+1 : r->end;
+    }
+}
+
+static void merge_ranges(void *arg){
+    TableLoad *tl=(TableLoad*)arg; const TableDef *d=tl->def;
+    for(int k=0;k<tl->nranges;k++){
+        Table *rows=&tl->ranges[k].rows;
+        d->jnl->malformed+=tl->ranges[k].malformed; d->jnl->truncated+=tl->ranges[k].truncated;
+        if(k==0 && d->tbl->count==0){
+            // take the first range's chunks as they are, then just index them
+            Table mine=*d->tbl; *d->tbl=*rows; rows->chunks=NULL; rows->nchunks=rows->chunkCap=rows->count=0;
+            tbl_clear(&mine);
+            for(int i=0;i<d->tbl->count;i++){
+                int id=*(const int*)tbl_at(d->tbl, i);
+                idx_put(d->idx, id, i); if(id>=*d->nextId) *d->nextId=id+1;
+            }
+            continue;
+        }
+        for(int i=0;i<rows->count;i++) table_insert(d, tbl_at(rows, i));
+        tbl_clear(rows);
+    }
+    unmap_file(tl->map, tl->len); tl->map=NULL;
+}
+
+// Adopts the binary snapshot, or maps the text one and queues its ranges.
+static void prepare_table(void *arg){
+    TableLoad *tl=(TableLoad*)arg; const TableDef *d=tl->def;
+    Journal *j=d->jnl;
+    if(load_bin(j, d->tbl, d->idx, d->nextId, d->strOff)) return;
+    j->snapSeq=0;
+    tl->map=map_file(j->snap, &tl->len); if(!tl->map) return;
+    char *p=tl->map, *end=tl->map+tl->len;
+    if(*p=='#'){   // "#seq=N" header
+        if(!strncmp(p, "#seq=", 5)) j->snapSeq=strtoll(p+5, NULL, 10);
+        char *nl=(char*)memchr(p, '\n', (size_t)(end-p)); p = nl ? nl+1 : end;
+    }
+    size_t body=(size_t)(end-p);
+    int n=(int)(body/LOAD_RANGE_MIN); if(n<1) n=1; if(n>LOAD_MAX_RANGES) n=LOAD_MAX_RANGES;
+    for(int k=0;k<n && p<end;k++){
+        char *stop = k==n-1 ? end : p+body/n;
+        if(stop<end){ char *nl=(char*)memchr(stop, '\n', (size_t)(end-stop)); stop = nl ? nl+1 : end; }
+        LoadRange *r=&tl->ranges[tl->nranges++];
+        memset(r, 0, sizeof *r);
+        r->def=d; r->begin=p; r->end=stop; r->rows.elem=d->tbl->elem;
+        pool_submit(parse_range, r);
+        p=stop;
+    }
+}
+
+/* Journal replay. Every journal is in seq order, so replaying them merged by
+ * seq reproduces the original order of changes across tables; that matters
+ * for a medicine's stock, which restocks set and sales adjust from txn.jnl.
+ */
+typedef struct {
+    FILE       *f;
+    Journal    *j;
+    long long   seq;                        // current record or group, -1 once exhausted
+    long        good;                       // file offset after the last complete one
+    int         n, cap;                     // parts in it (1 for a table journal), and room for
+    const char **jnl;                       // txn.jnl: journal each part belongs to
+    char       *op;
+    const char **row;
+    char      **line;                       // a JNL_LINE buffer per part; groups have no size limit
+    char        scratch[JNL_LINE];          // a group's begin and commit lines
+} JnlCursor;
+
+// Makes room in c for part k.
+static void jnl_cursor_room(JnlCursor *c, int k){
+    if(k<c->cap) return;
+    int cap = c->cap ? c->cap*2 : 16;
+    c->jnl=(const char**)xrealloc(c->jnl, cap*sizeof *c->jnl);
+    c->op=(char*)xrealloc(c->op, cap*sizeof *c->op);
+    c->row=(const char**)xrealloc(c->row, cap*sizeof *c->row);
+    c->line=(char**)xrealloc(c->line, cap*sizeof *c->line);
+    for(int i=c->cap;i<cap;i++) c->line[i]=(char*)xcalloc(1, JNL_LINE);
+    c->cap=cap;
+}
+
+// Reads one complete line; 0 at EOF or on a torn last line. *rest is what
+// follows "seq|", or NULL if the line has no seq.
+static int jnl_read_line(FILE *f, char *line, int cap, long long *seq, char **rest){
+    if(!fgets(line, cap, f)) return 0;
+    size_t n=strlen(line); if(!n || line[n-1]!='\n') return 0;
+    line[n-1]='\0';
+    char *end; *seq=strtoll(line, &end, 10);
+    *rest = end!=line && *end=='|' ? end+1 : NULL;
+    return 1;
+}
+
+// Reads one committed txn.jnl group into c.
+static int jnl_read_group(JnlCursor *c){
+    char *scratch=c->scratch, *rest; long long seq, s;
+    int n;
+    if(!jnl_read_line(c->f, scratch, JNL_LINE, &seq, &rest) || !rest) return 0;
+    if(sscanf(rest, "B|%d", &n)!=1 || n<1) return 0;
+    for(int k=0;k<n;k++){
+        jnl_cursor_room(c, k);
+        if(!jnl_read_line(c->f, c->line[k], JNL_LINE, &s, &rest) || !rest || s!=seq) return 0;
+        char *bar=strchr(rest, '|'); if(!bar || !bar[1] || bar[2]!='|') return 0;
+        *bar='\0'; c->jnl[k]=rest; c->op[k]=bar[1]; c->row[k]=bar+3;
+    }
+    if(!jnl_read_line(c->f, scratch, JNL_LINE, &s, &rest) || !rest || s!=seq || strcmp(rest, "C")) return 0;
+    c->seq=seq; c->n=n; c->good=ftell(c->f); return 1;
+}
+
+// Moves c to its next record. Malformed table records are skipped; a torn
+// line or an incomplete group ends the file and is cut off.
+// Appends cut off their own failed writes, so only a crash leaves one.
+static void jnl_cursor_next(JnlCursor *c){
+    c->seq=-1; if(!c->f) return;
+    jnl_cursor_room(c, 0);
+    if(c->j==&g_txnJnl){ if(jnl_read_group(c)) return; }
+    else {
+        long long seq; char *rest;
+        while(jnl_read_line(c->f, c->line[0], JNL_LINE, &seq, &rest)){
+            c->good=ftell(c->f);
+            if(!rest || !rest[0] || rest[1]!='|') continue;
+            c->seq=seq; c->n=1; c->jnl[0]=c->j->jnl; c->op[0]=rest[0]; c->row[0]=rest+2;
+            return;
+        }
+    }
+    fseek(c->f, 0, SEEK_END); long end=ftell(c->f);
+    fclose(c->f); c->f=NULL;
+    if(end>c->good) jnl_cut(c->j->jnl, c->good);
+}
+
+static const TableDef* table_of_jnl(const char *jnl){
+    for(int t=0;t<NTABLES;t++) if(!strcmp(g_tables[t].jnl->jnl, jnl)) return &g_tables[t];
+    return NULL;
+}
+
+static void replay_journals(){
+    static JnlCursor cs[NTABLES+1];
+    for(int t=0;t<=NTABLES;t++){
+        JnlCursor *c=&cs[t];
+        c->j = t<NTABLES ? g_tables[t].jnl : &g_txnJnl;
+        c->j->pending=0; c->j->txnSeq=0;
+        c->f=fopen(c->j->jnl, "r"); c->good=0;
+        jnl_cursor_next(c);
+    }
+    for(;;){
+        JnlCursor *c=NULL;
+        for(int t=0;t<=NTABLES;t++) if(cs[t].seq>=0 && (!c || cs[t].seq<c->seq)) c=&cs[t];
+        if(!c) break;
+        if(c->seq>g_seq) g_seq=c->seq;
+        for(int k=0;k<c->n;k++){
+            const TableDef *d=table_of_jnl(c->jnl[k]); if(!d) continue;
+            Journal *j=d->jnl;
+            j->pending++;
+            if(c->j==&g_txnJnl) j->txnSeq=c->seq;
+            if(c->seq<=j->snapSeq) continue;
+            int rc=d->apply(c->op[k], c->row[k]);
+            if(rc<0) j->malformed++; else j->truncated+=rc;
+        }
+        if(c->j==&g_txnJnl) g_txnJnl.pending++;
+        jnl_cursor_next(c);
+    }
+}
+
+static void load_tables(){
+    static TableLoad loads[NTABLES];
+    snap_roll_forward();   // a batch that stopped while swapping in its snapshots
+    long long t0=probe_start(), bytes=0;
+    pool_start();
+    for(int t=0;t<NTABLES;t++){
+        const TableDef *d=&g_tables[t];
+        tbl_clear(d->tbl); idx_clear(d->idx); *d->nextId=1;
+        d->jnl->malformed=d->jnl->truncated=0;
+        memset(&loads[t], 0, sizeof loads[t]); loads[t].def=d;
+        pool_submit(prepare_table, &loads[t]);
+    }
+    pool_wait();
+    for(int t=0;t<NTABLES;t++) if(loads[t].map) pool_submit(merge_ranges, &loads[t]);
+    pool_wait();
+    for(int t=0;t<NTABLES;t++){ bytes+=(long long)loads[t].len; if(g_tables[t].jnl->snapSeq>g_seq) g_seq=g_tables[t].jnl->snapSeq; }
+    probe_end(PROBE_LOAD_SNAPSHOTS, t0, bytes);
+    t0=probe_start();
+    replay_journals();
+    probe_end(PROBE_LOAD_REPLAY, t0, 0);
+    for(int t=0;t<NTABLES;t++){
+        const Journal *j=g_tables[t].jnl;
+        if(j->malformed || j->truncated)
+            fprintf(stderr, "%s: %lld malformed row(s) skipped, %lld field(s) truncated or unreadable\n",
+                    j->snap, j->malformed, j->truncated);
+    }
+}
+
+// Secondary indexes are rebuilt from the loaded tables, each on its own worker.
+static void rebuild_slots(void *unused)  { (void)unused; slot_rebuild(); }
+static void rebuild_ledger(void *unused) { (void)unused; ledger_rebuild(); }
+static void rebuild_stock(void *unused)  { (void)unused; stock_rebuild(); }
+static void rebuild_refs(void *unused)   { (void)unused; ref_rebuild(); }
+static void rebuild_wards(void *unused)  { (void)unused; ward_rebuild(); }
+
+static void rebuild_patient_names(void *unused){
+    (void)unused; tix_clear(&g_patientNameTix);
+    for(int i=0;i<g_patients.count;i++){ const Patient *p=patient_at(i); if(p->id) tix_add(&g_patientNameTix, p->id, p->name); }
+}
+
+static void rebuild_doctor_names(void *unused){
+    (void)unused; tix_clear(&g_doctorNameTix);
+    for(int i=0;i<g_doctors.count;i++){ const Doctor *d=doctor_at(i); if(d->id) tix_add(&g_doctorNameTix, d->id, d->name); }
+}
+
+static void rebuild_doctor_specs(void *unused){
+    (void)unused; tix_clear(&g_doctorSpecTix);
+    for(int i=0;i<g_doctors.count;i++){ const Doctor *d=doctor_at(i); if(d->id) tix_add(&g_doctorSpecTix, d->id, d->specialization); }
+}
+
+static void rebuild_indexes(){
+    pool_submit(rebuild_slots, NULL);
+    pool_submit(rebuild_ledger, NULL);
+    pool_submit(rebuild_stock, NULL);
+    pool_submit(rebuild_refs, NULL);
+    pool_submit(rebuild_wards, NULL);
+    pool_submit(rebuild_invoice_columns, NULL);
+    pool_submit(rebuild_appt_columns, NULL);
+    pool_submit(rebuild_patient_names, NULL);
+    pool_submit(rebuild_doctor_names, NULL);
+    pool_submit(rebuild_doctor_specs, NULL);
+    pool_wait();
+}
+
+static void load_all(){
+    long long t0=probe_start();
+    refs_config();
+    wards_config();
+    load_tables();
+    long long t1=probe_start();
+    rebuild_indexes();
+    ref_report(); ward_report();
+    str_gc();   // drops text that replayed updates replaced
+    probe_end(PROBE_LOAD_INDEXES, t1, 0);
+    jnl_sync_start();
+    probe_end(PROBE_LOAD_ALL, t0, 0);
+}
+
+// --------------------- Reports ---------------------
+/* Group-by aggregates over the column mirrors. A report splits the rows into
+ * one range per worker; each worker adds into its own dense accumulator
+ * (indexed by day offset, patient id or doctor x day cell) and the partials
+ * are summed at the end. REPORT_MAX_CELLS bounds all the accumulators of a
+ * report together, so a wide report runs on fewer workers, down to one. The inner loops are branch-free over plain arrays:
+ * rows outside the date range or with an unknown id land in one extra
+ * "discard" cell instead of taking a branch.
+ *
+ * Ranges are inclusive day numbers; NO_DAY for either end means the
+ * earliest or latest date in the data.
+ */
+#define REPORT_MIN_ROWS   (1<<16)   // rows per worker below which splitting doesn't pay
+#define REPORT_MAX_PARTS  64
+#define REPORT_MAX_CELLS  (1<<24)   // accumulator cells of one report, all workers together
+#define REPORT_TOP        20        // rows a ranked report shows in the menu
+
+enum { REP_BY_DAY, REP_BY_PATIENT, REP_BY_DOCTOR_DAY };
+
+typedef struct {
+    int       kind, lo, hi;
+    int       from;
+    unsigned  span, groups;   // days in the range; patient or doctor ids (< groups)
+    void     *acc;            // cells+1 accumulators, the last one discards
+} ReportPart;
+
+static void report_part(void *arg){
+    ReportPart *p=(ReportPart*)arg;
+    unsigned from=(unsigned)p->from, span=p->span, groups=p->groups;
+    if(p->kind==REP_BY_DAY){
+        const int *day=g_invCols.day; const Money *amt=g_invCols.amount; Money *acc=(Money*)p->acc;
+        for(int i=p->lo;i<p->hi;i++){ unsigned d=(unsigned)day[i]-from; acc[d<span ? d : span]+=amt[i]; }
+    } else if(p->kind==REP_BY_PATIENT){
+        const int *day=g_invCols.day, *pat=g_invCols.patientId; const Money *amt=g_invCols.amount; Money *acc=(Money*)p->acc;
+        for(int i=p->lo;i<p->hi;i++){
+            unsigned d=(unsigned)day[i]-from, id=(unsigned)pat[i];
+            acc[d<span && id<groups ? id : groups]+=amt[i];
+        }
+    } else {
+        const int *day=g_apptCols.day, *doc=g_apptCols.doctorId; int *acc=(int*)p->acc;
+        for(int i=p->lo;i<p->hi;i++){
+            unsigned d=(unsigned)day[i]-from, id=(unsigned)doc[i];
+            acc[d<span && id<groups ? id*span+d : groups*span]++;
+        }
+    }
+}
+
+static long long report_cells(int kind, long long span, unsigned groups){
+    return kind==REP_BY_DAY ? span : kind==REP_BY_PATIENT ? (long long)groups : (long long)groups*span;
+}
+
+/* Runs one report over rows [0, rows) split into `parts` workers (0 = one per
+ * thread, as the row count allows) and returns its cells+1 accumulators.
+ * Fewer workers run when their accumulators together would pass
+ * REPORT_MAX_CELLS; report_range has checked that one fits.
+ */
+static void* report_run(int kind, int rows, int from, unsigned span, unsigned groups, int parts){
+    size_t cells=(size_t)report_cells(kind, span, groups);
+    size_t elem = kind==REP_BY_DOCTOR_DAY ? sizeof(int) : sizeof(Money);
+    long long t0=probe_start();
+    if(parts<1){ parts=pool_threads(); if(parts>rows/REPORT_MIN_ROWS) parts=rows/REPORT_MIN_ROWS; }
+    if(parts>REPORT_MAX_PARTS) parts=REPORT_MAX_PARTS;
+    if((size_t)parts*(cells+1)>REPORT_MAX_CELLS) parts=(int)(REPORT_MAX_CELLS/(cells+1));
+    if(parts<1) parts=1;
+    ReportPart ps[REPORT_MAX_PARTS];
+    for(int k=0;k<parts;k++){
+        ReportPart *p=&ps[k];
+        p->kind=kind; p->from=from; p->span=span; p->groups=groups;
+        p->lo=(int)((long long)rows*k/parts); p->hi=(int)((long long)rows*(k+1)/parts);
+        p->acc=xcalloc(cells+1, elem);
+        pool_submit(report_part, p);
+    }
+    pool_wait();
+    for(int k=1;k<parts;k++){
+        if(elem==sizeof(int)){ int *a=(int*)ps[0].acc; const int *b=(const int*)ps[k].acc; for(size_t c=0;c<cells;c++) a[c]+=b[c]; }
+        else { Money *a=(Money*)ps[0].acc; const Money *b=(const Money*)ps[k].acc; for(size_t c=0;c<cells;c++) a[c]+=b[c]; }
+        free(ps[k].acc);
+    }
+    probe_end(PROBE_REPORT, t0, 0);
+    return ps[0].acc;
+}
+
+// Earliest and latest dated rows of a day column; 0 if there are none.
+static int report_day_bounds(const int *day, int n, int *lo, int *hi){
+    int mn=0x7fffffff, mx=NO_DAY;
+    for(int i=0;i<n;i++){
+        int d=day[i], e = d==NO_DAY ? 0x7fffffff : d;
+        mx = d>mx ? d : mx; mn = e<mn ? e : mn;
+    }
+    *lo=mn; *hi=mx;
+    return mx!=NO_DAY;
+}
+
+// Fills open ends of [*from, *to] from the data and checks that one accumulator fits.
+static const char* report_range(int kind, const int *day, int n, int *from, int *to, unsigned groups){
+    int lo, hi;
+    if(*from==NO_DAY || *to==NO_DAY){
+        if(!report_day_bounds(day, n, &lo, &hi)) return "Nothing to report.";
+        if(*from==NO_DAY) *from=lo;
+        if(*to==NO_DAY) *to=hi;
+    }
+    if(*to<*from) return "Empty date range.";
+    if(report_cells(kind, (long long)*to-*from+1, groups)>=REPORT_MAX_CELLS)
+        return kind==REP_BY_PATIENT ? "Too many patients to report." : "Date range too long.";
+    return NULL;
+}
+
+// Revenue per day: (*out)[d] is day *from+d. Caller frees *out.
+static const char* report_by_day(int *from, int *to, Money **out){
+    BILLING_READ();
+    const char *err=report_range(REP_BY_DAY, g_invCols.day, g_invCols.n, from, to, 0);
+    if(!err) *out=(Money*)report_run(REP_BY_DAY, g_invCols.n, *from, (unsigned)(*to-*from+1), 0, 0);
+    BILLING_UNLOCK();
+    return err;
+}
+
+// Revenue per patient in the range: (*out)[id] for ids below *groups.
+static const char* report_by_patient(int *from, int *to, Money **out, int *groups){
+    BILLING_READ();
+    *groups=g_nextPatientId;
+    const char *err=report_range(REP_BY_PATIENT, g_invCols.day, g_invCols.n, from, to, (unsigned)*groups);
+    if(!err) *out=(Money*)report_run(REP_BY_PATIENT, g_invCols.n, *from, (unsigned)(*to-*from+1), (unsigned)*groups, 0);
+    BILLING_UNLOCK();
+    return err;
+}
+
+// Live appointments per doctor and day: (*out)[id*span+d].
+static const char* report_by_doctor_day(int *from, int *to, int **out, int *groups){
+    *groups=g_nextDoctorId;
+    const char *err=report_range(REP_BY_DOCTOR_DAY, g_apptCols.day, g_apptCols.n, from, to, (unsigned)*groups);
+    if(!err) *out=(int*)report_run(REP_BY_DOCTOR_DAY, g_apptCols.n, *from, (unsigned)(*to-*from+1), (unsigned)*groups, 0);
+    return err;
+}
+
+// Stock valuation (stock x price); the medicine table is small, so rows are summed directly.
+static Money med_value(const Medicine *m){ return (Money)__atomic_load_n(&m->stock, __ATOMIC_RELAXED)*m->price; }
+
+typedef struct { int id; Money v; } IdMoney;
+
+static int cmp_id_money_desc(const void *a, const void *b){
+    Money x=((const IdMoney*)a)->v, y=((const IdMoney*)b)->v;
+    return (x<y)-(x>y);
+}
+
+// Non-zero entries of a per-id total, largest first; returns how many.
+static int report_top(const Money *acc, int groups, IdMoney **out){
+    int n=0;
+    for(int id=1;id<groups;id++) n += acc[id]!=0;
+    IdMoney *v=(IdMoney*)xcalloc((size_t)n, sizeof *v);
+    for(int id=1, k=0;id<groups;id++) if(acc[id]){ v[k].id=id; v[k].v=acc[id]; k++; }
+    qsort(v, (size_t)n, sizeof *v, cmp_id_money_desc);
+    *out=v; return n;
+}
+
+static void report_dates(int *from, int *to){
+    *from=*to=NO_DAY;
+    input_date("From (YYYY-MM-DD, blank = earliest): ", from);
+    input_date("To   (YYYY-MM-DD, blank = latest): ", to);
+}
+
+static void daily_revenue(){
+    int from, to; Money *acc; char d[DATE_LEN], am[MONEY_LEN];
+    report_dates(&from, &to);
+    double t0=now_sec();
+    const char *err=report_by_day(&from, &to, &acc); if(err){ puts(err); return; }
+    double ms=(now_sec()-t0)*1e3;
+    Money total=0;
+    printf("%-10s %12s\n", "Date", "Revenue");
+    for(int i=0;i<=to-from;i++){
+        if(!acc[i]) continue;
+        fmt_date(from+i, d); printf("%-10s %12s\n", d, fmt_money(acc[i], am)); total+=acc[i];
+    }
+    printf("Total: %s  (%d invoices scanned in %.1f ms)\n", fmt_money(total, am), g_invCols.n, ms);
+    free(acc);
+}
+
+static void revenue_per_patient(){
+    int from, to, groups; Money *acc; IdMoney *top; char am[MONEY_LEN];
+    report_dates(&from, &to);
+    double t0=now_sec();
+    const char *err=report_by_patient(&from, &to, &acc, &groups); if(err){ puts(err); return; }
+    double ms=(now_sec()-t0)*1e3;
+    int n=report_top(acc, groups, &top);
+    printf("%-6s %-22s %12s\n", "ID", "Patient", "Billed");
+    for(int i=0;i<n && i<REPORT_TOP;i++){
+        const Patient *p=find_patient_by_id(top[i].id);
+        printf("%-6d %-22.22s %12s\n", top[i].id, p ? p->name : "(deleted)", fmt_money(top[i].v, am));
+    }
+    printf("%d patient(s) billed; top %d shown  (%.1f ms)\n", n, n<REPORT_TOP ? n : REPORT_TOP, ms);
+    free(top); free(acc);
+}
+
+static void appts_per_doctor_day(){
+    int from, to, groups, *acc; char d[DATE_LEN];
+    report_dates(&from, &to);
+    double t0=now_sec();
+    const char *err=report_by_doctor_day(&from, &to, &acc, &groups); if(err){ puts(err); return; }
+    double ms=(now_sec()-t0)*1e3;
+    int span=to-from+1;
+    printf("%-6s %-22s %-10s %5s\n", "ID", "Doctor", "Date", "Appts");
+    for(int id=1;id<groups;id++){
+        const Doctor *doc=find_doctor_by_id(id);
+        for(int k=0;k<span;k++){
+            int c=acc[(size_t)id*span+k]; if(!c) continue;
+            fmt_date(from+k, d); printf("%-6d %-22.22s %-10s %5d\n", id, doc ? doc->name : "(deleted)", d, c);
+        }
+    }
+    printf("(%d appointments scanned in %.1f ms)\n", g_apptCols.n, ms);
+    free(acc);
+}
+
+static void stock_valuation(){
+    Money total=0; char pr[MONEY_LEN], val[MONEY_LEN];
+    printf("%-4s %-22s %-8s %-10s %12s\n", "ID", "Name", "Stock", "Price", "Value");
+    for(int i=0;i<g_meds.count;i++){
+        const Medicine *m=med_at(i); if(!m->id) continue;
+        Money v=med_value(m); total+=v;
+        printf("%-4d %-22.22s %-8d %-10s %12s\n", m->id, m->name, m->stock, fmt_money(m->price, pr), fmt_money(v, val));
+    }
+    printf("Total stock value: %s\n", fmt_money(total, val));
+}
+
+static void print_low(int medicineId, void *unused){
+    (void)unused; const Medicine *m=find_med_by_id(medicineId); if(!m) return;
+    printf("%-4d %-22.22s %8d %8d %8d\n", m->id, m->name, m->stock, m->reorderLevel, m->reorderLevel-m->stock);
+}
+
+static void low_stock(){
+    printf("%-4s %-22s %8s %8s %8s\n", "ID", "Name", "Stock", "Reorder", "Short");
+    double t0=now_sec();
+    STOCK_LOCK(); int n=stock_low(REPORT_TOP, print_low, NULL); STOCK_UNLOCK();
+    printf("%d medicine(s) at or below their reorder level shown  (%.2f ms)\n", n, (now_sec()-t0)*1e3);
+}
+
+static void expiring_lots(){
+    int today=today_day(), until=today+30;
+    input_date("Expiring on or before (YYYY-MM-DD, blank = 30 days from now): ", &until);
+    printf("%-6s %-22s %-10s %8s\n", "Lot", "Medicine", "Expiry", "Units");
+    double t0=now_sec();
+    STOCK_LOCK(); int n=stock_expiring(until, REPORT_TOP, print_lot, &today); STOCK_UNLOCK();
+    printf("%d lot(s) shown  (%.2f ms)\n", n, (now_sec()-t0)*1e3);
+}
+
+static void reports_menu(){
+    while(1){
+        puts("\n[Reports]\n 1) Daily revenue\n 2) Revenue per patient\n 3) Appointments per doctor per day\n 4) Stock valuation\n"
+             " 5) Low stock\n 6) Expiring lots\n 0) Back");
+        int ch=input_int("Choose: ");
+        switch(ch){
+            case 1: daily_revenue(); press_enter(); break;
+            case 2: revenue_per_patient(); press_enter(); break;
+            case 3: appts_per_doctor_day(); press_enter(); break;
+            case 4: stock_valuation(); press_enter(); break;
+            case 5: low_stock(); press_enter(); break;
+            case 6: expiring_lots(); press_enter(); break;
+            case 0: return;
+            default: puts("Invalid.");
+        }
+    }
+}
+
+// --------------------- Benchmarks ---------------------
+/* --bench-parse [rows]: writes synthetic patient and appointment files, then
+ * parses every line with the original sscanf loaders and with the FieldReader
+ * parsers and prints lines/sec for both. Lines are split beforehand so only
+ * the row parsing itself is timed.
+ */
+static int legacy_parse_patient(const char *line, Patient *p){
+    // id|name|age|gender|phone|address|admitted|roomNo
+    char name[NAME_LEN],gender[10],phone[PHONE_LEN],addr[ADDR_LEN];
+    int id, age, admitted, roomNo;
+    if(sscanf(line, "%d|%63[^|]|%d|%9[^|]|%19[^|]|%127[^|]|%d|%d",
+              &id, name, &age, gender, phone, addr, &admitted, &roomNo)!=8) return 0;
+    memset(p,0,sizeof *p);
+    p->id=id; strncpy(p->name,name,NAME_LEN);
+    p->age=age; p->gender=parse_gender(gender);
+    strncpy(p->phone,phone,PHONE_LEN); p->address=str_intern(addr);
+    p->admitted=admitted; p->roomNo=roomNo;
+    return 1;
+}
+
+static int legacy_parse_appt(const char *line, Appointment *a){
+    // id|patId|docId|date|time|notes|canceled
+    int id, pid, did, canceled; char date[DATE_LEN], tim[TIME_LEN], notes[NOTES_LEN];
+    if(sscanf(line, "%d|%d|%d|%10[^|]|%5[^|]|%127[^|]|%d", &id,&pid,&did,date,tim,notes,&canceled)!=7) return 0;
+    memset(a,0,sizeof *a);
+    int day=NO_DAY, minute=NO_TIME; parse_date(date, &day); parse_time(tim, &minute);
+    a->id=id; a->patientId=pid; a->doctorId=did; a->day=day; a->minute=(short)minute; a->notes=str_intern(notes); a->canceled=canceled!=0;
+    return 1;
+}
+
+typedef struct {
+    const char *name;
+    void      (*gen)(FILE *f, long i);
+    int       (*legacy)(const char *line, void *rec);
+    int       (*parse)(const char *line, void *rec);
+    size_t      elem;
+} ParseBench;
+
+static void gen_patient_line(FILE *f, long i){
+    fprintf(f, "%ld|Patient Number %ld|%ld|%s|+1-555-%07ld|%ld Long Street Name, Springfield|0|-1\n",
+            i, i, i%97, i%2 ? "M" : "F", i, i%9000+1);
+}
+
+static void gen_appt_line(FILE *f, long i){
+    fprintf(f, "%ld|%ld|%ld|2026-%02ld-%02ld|%02ld:%02ld|Follow-up visit for case %ld|%ld\n",
+            i, i%50000+1, i%300+1, i%12+1, i%28+1, 8+i%10, (i%4)*15, i, i%20==0 ? 1L : 0L);
+}
+
+// Same result convention as the row parsers: -1 rejected, >= 0 accepted.
+static int legacy_patient_rec(const char *l, void *r){ return legacy_parse_patient(l, (Patient*)r) ? 0 : -1; }
+static int legacy_appt_rec(const char *l, void *r)   { return legacy_parse_appt(l, (Appointment*)r) ? 0 : -1; }
+
+static double bench_lines(int (*fn)(const char*, void*), char **lines, long n, void *rec, long *ok){
+    double t0=now_sec(); *ok=0;
+    for(long i=0;i<n;i++) if(fn(lines[i], rec)>=0) (*ok)++;
+    return now_sec()-t0;
+}
+
+static int bench_parse(long rows){
+    ParseBench benches[]={
+        {"patients",     gen_patient_line, legacy_patient_rec, parse_patient_rec, sizeof(Patient)},
+        {"appointments", gen_appt_line,    legacy_appt_rec,    parse_appt_rec,    sizeof(Appointment)},
+    };
+    const char *path="bench_parse.tmp";
+    printf("%-13s %9s %16s %16s %8s\n", "table", "rows", "sscanf lines/s", "parser lines/s", "speedup");
+    for(size_t b=0;b<sizeof benches/sizeof benches[0];b++){
+        ParseBench *pb=&benches[b];
+        FILE *f=fopen(path,"w"); if(!f){ perror(path); return 1; }
+        for(long i=1;i<=rows;i++) pb->gen(f, i);
+        fclose(f);
+        size_t len=0; char *map=map_file(path, &len); if(!map){ perror(path); return 1; }
+        char **lines=(char**)xcalloc((size_t)rows, sizeof *lines);
+        long n=0;
+        for(char *p=map, *end=map+len; p<end && n<rows; ){
+            char *nl=(char*)memchr(p, '\n', (size_t)(end-p)); if(!nl) break;
+            *nl='\0'; lines[n++]=p; p=nl+1;
+        }
+        void *rec=xcalloc(1, pb->elem);
+        long okOld, okNew;
+        double tOld=bench_lines(pb->legacy, lines, n, rec, &okOld);
+        double tNew=bench_lines(pb->parse, lines, n, rec, &okNew);
+        printf("%-13s %9ld %16.0f %16.0f %7.1fx\n", pb->name, n, n/tOld, n/tNew, tOld/tNew);
+        if(okOld!=n || okNew!=n) printf("  (rows accepted: sscanf %ld, parser %ld)\n", okOld, okNew);
+        free(rec); free(lines); unmap_file(map, len);
+    }
+    remove(path);
+    return 0;
+}
+
+/* --bench-report [rows]: fills the invoice table with synthetic rows (a year
+ * of dates, 50000 patients) in memory and times daily revenue and revenue
+ * per patient three ways: scanning the Invoice records, the column kernels
+ * on one thread, and the column kernels on every pool thread.
+ */
+#define BENCH_PATIENTS 50000
+
+static double bench_rows_by_day(int from, unsigned span, Money *acc){
+    double t0=now_sec();
+    for(int i=0;i<g_invoices.count;i++){
+        const Invoice *iv=invoice_at(i);
+        if((unsigned)iv->day-(unsigned)from<span) acc[iv->day-from]+=iv->amount;
+    }
+    return now_sec()-t0;
+}
+
+static double bench_rows_by_patient(Money *acc){
+    double t0=now_sec();
+    for(int i=0;i<g_invoices.count;i++){ const Invoice *iv=invoice_at(i); acc[iv->patientId]+=iv->amount; }
+    return now_sec()-t0;
+}
+
+static int bench_report(long rows){
+    if(rows<1 || rows>0x7fffffffL) rows=1000000;
+    int from=days_from_civil(2026, 1, 1); unsigned span=365;
+    for(long i=0;i<rows;i++){
+        Invoice *iv=(Invoice*)tbl_push(&g_invoices);
+        iv->id=(int)i+1; iv->patientId=(int)(i*7919%BENCH_PATIENTS)+1; iv->amount=(Money)(i%50000)+100;
+        iv->day=from+(int)(i%span);
+        char desc[DESC_LEN]; snprintf(desc, sizeof desc, "Consultation and follow-up %ld", i%1000);
+        iv->description=str_intern(desc);
+        invcol_set((int)i, iv);
+    }
+    g_nextPatientId=BENCH_PATIENTS+1;
+    pool_start();
+    int nth=pool_threads();
+    printf("%ld invoices, %d thread(s)\n%-20s %10s %12s %12s\n", rows, nth, "report", "rows ms", "cols 1t ms", "cols ms");
+    for(int kind=REP_BY_DAY;kind<=REP_BY_PATIENT;kind++){
+        unsigned groups = kind==REP_BY_DAY ? 0 : BENCH_PATIENTS+1;
+        Money *rowAcc=(Money*)xcalloc(kind==REP_BY_DAY ? span : groups, sizeof(Money));
+        double tRows = kind==REP_BY_DAY ? bench_rows_by_day(from, span, rowAcc) : bench_rows_by_patient(rowAcc);
+        double t0=now_sec();
+        Money *one=(Money*)report_run(kind, g_invCols.n, from, span, groups, 1);
+        double tOne=now_sec()-t0; t0=now_sec();
+        Money *all=(Money*)report_run(kind, g_invCols.n, from, span, groups, 0);
+        double tAll=now_sec()-t0;
+        size_t cells = kind==REP_BY_DAY ? span : groups;
+        int same = !memcmp(rowAcc, one, cells*sizeof(Money)) && !memcmp(one, all, cells*sizeof(Money));
+        printf("%-20s %10.1f %12.1f %12.1f%s\n", kind==REP_BY_DAY ? "daily revenue" : "revenue per patient",
+               tRows*1e3, tOne*1e3, tAll*1e3, same ? "" : "  (results differ!)");
+        free(rowAcc); free(one); free(all);
+    }
+    return 0;
+}
+
+/* --gen [rows]: writes a synthetic dataset as text snapshots in the current
+ * directory. rows (10^3 .. 10^7) is the size of the appointment and invoice
+ * tables; there are rows/4 patients, one doctor per 200 rows and a few
+ * hundred medicines, each stocked in GEN_LOTS lots expiring from two months
+ * ago to two years ahead. Names, addresses and amounts come from small
+ * vocabularies and a fixed-seed generator, so a scale always produces the
+ * same files. Each doctor's appointments are spread over the past and next
+ * year without double-booking, and about 5% are canceled.
+ */
+#define GEN_ROWS_MIN  1000L
+#define GEN_ROWS_MAX  10000000L
+#define GEN_LOTS      3
+
+static unsigned long long g_genRng = 0x9e3779b97f4a7c15ULL;
+
+static unsigned gen_rand(){   // xorshift64*
+    g_genRng^=g_genRng>>12; g_genRng^=g_genRng<<25; g_genRng^=g_genRng>>27;
+    return (unsigned)((g_genRng*2685821657736338717ULL)>>32);
+}
+
+static unsigned gen_below(unsigned n){ return gen_rand()%n; }
+
+#define GEN_PICK(list) (list[gen_below(sizeof list/sizeof list[0])])
+
+static const char *const g_genFirst[]={   // alternately male and female
+    "James","Mary","John","Patricia","Robert","Jennifer","Michael","Linda","William","Elizabeth",
+    "David","Barbara","Richard","Susan","Joseph","Jessica","Thomas","Sarah","Carlos","Karen",
+    "Wei","Nancy","Ahmed","Lisa","Daniel","Fatima","Matthew","Sandra","Anthony","Priya",
+    "Mark","Aisha",
+};
+static const char *const g_genLast[]={
+    "Smith","Johnson","Williams","Brown","Jones","Garcia","Miller","Davis","Rodriguez","Martinez",
+    "Hernandez","Lopez","Gonzalez","Wilson","Anderson","Thomas","Taylor","Moore","Jackson","Martin",
+    "Lee","Perez","Thompson","White","Harris","Sanchez","Clark","Ramirez","Lewis","Robinson",
+    "Khan","Nguyen",
+};
+static const char *const g_genStreets[]={
+    "Oak","Maple","Cedar","Pine","Elm","Washington","Lake","Hill","Park","Main","River","Sunset",
+    "Highland","Church","Mill","Spring",
+};
+static const char *const g_genSuffixes[]={ "St","Ave","Rd","Ln","Blvd","Dr" };
+static const char *const g_genCities[]={
+    "Springfield","Riverside","Franklin","Greenville","Bristol","Clinton","Fairview","Salem",
+    "Madison","Georgetown","Arlington","Ashland",
+};
+static const char *const g_genSpecs[]={
+    "Cardiology","Dermatology","Endocrinology","Family Medicine","Gastroenterology","Neurology",
+    "Obstetrics","Oncology","Ophthalmology","Orthopedics","Pediatrics","Psychiatry","Pulmonology",
+    "Radiology","Rheumatology","Urology",
+};
+static const char *const g_genMeds[]={
+    "Amoxicillin","Atorvastatin","Azithromycin","Cetirizine","Ciprofloxacin","Clopidogrel",
+    "Diclofenac","Doxycycline","Escitalopram","Furosemide","Gabapentin","Hydrochlorothiazide",
+    "Ibuprofen","Insulin Glargine","Levothyroxine","Lisinopril","Loratadine","Losartan",
+    "Metformin","Metoprolol","Montelukast","Naproxen","Omeprazole","Ondansetron","Pantoprazole",
+    "Paracetamol","Prednisone","Salbutamol","Sertraline","Simvastatin","Tramadol","Warfarin",
+};
+static const int g_genStrengths[]={ 5, 10, 20, 25, 50, 100, 250, 500 };
+static const char *const g_genNotes[]={
+    "", "", "Follow-up visit", "Annual check-up", "Review lab results", "New patient consultation",
+    "Medication review", "Post-op check", "Referred by GP", "Chronic pain assessment",
+    "Vaccination", "Blood pressure monitoring", "Discuss imaging results", "Prescription renewal",
+};
+static const char *const g_genServices[]={
+    "Consultation","Follow-up consultation","Lab work","X-ray","Ultrasound","ECG","MRI scan",
+    "Physiotherapy session","Vaccination","Minor procedure",
+};
+
+static int gen_people(long rows){ long n=rows/4;   return n<10 ? 10 : (int)n; }
+static int gen_doctors(long rows){ long n=rows/200; return n<5 ? 5 : (int)n; }
+static int gen_meds(long rows){ long n=100+rows/20000; return n>256 ? 256 : (int)n; }   // 32 names x 8 strengths
+static long gen_clamp(long rows){ return rows<GEN_ROWS_MIN ? GEN_ROWS_MIN : rows>GEN_ROWS_MAX ? GEN_ROWS_MAX : rows; }
+
+static void gen_name(char *out, size_t n, const char *title){
+    snprintf(out, n, "%s%s %s", title, GEN_PICK(g_genFirst), GEN_PICK(g_genLast));
+}
+
+static void gen_phone(char out[PHONE_LEN]){
+    snprintf(out, PHONE_LEN, "+1-%03u-555-%04u", 200+gen_below(800), gen_below(10000));
+}
+
+static void gen_med_name(char out[NAME_LEN], int i){
+    const int nm=(int)(sizeof g_genMeds/sizeof g_genMeds[0]);
+    snprintf(out, NAME_LEN, "%s %dmg", g_genMeds[i%nm], g_genStrengths[i/nm%8]);
+}
+
+// Writes one table's snapshot, with fill(i, row) producing row i (1-based); 0 on I/O error.
+static int gen_table(Journal *j, long count, void (*fill)(long i, long rows, char *row, size_t n), long rows){
+    FILE *f=snap_create(j); if(!f) return 0;
+    char row[768];
+    for(long i=1;i<=count;i++){
+        fill(i, rows, row, sizeof row); fputs(row, f); fputc('\n', f);
+        if(!(i & 0xffff)) str_gc();   // the tables are empty, so this drops every handle made so far
+    }
+    str_gc();
+    return snap_close(j, f);
+}
+
+static int g_genToday, g_genAdmitted;
+
+static void gen_patient_row(long i, long rows, char *row, size_t n){
+    (void)rows; Patient p; memset(&p, 0, sizeof p);
+    char ad[ADDR_LEN]; unsigned first=gen_below(sizeof g_genFirst/sizeof g_genFirst[0]);
+    p.id=(int)i; snprintf(p.name, sizeof p.name, "%s %s", g_genFirst[first], GEN_PICK(g_genLast)); p.age=(int)gen_below(96);
+    p.gender = gen_below(100)<4 ? GENDER_OTHER : first%2 ? GENDER_F : GENDER_M;
+    gen_phone(p.phone);
+    snprintf(ad, sizeof ad, "%u %s %s, %s", 1+gen_below(9999), GEN_PICK(g_genStreets), GEN_PICK(g_genSuffixes), GEN_PICK(g_genCities));
+    p.address=str_intern(ad);
+    p.roomNo=-1; p.since=NO_DAY;
+    // about 5% are admitted, one to a room of the default wards (see Wards), leaving a quarter of them free
+    if(gen_below(100)<5 && g_genAdmitted<WARDS_DEFAULT*WARD_ROOMS_DEFAULT*3/4){
+        int k=g_genAdmitted++;
+        p.admitted=1; p.roomNo=(k%WARDS_DEFAULT+1)*ROOM_STRIDE+k/WARDS_DEFAULT+1; p.since=g_genToday-(int)gen_below(30);
+    }
+    fmt_patient(row, n, &p);
+}
+
+static void gen_doctor_row(long i, long rows, char *row, size_t n){
+    (void)rows; Doctor d; memset(&d, 0, sizeof d);
+    d.id=(int)i; gen_name(d.name, sizeof d.name, "Dr. ");
+    snprintf(d.specialization, sizeof d.specialization, "%s", GEN_PICK(g_genSpecs)); gen_phone(d.phone);
+    fmt_doctor(row, n, &d);
+}
+
+// Per-doctor cursor over that doctor's bookable slots, so appointments never overlap.
+static int *g_genNextSlot;
+static int *g_genLotQty;   // units in each medicine's lots, drawn by gen_med_row for gen_lot_row
+
+static void gen_med_row(long i, long rows, char *row, size_t n){
+    (void)rows; Medicine m; memset(&m, 0, sizeof m);
+    m.id=(int)i; gen_med_name(m.name, (int)i-1); m.price=50+gen_below(20000);
+    for(int k=0;k<GEN_LOTS;k++) m.stock+=(g_genLotQty[(i-1)*GEN_LOTS+k]=(int)gen_below(701));
+    m.reorderLevel = gen_below(4) ? 100+(int)gen_below(400) : 0;
+    fmt_med(row, n, &m);
+}
+
+static void gen_lot_row(long i, long rows, char *row, size_t n){
+    (void)rows; Lot l; memset(&l, 0, sizeof l);
+    l.id=(int)i; l.medicineId=(int)((i-1)/GEN_LOTS)+1; l.expiry=g_genToday-60+(int)gen_below(790); l.qty=g_genLotQty[i-1];
+    fmt_lot(row, n, &l);
+}
+
+static void gen_appt_row(long i, long rows, char *row, size_t n){
+    const int perDay=(WORKDAY_END-WORKDAY_START)/APPT_SLOT_MIN, docs=gen_doctors(rows);
+    Appointment a; memset(&a, 0, sizeof a);
+    a.id=(int)i; a.patientId=1+(int)gen_below((unsigned)gen_people(rows)); a.doctorId=1+(int)gen_below((unsigned)docs);
+    // Average step chosen so each doctor's rows/docs bookings cover about two years.
+    long span=730L*perDay*docs/rows; if(span<1) span=1;
+    int s=(g_genNextSlot[a.doctorId]+=1+(int)gen_below((unsigned)(2*span)));
+    a.day=g_genToday-365+s/perDay; a.minute=(short)(WORKDAY_START+(s%perDay)*APPT_SLOT_MIN);
+    a.canceled = gen_below(100)<5;
+    a.notes=str_intern(GEN_PICK(g_genNotes));
+    fmt_appt(row, n, &a);
+}
+
+static void gen_invoice_row(long i, long rows, char *row, size_t n){
+    Invoice iv; memset(&iv, 0, sizeof iv); char desc[DESC_LEN];
+    iv.id=(int)i; iv.patientId=1+(int)gen_below((unsigned)gen_people(rows)); iv.day=g_genToday-(int)gen_below(366);
+    if(gen_below(10)<6){
+        iv.amount=5000+gen_below(25000);
+        snprintf(desc, sizeof desc, "%s", GEN_PICK(g_genServices));
+    } else {
+        char nm[NAME_LEN]; int k=(int)gen_below((unsigned)gen_meds(rows)), qty=1+(int)gen_below(5);
+        gen_med_name(nm, k); iv.amount=(Money)qty*(50+gen_below(5000));
+        snprintf(desc, sizeof desc, "Medicine: %s x %d", nm, qty);
+    }
+    iv.description=str_intern(desc);
+    fmt_invoice(row, n, &iv);
+}
+
+// rows must already be clamped with gen_clamp. Returns 0 if a file could not be written.
+static int gen_dataset(long rows){
+    g_genRng=0x9e3779b97f4a7c15ULL^(unsigned long long)rows; g_genToday=today_day(); g_genAdmitted=0;
+    g_genNextSlot=(int*)xcalloc((size_t)gen_doctors(rows)+1, sizeof *g_genNextSlot);
+    g_genLotQty=(int*)xcalloc((size_t)gen_meds(rows)*GEN_LOTS, sizeof *g_genLotQty);
+    int ok = gen_table(&g_patJnl, gen_people(rows), gen_patient_row, rows)
+          && gen_table(&g_docJnl, gen_doctors(rows), gen_doctor_row, rows)
+          && gen_table(&g_medJnl, gen_meds(rows), gen_med_row, rows)
+          && gen_table(&g_lotJnl, (long)gen_meds(rows)*GEN_LOTS, gen_lot_row, rows)
+          && gen_table(&g_apptJnl, rows, gen_appt_row, rows)
+          && gen_table(&g_invJnl, rows, gen_invoice_row, rows);
+    free(g_genNextSlot); g_genNextSlot=NULL;
+    free(g_genLotQty); g_genLotQty=NULL;
+    return ok;
+}
+
+static int have_snapshots(){
+    for(int t=0;t<NTABLES;t++){
+        const Journal *j=g_tables[t].jnl;
+        FILE *f=fopen(j->snap, "rb"); if(!f) f=fopen(j->bin, "rb");
+        if(f){ fclose(f); return 1; }
+    }
+    return 0;
+}
+
+static int gen_main(long rows){
+    if(have_snapshots()){ fprintf(stderr, "Snapshots already exist here; run --gen in an empty directory.\n"); return 1; }
+    double t0=now_sec(); rows=gen_clamp(rows);
+    if(!gen_dataset(rows)) return 1;
+    printf("Wrote %d patients, %d doctors, %d medicines in %d lots, %ld appointments, %ld invoices in %.2f s.\n",
+           gen_people(rows), gen_doctors(rows), gen_meds(rows), gen_meds(rows)*GEN_LOTS, rows, rows, now_sec()-t0);
+    return 0;
+}
+
+/* --bench [rows] [file]: the regression suite. Benchmarks whatever snapshots
+ * are in the current directory, generating rows of them first if there are
+ * none, and appends one result per line to file (default stdout):
+ *
+ *     name|rows|ops|total_ms|ns_per_op
+ *
+ * rows is the largest table's size, so results from different scales and
+ * releases can be lined up. Covered: load_all, each save_*, the find_*_by_id
+ * lookups, search_patients, patient balances and invoices, the low-stock and
+ * expiring-lot reports, and scheduling (slot_conflict, next_free_slot, and
+ * next_free_slot + op_schedule_appt).
+ * Snapshots are rewritten in place with the same data; the appointments
+ * booked by the scheduling benchmark are never saved.
+ */
+#define BENCH_LOOKUPS  1000000
+#define BENCH_SEARCHES 2000
+#define BENCH_BOOKINGS 100000   // at most; rows/10 at smaller scales
+
+static void bench_out(FILE *out, const char *name, long rows, long ops, double secs){
+    fprintf(out, "%s|%ld|%ld|%.3f|%.1f\n", name, rows, ops, secs*1e3, ops ? secs*1e9/ops : 0.0);
+}
+
+static int bench_rand_id(int next){ return 1+(int)gen_below(next>1 ? (unsigned)(next-1) : 1u); }
+
+static void bench_count_hit(const Patient *p, void *n){ (void)p; (*(long*)n)++; }
+static void bench_ignore_id(int id, void *n)       { (void)id; (void)n; }
+static void bench_ignore_lot(const Lot *l, void *n){ (void)l; (void)n; }
+
+static int bench_suite(long rows, const char *path){
+    FILE *out = path ? fopen(path, "a") : stdout;
+    if(!out){ perror(path); return 1; }
+    if(!have_snapshots()){
+        double t0=now_sec(); rows=gen_clamp(rows);
+        if(!gen_dataset(rows)){ if(path) fclose(out); return 1; }
+        bench_out(out, "gen", rows, rows*2+gen_people(rows)+gen_doctors(rows)+gen_meds(rows)*(1+GEN_LOTS), now_sec()-t0);
+    }
+    g_genRng=0x2545f4914f6cdd1dULL;
+    double t0=now_sec();
+    load_all();
+    double t=now_sec()-t0;
+    long total=tbl_live(&g_patients)+tbl_live(&g_doctors)+tbl_live(&g_appts)+tbl_live(&g_meds)+tbl_live(&g_invoices)+tbl_live(&g_lots);
+    rows = tbl_live(&g_appts)>tbl_live(&g_invoices) ? tbl_live(&g_appts) : tbl_live(&g_invoices);
+    bench_out(out, "load_all", rows, total, t);
+
+    struct { const char *name; int (*save)(); const Table *t; } saves[]={
+        {"save_patients", save_patients, &g_patients}, {"save_doctors", save_doctors, &g_doctors},
+        {"save_appts", save_appts, &g_appts}, {"save_meds", save_meds, &g_meds}, {"save_invoices", save_invoices, &g_invoices},
+        {"save_lots", save_lots, &g_lots},
+    };
+    for(size_t k=0;k<sizeof saves/sizeof saves[0];k++){
+        t0=now_sec(); int ok=saves[k].save(); t=now_sec()-t0;
+        if(!ok){ fprintf(stderr, "%s failed\n", saves[k].name); if(path) fclose(out); return 1; }
+        bench_out(out, saves[k].name, rows, tbl_live(saves[k].t), t);
+    }
+
+    long found=0;
+    t0=now_sec(); for(int i=0;i<BENCH_LOOKUPS;i++) found+=find_patient_by_id(bench_rand_id(g_nextPatientId))!=NULL;
+    bench_out(out, "find_patient_by_id", rows, BENCH_LOOKUPS, now_sec()-t0);
+    t0=now_sec(); for(int i=0;i<BENCH_LOOKUPS;i++) found+=find_doctor_by_id(bench_rand_id(g_nextDoctorId))!=NULL;
+    bench_out(out, "find_doctor_by_id", rows, BENCH_LOOKUPS, now_sec()-t0);
+    t0=now_sec(); for(int i=0;i<BENCH_LOOKUPS;i++) found+=find_appt_by_id(bench_rand_id(g_nextApptId))!=NULL;
+    bench_out(out, "find_appt_by_id", rows, BENCH_LOOKUPS, now_sec()-t0);
+    t0=now_sec(); for(int i=0;i<BENCH_LOOKUPS;i++) found+=find_med_by_id(bench_rand_id(g_nextMedId))!=NULL;
+    bench_out(out, "find_med_by_id", rows, BENCH_LOOKUPS, now_sec()-t0);
+    t0=now_sec(); for(int i=0;i<BENCH_LOOKUPS;i++) found+=find_invoice_by_id(bench_rand_id(g_nextInvoiceId))!=NULL;
+    bench_out(out, "find_invoice_by_id", rows, BENCH_LOOKUPS, now_sec()-t0);
+
+    // Queries are three-letter pieces of real names, as a user would type them.
+    long hits=0;
+    t0=now_sec();
+    for(int i=0;i<BENCH_SEARCHES;i++){
+        const char *nm = i&1 ? GEN_PICK(g_genLast) : GEN_PICK(g_genFirst);
+        size_t len=strlen(nm), at=len>3 ? gen_below((unsigned)(len-2)) : 0; char q[4];
+        snprintf(q, sizeof q, "%s", nm+at);
+        search_patients(q, bench_count_hit, &hits);
+    }
+    bench_out(out, "search_patients", rows, BENCH_SEARCHES, now_sec()-t0);
+
+    Money sum=0;
+    t0=now_sec();
+    for(int i=0;i<BENCH_LOOKUPS;i++){ const PatientLedger *l=ledger_of(bench_rand_id(g_nextPatientId), 0); if(l) sum+=l->balance; }
+    bench_out(out, "patient_balance", rows, BENCH_LOOKUPS, now_sec()-t0);
+    t0=now_sec();
+    for(int i=0;i<BENCH_LOOKUPS/10;i++){
+        const PatientLedger *l=ledger_of(bench_rand_id(g_nextPatientId), 0);
+        for(int k=0; l && k<l->n; k++){ const Invoice *iv=find_invoice_by_id(l->invoiceIds[k]); if(iv) sum+=iv->amount; }
+    }
+    bench_out(out, "patient_invoices", rows, BENCH_LOOKUPS/10, now_sec()-t0);
+
+    int today=today_day(), fd, fm;
+    t0=now_sec();
+    for(int i=0;i<BENCH_LOOKUPS;i++)
+        found+=slot_conflict(bench_rand_id(g_nextDoctorId), today-365+(int)gen_below(730), WORKDAY_START+(int)gen_below(WORKDAY_END-WORKDAY_START))!=0;
+    bench_out(out, "slot_conflict", rows, BENCH_LOOKUPS, now_sec()-t0);
+    t0=now_sec();
+    for(int i=0;i<BENCH_LOOKUPS/10;i++) found+=next_free_slot(bench_rand_id(g_nextDoctorId), today-365+(int)gen_below(730), 0, &fd, &fm);
+    bench_out(out, "next_free_slot", rows, BENCH_LOOKUPS/10, now_sec()-t0);
+    t0=now_sec();
+    for(int i=0;i<BENCH_SEARCHES;i++) found+=stock_low(REPORT_TOP, bench_ignore_id, NULL);
+    bench_out(out, "stock_low", rows, BENCH_SEARCHES, now_sec()-t0);
+    t0=now_sec();
+    for(int i=0;i<BENCH_SEARCHES;i++) found+=stock_expiring(today+30, REPORT_TOP, bench_ignore_lot, NULL);
+    bench_out(out, "stock_expiring", rows, BENCH_SEARCHES, now_sec()-t0);
+    g_deferLog=1;   // bookings stay in memory
+    long booked=0, bookings = rows/10<BENCH_BOOKINGS ? rows/10 : BENCH_BOOKINGS;
+    t0=now_sec();
+    for(long i=0;i<bookings;i++){
+        Appointment a; memset(&a, 0, sizeof a);
+        a.patientId=bench_rand_id(g_nextPatientId); a.doctorId=bench_rand_id(g_nextDoctorId);
+        if(!next_free_slot(a.doctorId, today+(int)gen_below(365), 0, &fd, &fm)) continue;
+        a.day=fd; a.minute=(short)fm; a.notes=0;
+        booked+=op_schedule_appt(&a)==NULL;
+    }
+    bench_out(out, "schedule_appt", rows, bookings, now_sec()-t0);
+    if(path) fclose(out);
+    fprintf(stderr, "bench: %ld rows, %ld lookups found, %ld search hits, %ld booked (checksum %lld)\n",
+            rows, found, hits, booked, sum);
+    return 0;
+}
+
+// --------------------- Commands ---------------------
+/* Line commands shared by batch mode and the server. A command is a verb and
+ * its fields, separated by the storage delimiter. Handlers return NULL or an
+ * error message; on success they add result rows (in the storage row format)
+ * to the Reply, which may be NULL when nobody reads them. Commands marked as
+ * writes mutate tables and go through the op_* functions.
+ */
+#define CMD_LINE_MAX    2048
+
+typedef struct {
+    char *buf;
+    size_t len, cap;
+    int   rows;
+} Reply;
+
+static void reply_row(Reply *rp, const char *row){
+    if(!rp) return;
+    size_t n=strlen(row);
+    if(rp->len+n+2>rp->cap){
+        while(rp->len+n+2>rp->cap) rp->cap = rp->cap ? rp->cap*2 : 1024;
+        rp->buf=(char*)xrealloc(rp->buf, rp->cap);
+    }
+    memcpy(rp->buf+rp->len, row, n); rp->len+=n;
+    rp->buf[rp->len++]='\n'; rp->buf[rp->len]='\0';
+    rp->rows++;
+}
+
+static void reply_patient(Reply *rp, const Patient *p)  { char row[512]; if(rp){ fmt_patient(row, sizeof row, p); reply_row(rp, row); } }
+static void reply_doctor(Reply *rp, const Doctor *d)    { char row[512]; if(rp){ fmt_doctor(row, sizeof row, d); reply_row(rp, row); } }
+static void reply_appt(Reply *rp, const Appointment *a) { char row[768]; if(rp){ fmt_appt(row, sizeof row, a); reply_row(rp, row); } }
+static void reply_med(Reply *rp, const Medicine *m)     { char row[512]; if(rp){ fmt_med(row, sizeof row, m); reply_row(rp, row); } }
+static void reply_invoice(Reply *rp, const Invoice *iv) { char row[768]; if(rp){ fmt_invoice(row, sizeof row, iv); reply_row(rp, row); } }
+static void reply_lot(Reply *rp, const Lot *l)          { char row[128]; if(rp){ fmt_lot(row, sizeof row, l); reply_row(rp, row); } }
+
+static void hit_patient(const Patient *p, void *rp){ reply_patient((Reply*)rp, p); }
+static void hit_doctor(const Doctor *d, void *rp)  { reply_doctor((Reply*)rp, d); }
+static void hit_lot(const Lot *l, void *rp)        { reply_lot((Reply*)rp, l); }
+static void hit_med_id(int id, void *rp)           { const Medicine *m=find_med_by_id(id); if(m) reply_med((Reply*)rp, m); }
+
+#define MALFORMED "Malformed command."
+
+static const char* cmd_patient_add(FieldReader *r, Reply *rp){
+    Patient p={0}; p.roomNo=-1; char gd[16];
+    fr_str(r,p.name,sizeof p.name); p.age=fr_int(r); fr_str(r,gd,sizeof gd); p.gender=parse_gender(gd);
+    char ad[ADDR_LEN]; fr_str(r,p.phone,sizeof p.phone); fr_str(r,ad,sizeof ad); p.address=str_intern(ad);
+    if(r->bad) return MALFORMED;
+    const char *err=op_add_patient(&p); if(!err) reply_patient(rp, &p);
+    return err;
+}
+
+static const char* cmd_patient_edit(FieldReader *r, Reply *rp){
+    int id=fr_int(r); const Patient *p=live_patient(id);
+    char name[NAME_LEN], age[16], gender[16], phone[PHONE_LEN], addr[ADDR_LEN];
+    fr_str(r,name,sizeof name); fr_str(r,age,sizeof age); fr_str(r,gender,sizeof gender);
+    fr_str(r,phone,sizeof phone); fr_str(r,addr,sizeof addr);
+    if(r->bad) return MALFORMED;
+    if(!p) return "Not found.";
+    Patient u=*p;
+    if(*name) strcpy(u.name,name);
+    if(*age) u.age=atoi(age);
+    if(*gender) u.gender=parse_gender(gender);
+    if(*phone) strcpy(u.phone,phone);
+    if(*addr) u.address=str_intern(addr);
+    const char *err=op_edit_patient(&u); if(!err) reply_patient(rp, &u);
+    return err;
+}
+
+static const char* cmd_patient_delete(FieldReader *r, Reply *rp){
+    (void)rp; int id=fr_int(r); return r->bad ? MALFORMED : op_delete_patient(id);
+}
+
+static const char* cmd_patient_get(FieldReader *r, Reply *rp){
+    int id=fr_int(r); if(r->bad) return MALFORMED;
+    const Patient *p=find_patient_by_id(id); if(!p) return "Not found.";
+    reply_patient(rp, p); return NULL;
+}
+
+static const char* cmd_patient_search(FieldReader *r, Reply *rp){
+    char q[NAME_LEN]; fr_str(r,q,sizeof q); if(r->bad) return MALFORMED;
+    search_patients(q, hit_patient, rp); return NULL;
+}
+
+static const char* cmd_doctor_add(FieldReader *r, Reply *rp){
+    Doctor d={0};
+    fr_str(r,d.name,sizeof d.name); fr_str(r,d.specialization,sizeof d.specialization); fr_str(r,d.phone,sizeof d.phone);
+    if(r->bad) return MALFORMED;
+    const char *err=op_add_doctor(&d); if(!err) reply_doctor(rp, &d);
+    return err;
+}
+
+static const char* cmd_doctor_edit(FieldReader *r, Reply *rp){
+    int id=fr_int(r); const Doctor *d=live_doctor(id);
+    char name[NAME_LEN], spec[SPEC_LEN], phone[PHONE_LEN];
+    fr_str(r,name,sizeof name); fr_str(r,spec,sizeof spec); fr_str(r,phone,sizeof phone);
+    if(r->bad) return MALFORMED;
+    if(!d) return "Not found.";
+    Doctor u=*d;
+    if(*name) strcpy(u.name,name);
+    if(*spec) strcpy(u.specialization,spec);
+    if(*phone) strcpy(u.phone,phone);
+    const char *err=op_edit_doctor(&u); if(!err) reply_doctor(rp, &u);
+    return err;
+}
+
+static const char* cmd_doctor_delete(FieldReader *r, Reply *rp){
+    (void)rp; int id=fr_int(r); return r->bad ? MALFORMED : op_delete_doctor(id);
+}
+
+static const char* cmd_doctor_get(FieldReader *r, Reply *rp){
+    int id=fr_int(r); if(r->bad) return MALFORMED;
+    const Doctor *d=find_doctor_by_id(id); if(!d) return "Not found.";
+    reply_doctor(rp, d); return NULL;
+}
+
+static const char* cmd_doctor_search(FieldReader *r, Reply *rp){
+    char q[NAME_LEN]; fr_str(r,q,sizeof q); if(r->bad) return MALFORMED;
+    search_doctors(q, hit_doctor, rp); return NULL;
+}
+
+static const char* cmd_appt_schedule(FieldReader *r, Reply *rp){
+    Appointment a={0}; char date[32], tim[32]; int day, minute;
+    a.patientId=fr_int(r); a.doctorId=fr_int(r);
+    char nt[NOTES_LEN]; fr_str(r,date,sizeof date); fr_str(r,tim,sizeof tim); fr_str(r,nt,sizeof nt); a.notes=str_intern(nt);
+    if(r->bad) return MALFORMED;
+    if(!parse_date(date, &day)) return "Invalid date. Use YYYY-MM-DD.";
+    if(!parse_time(tim, &minute)) return "Invalid time. Use HH:MM.";
+    a.day=day; a.minute=(short)minute;
+    const char *err=op_schedule_appt(&a); if(!err) reply_appt(rp, &a);
+    return err;
+}
+
+static const char* cmd_appt_cancel(FieldReader *r, Reply *rp){
+    int id=fr_int(r); if(r->bad) return MALFORMED;
+    const char *err=op_cancel_appt(id); if(!err) reply_appt(rp, find_appt_by_id(id));
+    return err;
+}
+
+static const char* cmd_appt_get(FieldReader *r, Reply *rp){
+    int id=fr_int(r); if(r->bad) return MALFORMED;
+    const Appointment *a=find_appt_by_id(id); if(!a) return "Not found.";
+    reply_appt(rp, a); return NULL;
+}
+
+// appt.day|doctorId|YYYY-MM-DD: the doctor's live appointments that day, by time.
+static const char* cmd_appt_day(FieldReader *r, Reply *rp){
+    char date[32]; int did=fr_int(r); fr_str(r,date,sizeof date); int day;
+    if(r->bad) return MALFORMED;
+    if(!parse_date(date, &day)) return "Invalid date. Use YYYY-MM-DD.";
+    const DaySlots *ds=slot_day(did, day, 0);
+    for(int i=0; ds && i<ds->n; i++){ const Appointment *a=find_appt_by_id(ds->apptId[i]); if(a) reply_appt(rp, a); }
+    return NULL;
+}
+
+// appt.next|doctorId|YYYY-MM-DD|HH:MM: earliest free slot from then, as "date|time".
+static const char* cmd_appt_next(FieldReader *r, Reply *rp){
+    char date[32], tim[32]; int did=fr_int(r); fr_str(r,date,sizeof date); fr_str(r,tim,sizeof tim);
+    int day, minute, fd, fm;
+    if(r->bad) return MALFORMED;
+    if(!parse_date(date, &day)) return "Invalid date. Use YYYY-MM-DD.";
+    if(!parse_time(tim, &minute)) return "Invalid time. Use HH:MM.";
+    if(!live_doctor(did)) return "Invalid doctor.";
+    if(!next_free_slot(did, day, minute, &fd, &fm)) return "No free slot in the next year.";
+    char d[DATE_LEN], t[TIME_LEN], row[32];
+    fmt_date(fd, d); fmt_time(fm, t); snprintf(row, sizeof row, "%s|%s", d, t);
+    reply_row(rp, row); return NULL;
+}
+
+// Optional date field: missing or blank leaves *day as it is.
+static const char* cmd_opt_date(FieldReader *r, int *day){
+    char buf[32]="";
+    if(!r->end) fr_str(r,buf,sizeof buf);
+    return *buf && !parse_date(buf, day) ? "Invalid date. Use YYYY-MM-DD." : NULL;
+}
+
+// med.add|name|stock|price[|expiry|reorderLevel]: with an expiry the stock is one lot.
+static const char* cmd_med_add(FieldReader *r, Reply *rp){
+    Medicine m={0}; int expiry=NO_DAY;
+    fr_str(r,m.name,sizeof m.name); m.stock=fr_int(r); m.price=fr_money(r);
+    const char *err=cmd_opt_date(r, &expiry);
+    if(!r->end) m.reorderLevel=fr_int(r);
+    if(r->bad) return MALFORMED;
+    if(!err) err=op_add_med(&m, expiry);
+    if(!err) reply_med(rp, &m);
+    return err;
+}
+
+// med.restock|id|qty[|expiry]: with an expiry the units arrive as a new lot.
+static const char* cmd_med_restock(FieldReader *r, Reply *rp){
+    int id=fr_int(r), qty=fr_int(r), expiry=NO_DAY;
+    const char *err=cmd_opt_date(r, &expiry);
+    if(r->bad) return MALFORMED;
+    if(!err) err=op_restock_med(id, qty, expiry);
+    if(!err) reply_med(rp, find_med_by_id(id));
+    return err;
+}
+
+static const char* cmd_med_reorder(FieldReader *r, Reply *rp){
+    int id=fr_int(r), level=fr_int(r); if(r->bad) return MALFORMED;
+    const char *err=op_set_reorder(id, level); if(!err) reply_med(rp, find_med_by_id(id));
+    return err;
+}
+
+// med.writeoff[|date]: empties the lots that expired before date (default today); "lots|units".
+static const char* cmd_med_writeoff(FieldReader *r, Reply *rp){
+    int day=today_day(), lots, units; char row[32];
+    const char *err=cmd_opt_date(r, &day); if(err) return err;
+    err=op_writeoff_expired(day, &lots, &units);
+    snprintf(row, sizeof row, "%d|%d", lots, units); reply_row(rp, row);
+    return err;
+}
+
+static const char* cmd_med_sell(FieldReader *r, Reply *rp){
+    int pid=fr_int(r), mid=fr_int(r), qty=fr_int(r); Invoice iv;
+    if(r->bad) return MALFORMED;
+    const char *err=op_sell_med(pid, mid, qty, &iv); if(!err) reply_invoice(rp, &iv);
+    return err;
+}
+
+static const char* cmd_med_get(FieldReader *r, Reply *rp){
+    int id=fr_int(r); if(r->bad) return MALFORMED;
+    const Medicine *m=find_med_by_id(id); if(!m) return "Not found.";
+    reply_med(rp, m); return NULL;
+}
+
+static const char* cmd_invoice_add(FieldReader *r, Reply *rp){
+    Invoice iv={0}; iv.day=NO_DAY;
+    char ds[DESC_LEN]; iv.patientId=fr_int(r); iv.amount=fr_money(r); fr_str(r,ds,sizeof ds); iv.description=str_intern(ds);
+    if(r->bad) return MALFORMED;
+    const char *err=op_add_invoice(&iv); if(!err) reply_invoice(rp, &iv);
+    return err;
+}
+
+static const char* cmd_invoice_get(FieldReader *r, Reply *rp){
+    int id=fr_int(r); if(r->bad) return MALFORMED;
+    BILLING_READ();
+    const Invoice *iv=find_invoice_by_id(id); if(iv) reply_invoice(rp, iv);
+    BILLING_UNLOCK();
+    return iv ? NULL : "Not found.";
+}
+
+// billing.balance|patientId: "patientId|balance|invoices".
+static const char* cmd_billing_balance(FieldReader *r, Reply *rp){
+    int pid=fr_int(r); if(r->bad) return MALFORMED;
+    if(!find_patient_by_id(pid)) return "Invalid patient.";
+    char am[MONEY_LEN], row[64];
+    BILLING_READ();
+    const PatientLedger *l=ledger_of(pid, 0);
+    snprintf(row, sizeof row, "%d|%s|%d", pid, fmt_money(l ? l->balance : 0, am), l ? l->n : 0);
+    BILLING_UNLOCK();
+    reply_row(rp, row); return NULL;
+}
+
+static const char* cmd_billing_invoices(FieldReader *r, Reply *rp){
+    int pid=fr_int(r); if(r->bad) return MALFORMED;
+    if(!find_patient_by_id(pid)) return "Invalid patient.";
+    BILLING_READ();
+    const PatientLedger *l=ledger_of(pid, 0);
+    for(int i=0; l && i<l->n; i++){ const Invoice *iv=find_invoice_by_id(l->invoiceIds[i]); if(iv) reply_invoice(rp, iv); }
+    BILLING_UNLOCK();
+    return NULL;
+}
+
+// Optional "|from|to" date fields of the report commands; blank or missing = open.
+static const char* cmd_range(FieldReader *r, int *from, int *to){
+    char a[32]="", b[32]="";
+    if(!r->end) fr_str(r,a,sizeof a);
+    if(!r->end) fr_str(r,b,sizeof b);
+    *from=*to=NO_DAY;
+    if((*a && !parse_date(a, from)) || (*b && !parse_date(b, to))) return "Invalid date. Use YYYY-MM-DD.";
+    return NULL;
+}
+
+// Optional integer field: missing or blank gives 0.
+static int cmd_opt_int(FieldReader *r){
+    char buf[16]="";
+    if(!r->end) fr_str(r,buf,sizeof buf);
+    if(!*buf) return 0;
+    char *end; long v=strtol(buf, &end, 10);
+    if(*end || v<0 || v>0x7fffffff) r->bad=1;
+    return (int)v;
+}
+
+/* ward.admit|patientId[|ward|room|date] and ward.transfer|...: without a
+ * room, the first free room of ward, or of any ward without one either (see
+ * Wards); date defaults to today. Replies with the patient.
+ */
+static const char* cmd_ward_move(FieldReader *r, Reply *rp, int transfer){
+    int id=fr_int(r), ward=cmd_opt_int(r), room=cmd_opt_int(r), day=today_day(); if(r->bad) return MALFORMED;
+    const char *err=cmd_opt_date(r, &day); if(err) return err;
+    err = transfer ? op_transfer(id, ward, room, day) : op_admit(id, ward, room, day);
+    if(!err) reply_patient(rp, find_patient_by_id(id));
+    return err;
+}
+static const char* cmd_ward_admit(FieldReader *r, Reply *rp)   { return cmd_ward_move(r, rp, 0); }
+static const char* cmd_ward_transfer(FieldReader *r, Reply *rp){ return cmd_ward_move(r, rp, 1); }
+
+// ward.discharge|patientId[|date]
+static const char* cmd_ward_discharge(FieldReader *r, Reply *rp){
+    int id=fr_int(r), day=today_day(); if(r->bad) return MALFORMED;
+    const char *err=cmd_opt_date(r, &day); if(err) return err;
+    err=op_discharge(id, day); if(!err) reply_patient(rp, find_patient_by_id(id));
+    return err;
+}
+
+// ward.list: "ward|rooms|occupied|free" per ward.
+static const char* cmd_ward_list(FieldReader *r, Reply *rp){
+    (void)r; char row[64];
+    for(int w=1;w<=g_nwards;w++){
+        const Ward *wd=&g_wards[w]; if(!wd->rooms) continue;
+        snprintf(row, sizeof row, "%d|%d|%d|%d", w, wd->rooms, wd->rooms-wd->free, wd->free); reply_row(rp, row);
+    }
+    return NULL;
+}
+
+// ward.free|ward: the free room numbers, lowest first.
+static const char* cmd_ward_free(FieldReader *r, Reply *rp){
+    int w=fr_int(r); if(r->bad) return MALFORMED;
+    if(w<1 || w>g_nwards || !g_wards[w].rooms) return "No such ward.";
+    unsigned long long bits[WARD_WORDS]; memcpy(bits, g_wards[w].freeBits, sizeof bits);
+    char row[16];
+    for(int i; (i=bit_first(bits, WARD_WORDS))>=0; ){ bit_clear(bits, i); snprintf(row, sizeof row, "%d", w*ROOM_STRIDE+i+1); reply_row(rp, row); }
+    return NULL;
+}
+
+// room.timeline|room: "patientId|from|to" per stay since load, to blank for the current one.
+static const char* cmd_room_timeline(FieldReader *r, Reply *rp){
+    int no=fr_int(r), w, n; if(r->bad) return MALFORMED;
+    const Room *rm=room_of(no, &w, &n); if(!rm) return "No such room.";
+    char row[64], from[DATE_LEN], to[DATE_LEN];
+    for(int i=0;i<rm->n;i++){
+        const Stay *st=&rm->stays[i]; fmt_date(st->from, from); fmt_date(st->to, to);
+        snprintf(row, sizeof row, "%d|%s|%s", st->patientId, from, to); reply_row(rp, row);
+    }
+    return NULL;
+}
+
+/* Shared tail of the list commands: optional "|offset|limit" (limit defaults
+ * to LIST_PAGE, at most LIST_LIMIT_MAX), then the matching rows in storage
+ * format, in table order.
+ */
+static const char* cmd_list(FieldReader *r, Reply *rp, int kind, ListFilter *f){
+    int offset=cmd_opt_int(r), limit=cmd_opt_int(r);
+    if(r->bad) return MALFORMED;
+    if(!limit) limit=LIST_PAGE;
+    if(limit>LIST_LIMIT_MAX) limit=LIST_LIMIT_MAX;
+    if(kind==LIST_INVOICES) BILLING_READ();
+    int pos=list_next(kind, f, 0);
+    for(; pos>=0 && offset>0; offset--) pos=list_next(kind, f, pos+1);
+    for(; pos>=0 && limit>0; limit--, pos=list_next(kind, f, pos+1)){
+        if(kind==LIST_PATIENTS) reply_patient(rp, patient_at(pos));
+        else if(kind==LIST_APPTS) reply_appt(rp, appt_at(pos));
+        else reply_invoice(rp, invoice_at(pos));
+    }
+    if(kind==LIST_INVOICES) BILLING_UNLOCK();
+    return NULL;
+}
+
+// patient.list[|offset|limit]
+static const char* cmd_patient_list(FieldReader *r, Reply *rp){
+    ListFilter f; filter_all(&f);
+    return cmd_list(r, rp, LIST_PATIENTS, &f);
+}
+
+// appt.list[|from|to|doctorId|patientId|canceled|offset|limit]; canceled is 0, 1 or blank for both.
+static const char* cmd_appt_list(FieldReader *r, Reply *rp){
+    ListFilter f; filter_all(&f); int to;
+    const char *err=cmd_range(r, &f.lo, &to); if(err) return err;
+    if(to!=NO_DAY) f.hi=to;
+    f.doctorId=cmd_opt_int(r); f.patientId=cmd_opt_int(r);
+    char c[4]=""; if(!r->end) fr_str(r,c,sizeof c);
+    if(*c) f.canceled = *c=='1';
+    return cmd_list(r, rp, LIST_APPTS, &f);
+}
+
+// invoice.list[|from|to|patientId|offset|limit]
+static const char* cmd_invoice_list(FieldReader *r, Reply *rp){
+    ListFilter f; filter_all(&f); int to;
+    const char *err=cmd_range(r, &f.lo, &to); if(err) return err;
+    if(to!=NO_DAY) f.hi=to;
+    f.patientId=cmd_opt_int(r);
+    return cmd_list(r, rp, LIST_INVOICES, &f);
+}
+
+// report.revenue[|from|to]: "date|amount" per day with revenue.
+static const char* cmd_report_revenue(FieldReader *r, Reply *rp){
+    int from, to; Money *acc; char d[DATE_LEN], am[MONEY_LEN], row[64];
+    const char *err=cmd_range(r, &from, &to); if(!err) err=report_by_day(&from, &to, &acc);
+    if(err) return err;
+    for(int i=0;i<=to-from;i++){
+        if(!acc[i]) continue;
+        fmt_date(from+i, d); snprintf(row, sizeof row, "%s|%s", d, fmt_money(acc[i], am)); reply_row(rp, row);
+    }
+    free(acc); return NULL;
+}
+
+// report.patients[|from|to|limit]: "patientId|amount", largest first.
+static const char* cmd_report_patients(FieldReader *r, Reply *rp){
+    int from, to, groups, limit=0; Money *acc; IdMoney *top; char am[MONEY_LEN], row[64];
+    const char *err=cmd_range(r, &from, &to);
+    if(!err && !r->end){ limit=fr_int(r); if(r->bad) return MALFORMED; }
+    if(!err) err=report_by_patient(&from, &to, &acc, &groups);
+    if(err) return err;
+    int n=report_top(acc, groups, &top);
+    for(int i=0;i<n && (limit<=0 || i<limit);i++){
+        snprintf(row, sizeof row, "%d|%s", top[i].id, fmt_money(top[i].v, am)); reply_row(rp, row);
+    }
+    free(top); free(acc); return NULL;
+}
+
+// report.appts[|from|to]: "doctorId|date|count" for every doctor and day with appointments.
+static const char* cmd_report_appts(FieldReader *r, Reply *rp){
+    int from, to, groups, *acc; char d[DATE_LEN], row[64];
+    const char *err=cmd_range(r, &from, &to); if(!err) err=report_by_doctor_day(&from, &to, &acc, &groups);
+    if(err) return err;
+    int span=to-from+1;
+    for(int id=1;id<groups;id++) for(int k=0;k<span;k++){
+        int c=acc[(size_t)id*span+k]; if(!c) continue;
+        fmt_date(from+k, d); snprintf(row, sizeof row, "%d|%s|%d", id, d, c); reply_row(rp, row);
+    }
+    free(acc); return NULL;
+}
+
+// report.stock: "medicineId|value" per medicine, then "total|value".
+static const char* cmd_report_stock(FieldReader *r, Reply *rp){
+    (void)r; Money total=0; char am[MONEY_LEN], row[64];
+    for(int i=0;i<g_meds.count;i++){
+        const Medicine *m=med_at(i); if(!m->id) continue;
+        Money v=med_value(m); total+=v;
+        snprintf(row, sizeof row, "%d|%s", m->id, fmt_money(v, am)); reply_row(rp, row);
+    }
+    snprintf(row, sizeof row, "total|%s", fmt_money(total, am)); reply_row(rp, row);
+    return NULL;
+}
+
+// med.lots|id: the medicine's open lots, in the order sales draw on them.
+static const char* cmd_med_lots(FieldReader *r, Reply *rp){
+    int id=fr_int(r); if(r->bad) return MALFORMED;
+    if(!find_med_by_id(id)) return "Not found.";
+    STOCK_LOCK(); stock_lots(id, hit_lot, rp); STOCK_UNLOCK();
+    return NULL;
+}
+
+// med.low[|limit]: medicines at or below their reorder level, shortest first.
+static const char* cmd_med_low(FieldReader *r, Reply *rp){
+    int limit=cmd_opt_int(r); if(r->bad) return MALFORMED;
+    STOCK_LOCK(); stock_low(limit ? limit : 0x7fffffff, hit_med_id, rp); STOCK_UNLOCK();
+    return NULL;
+}
+
+// med.expiring[|date|limit]: open lots expiring on or before date (default today), earliest first.
+static const char* cmd_med_expiring(FieldReader *r, Reply *rp){
+    int day=today_day(); const char *err=cmd_opt_date(r, &day); if(err) return err;
+    int limit=cmd_opt_int(r); if(r->bad) return MALFORMED;
+    STOCK_LOCK(); stock_expiring(day, limit ? limit : 0x7fffffff, hit_lot, rp); STOCK_UNLOCK();
+    return NULL;
+}
+
+// stats: one "table|live rows|next id" row per table, then "strings|entries|arena bytes".
+static const char* cmd_stats(FieldReader *r, Reply *rp){
+    (void)r; char row[64];
+    snprintf(row, sizeof row, "patients|%d|%d", tbl_live(&g_patients), g_nextPatientId); reply_row(rp, row);
+    snprintf(row, sizeof row, "doctors|%d|%d", tbl_live(&g_doctors), g_nextDoctorId); reply_row(rp, row);
+    snprintf(row, sizeof row, "appointments|%d|%d", tbl_live(&g_appts), g_nextApptId); reply_row(rp, row);
+    snprintf(row, sizeof row, "medicines|%d|%d", tbl_live(&g_meds), g_nextMedId); reply_row(rp, row);
+    snprintf(row, sizeof row, "lots|%d|%d", tbl_live(&g_lots), g_nextLotId); reply_row(rp, row);
+    BILLING_READ();
+    snprintf(row, sizeof row, "invoices|%d|%d", tbl_live(&g_invoices), g_nextInvoiceId);
+    BILLING_UNLOCK();
+    reply_row(rp, row);
+    STR_LOCK(); snprintf(row, sizeof row, "strings|%u|%zu", g_strs.live, g_strs.bytes); STR_UNLOCK();
+    reply_row(rp, row);
+    return NULL;
+}
+
+static void reply_probe(Reply *rp, const char *name, const Probe *p){
+    ProbeSummary s; probe_summary(p, &s); if(!s.count) return;
+    char row[256];
+    snprintf(row, sizeof row, "%s|%llu|%.3f|%.3f|%.3f|%.3f|%.3f|%.3f|%.3f|%llu", name, s.count, s.totalNs/1e6,
+             (double)s.totalNs/s.count/1e3, s.p50/1e3, s.p90/1e3, s.p99/1e3, s.p999/1e3, s.maxNs/1e3, s.bytes);
+    reply_row(rp, row);
+}
+
+/* probes[|on|off|reset]: switches or clears instrumentation, then one
+ * "name|count|total_ms|mean_us|p50_us|p90_us|p99_us|p999_us|max_us|bytes"
+ * row per probe that has fired.
+ */
+static const char* cmd_probes(FieldReader *r, Reply *rp){
+    char arg[8]=""; if(!r->end) fr_str(r,arg,sizeof arg);
+    if(!strcmp(arg, "on") || !strcmp(arg, "off")) __atomic_store_n(&g_probesOn, arg[1]=='n', __ATOMIC_RELAXED);
+    else if(!strcmp(arg, "reset")) probes_reset();
+    else if(*arg) return MALFORMED;
+    for(int i=0;i<PROBE_COUNT;i++) reply_probe(rp, g_probeNames[i], &g_probes[i]);
+    for(int i=0;i<PROBE_MAX_CMDS;i++) if(g_cmdProbeNames[i]) reply_probe(rp, g_cmdProbeNames[i], &g_cmdProbes[i]);
+    return NULL;
+}
+
+/* refs[|name|action]: sets a referential rule (see Integrity), then one
+ * "name|action|orphans" row per rule, orphans as counted at load.
+ */
+static const char* cmd_refs(FieldReader *r, Reply *rp){
+    if(!r->end){
+        char name[32], action[16]; fr_str(r,name,sizeof name); fr_str(r,action,sizeof action);
+        if(r->bad) return MALFORMED;
+        if(!ref_set(name, action)) return "Unknown rule or action.";
+    }
+    char row[96];
+    for(int i=0;i<NREFS;i++){
+        const RefRule *rr=&g_refRules[i];
+        snprintf(row, sizeof row, "%s|%s|%lld", rr->name, g_refActions[rr->action], rr->orphans); reply_row(rp, row);
+    }
+    return NULL;
+}
+
+/* cdc.status: replication state (see Replication), "role|leader", "role|standby" or
+ * "role|standalone", then for a leader
+ *     seq|<last>|<sendable>    ring|<oldest seq it can resend>    feed|<slot>|<sent>|<behind>
+ * and for a standby
+ *     seq|<applied>|<leader's>    lag|<records>|<ms behind the leader's clock>
+ *     stream|<records applied>|<snapshots>|<reconnects>|<connected>
+ */
+static const char* cmd_cdc_status(FieldReader *r, Reply *rp){
+    (void)r; char row[128];
+    if(g_follow.leader){
+        long long seq=jnl_last_seq(), leaderSeq=__atomic_load_n(&g_follow.leaderSeq, __ATOMIC_RELAXED);
+        long long behind = leaderSeq>seq ? leaderSeq-seq : 0;
+        long long ms = behind && g_follow.lastNs ? (wall_ns()-g_follow.lastNs)/1000000 : 0;
+        reply_row(rp, "role|standby");
+        snprintf(row, sizeof row, "seq|%lld|%lld", seq, leaderSeq); reply_row(rp, row);
+        snprintf(row, sizeof row, "lag|%lld|%lld", behind, ms > 0 ? ms : 0); reply_row(rp, row);
+        snprintf(row, sizeof row, "stream|%lld|%lld|%lld|%d", g_follow.applied, g_follow.snapshots,
+                 __atomic_load_n(&g_follow.reconnects, __ATOMIC_RELAXED), __atomic_load_n(&g_follow.connected, __ATOMIC_RELAXED));
+        reply_row(rp, row);
+        return NULL;
+    }
+    if(!g_cdcRing){ reply_row(rp, "role|standalone"); return NULL; }
+    reply_row(rp, "role|leader");
+    SYNC_LOCK();
+    long long seq=g_seq, ready=cdc_ready_locked(), base=g_cdcBase;
+    CdcFeed feeds[CDC_MAX_FEEDS]; memcpy(feeds, g_cdcFeeds, sizeof feeds);
+    SYNC_UNLOCK();
+    snprintf(row, sizeof row, "seq|%lld|%lld", seq, ready); reply_row(rp, row);
+    snprintf(row, sizeof row, "ring|%lld", base+1); reply_row(rp, row);
+    for(int k=0;k<CDC_MAX_FEEDS;k++) if(feeds[k].used){
+        snprintf(row, sizeof row, "feed|%d|%lld|%lld", k, feeds[k].sent, ready>feeds[k].sent ? ready-feeds[k].sent : 0); reply_row(rp, row);
+    }
+    return NULL;
+}
+
+static const char* cmd_ping(FieldReader *r, Reply *rp){ (void)r; (void)rp; return NULL; }
+
+#define CMD_READ          0
+#define CMD_WRITE         1   // needs the exclusive lock in server mode
+#define CMD_SHARED_WRITE  2   // writes, but does its own finer locking (op_sell_med)
+
+typedef struct {
+    const char  *verb;
+    int          writes;    // CMD_*; writes are the commands allowed in batches
+    const char* (*run)(FieldReader *r, Reply *rp);
+} Command;
+
+static const Command g_commands[]={
+    {"patient.add",      CMD_WRITE,        cmd_patient_add},
+    {"patient.edit",     CMD_WRITE,        cmd_patient_edit},
+    {"patient.delete",   CMD_WRITE,        cmd_patient_delete},
+    {"patient.get",      CMD_READ,         cmd_patient_get},
+    {"patient.search",   CMD_READ,         cmd_patient_search},
+    {"patient.list",     CMD_READ,         cmd_patient_list},
+    {"doctor.add",       CMD_WRITE,        cmd_doctor_add},
+    {"doctor.edit",      CMD_WRITE,        cmd_doctor_edit},
+    {"doctor.delete",    CMD_WRITE,        cmd_doctor_delete},
+    {"doctor.get",       CMD_READ,         cmd_doctor_get},
+    {"doctor.search",    CMD_READ,         cmd_doctor_search},
+    {"appt.schedule",    CMD_WRITE,        cmd_appt_schedule},
+    {"appt.cancel",      CMD_WRITE,        cmd_appt_cancel},
+    {"appt.get",         CMD_READ,         cmd_appt_get},
+    {"appt.day",         CMD_READ,         cmd_appt_day},
+    {"appt.next",        CMD_READ,         cmd_appt_next},
+    {"appt.list",        CMD_READ,         cmd_appt_list},
+    {"med.add",          CMD_WRITE,        cmd_med_add},
+    {"med.restock",      CMD_WRITE,        cmd_med_restock},
+    {"med.sell",         CMD_SHARED_WRITE, cmd_med_sell},
+    {"med.get",          CMD_READ,         cmd_med_get},
+    {"med.reorder",      CMD_WRITE,        cmd_med_reorder},
+    {"med.writeoff",     CMD_WRITE,        cmd_med_writeoff},
+    {"med.lots",         CMD_READ,         cmd_med_lots},
+    {"med.low",          CMD_READ,         cmd_med_low},
+    {"med.expiring",     CMD_READ,         cmd_med_expiring},
+    {"ward.admit",       CMD_WRITE,        cmd_ward_admit},
+    {"ward.transfer",    CMD_WRITE,        cmd_ward_transfer},
+    {"ward.discharge",   CMD_WRITE,        cmd_ward_discharge},
+    {"ward.list",        CMD_READ,         cmd_ward_list},
+    {"ward.free",        CMD_READ,         cmd_ward_free},
+    {"room.timeline",    CMD_READ,         cmd_room_timeline},
+    {"invoice.add",      CMD_WRITE,        cmd_invoice_add},
+    {"invoice.get",      CMD_READ,         cmd_invoice_get},
+    {"invoice.list",     CMD_READ,         cmd_invoice_list},
+    {"billing.balance",  CMD_READ,         cmd_billing_balance},
+    {"billing.invoices", CMD_READ,         cmd_billing_invoices},
+    {"report.revenue",   CMD_READ,         cmd_report_revenue},
+    {"report.patients",  CMD_READ,         cmd_report_patients},
+    {"report.appts",     CMD_READ,         cmd_report_appts},
+    {"report.stock",     CMD_READ,         cmd_report_stock},
+    {"stats",            CMD_READ,         cmd_stats},
+    {"probes",           CMD_READ,         cmd_probes},
+    {"cdc.status",       CMD_READ,         cmd_cdc_status},
+    {"refs",             CMD_WRITE,        cmd_refs},
+    {"ping",             CMD_READ,         cmd_ping},
+};
+
+// Names the per-command probes after the verbs, then starts instrumentation.
+static void cmd_probes_start(){
+    for(size_t i=0;i<sizeof g_commands/sizeof g_commands[0] && i<PROBE_MAX_CMDS;i++) g_cmdProbeNames[i]=g_commands[i].verb;
+    probes_start();
+}
+
+// Reads the verb off r and returns its command, or NULL.
+static const Command* cmd_lookup(FieldReader *r){
+    char verb[32]; fr_str(r, verb, sizeof verb);
+    for(size_t i=0;i<sizeof g_commands/sizeof g_commands[0];i++)
+        if(!strcmp(verb, g_commands[i].verb)) return &g_commands[i];
+    return NULL;
+}
+
+// --------------------- Batch ---------------------
+/* --batch [file]: applies the write commands above, one per line, from file
+ * (or stdin) without prompts, e.g. for bulk imports:
+ *     patient.add|name|age|gender|phone|address
+ *     patient.edit|id|name|age|gender|phone|address     (empty field = keep)
+ *     patient.delete|id
+ *     doctor.add|name|specialization|phone
+ *     doctor.edit|id|name|specialization|phone
+ *     doctor.delete|id
+ *     appt.schedule|patientId|doctorId|YYYY-MM-DD|HH:MM|notes
+ *     appt.cancel|id
+ *     med.add|name|stock|price|expiry|reorderLevel      (last two optional)
+ *     med.restock|id|qty|expiry                          (expiry optional)
+ *     med.sell|patientId|medicineId|qty
+ *     med.reorder|id|level
+ *     med.writeoff|YYYY-MM-DD                            (optional, default today)
+ *     ward.admit|patientId|ward|room|YYYY-MM-DD          (all but patientId optional, see Wards)
+ *     ward.transfer|patientId|ward|room|YYYY-MM-DD       (as ward.admit)
+ *     ward.discharge|patientId|YYYY-MM-DD                (optional, default today)
+ *     invoice.add|patientId|amount|description
+ *     refs|name|action                                   (delete rule, see Integrity)
+ * Blank lines and lines starting with '#' are skipped. A failing command is
+ * reported and skipped. The whole run is one unit: nothing reaches the
+ * journals while it runs, and at the end every touched table is written to
+ * a new snapshot and they are swapped in together (see snap_release), so an
+ * interrupted or failed batch leaves the files as they were, and one that
+ * stops while swapping is completed on the next start.
+ */
+#define BATCH_ERRORS_MAX   100   // reported individually; the rest are only counted
+
+// Runs one command line; NULL on success, else the reason it was rejected.
+static const char* batch_exec(const char *line){
+    FieldReader r; fr_init(&r, line);
+    const Command *c=cmd_lookup(&r);
+    if(!c) return "Unknown command.";
+    if(c->writes==CMD_READ) return "Not a batch command.";
+    long long t0=probe_start();
+    const char *err=c->run(&r, NULL);
+    probe_end_cmd((int)(c-g_commands), t0);
+    return err;
+}
+
+static int batch_run(const char *path){
+    FILE *in = path && strcmp(path,"-") ? fopen(path,"r") : stdin;
+    if(!in){ perror(path); return 1; }
+    load_all();
+    g_deferLog=1;
+    char line[CMD_LINE_MAX];
+    long lineNo=0, ops=0, errors=0;
+    double t0=now_sec(), lastReport=t0;
+    while(fgets(line, sizeof line, in)){
+        lineNo++;
+        size_t n=strlen(line);
+        const char *err=NULL;
+        if(n && line[n-1]=='\n') line[--n]='\0';
+        else if(!feof(in)){   // over-long line: drop the rest of it
+            int c; while((c=fgetc(in))!=EOF && c!='\n'){}
+            err="Line too long.";
+        }
+        if(n && line[n-1]=='\r') line[--n]='\0';
+        if(!err && (!n || line[0]=='#')) continue;
+        if(!err) err=batch_exec(line);
+        ops++;
+        if(err && ++errors<=BATCH_ERRORS_MAX) fprintf(stderr, "line %ld: %s\n", lineNo, err);
+        if(ops%4096==0 && now_sec()-lastReport>=1.0){
+            lastReport=now_sec();
+            fprintf(stderr, "  %ld ops, %ld errors, %.0f ops/sec\n", ops, errors, ops/(lastReport-t0));
+        }
+    }
+    if(in!=stdin) fclose(in);
+    double t1=now_sec();
+    // One seq for the whole batch, so the new snapshots outrank any older ones;
+    // they are swapped in together or not at all.
+    g_deferLog=0; g_seq++;
+    g_snapHold=1;
+    int unsaved=compact_all();
+    if(!snap_release(!unsaved) && !unsaved) unsaved=1;
+    double t2=now_sec();
+    if(errors>BATCH_ERRORS_MAX) fprintf(stderr, "(%ld more errors not shown)\n", errors-BATCH_ERRORS_MAX);
+    printf("Batch: %ld ops, %ld applied, %ld errors in %.3f s (%.0f ops/sec); saved in %.3f s\n",
+           ops, ops-errors, errors, t1-t0, (t1>t0 ? ops/(t1-t0) : 0.0), t2-t1);
+    if(unsaved){ fprintf(stderr, "The batch could not be saved (%d table(s) failed); the files are unchanged and its changes are lost.\n", unsaved); return 1; }
+    return errors ? 1 : 0;
+}
+
+// --------------------- Server ---------------------
+/* --serve [socket]: shares one dataset between desks over a Unix-domain socket
+ * (default hms.sock). Each connection gets a thread and sends command lines
+ * (see Commands; "quit" hangs up). Every request is answered with
+ *     OK <n>            followed by n result rows, or
+ *     ERR <message>
+ * Reads run concurrently under a shared lock; write commands take it
+ * exclusively, so they are serialized and each one is journaled before the
+ * next starts. Sales are the exception and run under the shared lock (see
+ * Operations). A write is acknowledged once group commit has made it durable;
+ * if an fsync fails, the tables whose journals are in doubt are saved first
+ * (jnl_sync_recover), and the write gets ERR if that fails too.
+ * SIGINT/SIGTERM compact the journals and stop the server. A connection
+ * that sends "cdc|<seq>" instead receives the change feed, and a server
+ * started with --follow is a read-only standby (see Replication).
+ */
+#ifndef _WIN32
+#define SERVER_SOCKET   "hms.sock"
+#define SERVER_BACKLOG  64
+
+static pthread_rwlock_t      g_dbLock;
+static volatile sig_atomic_t g_stop = 0;
+
+static void on_stop_signal(int sig){ (void)sig; g_stop=1; }
+
+static void cdc_start();                        // see Replication
+static void cdc_feed(int fd, long long from);
+static int  follow_start(const char *leader);
+
+static int write_all(int fd, const char *p, size_t n){
+    while(n){
+        ssize_t w=send(fd, p, n, MSG_NOSIGNAL);
+        if(w<0){ if(errno==EINTR) continue; return -1; }
+        p+=w; n-=(size_t)w;
+    }
+    return 0;
+}
+
+/* After a failed fsync: saves every table whose journal is in doubt, and
+ * those with txn.jnl groups when txn.jnl is, so the snapshots hold the
+ * records and g_durableSeq can move on. Returns 0 if some are still in
+ * doubt. Call with the exclusive lock held.
+ */
+static int jnl_sync_recover(){
+    int failed[NTABLES], txnFailed;
+    SYNC_LOCK();
+    for(int t=0;t<NTABLES;t++) failed[t]=g_tables[t].jnl->syncFailed;
+    txnFailed=g_txnJnl.syncFailed;
+    SYNC_UNLOCK();
+    int covered=1;
+    for(int t=0;t<NTABLES;t++){
+        Journal *j=g_tables[t].jnl;
+        if(failed[t] || (txnFailed && j->txnSeq>j->snapSeq)) g_tables[t].save();
+        if(j->txnSeq>j->snapSeq) covered=0;
+    }
+    if(txnFailed && covered) jnl_truncate(&g_txnJnl);
+    SYNC_LOCK();
+    int ok=!g_syncDoubt;
+    if(ok && !g_flusher) g_durableSeq=g_appendedSeq;   // every other record was synced as it was appended
+    SYNC_UNLOCK();
+    return ok;
+}
+
+// Runs one request under the database lock and fills in the reply text.
+static void server_exec(char *line, Reply *rp, char *head, size_t headCap){
+    FieldReader r; fr_init(&r, line);
+    const Command *c=cmd_lookup(&r);
+    const char *err="Unknown command.";
+    rp->len=0; rp->rows=0;
+    if(c && c->writes && g_follow.leader) err="Read-only standby.";
+    else if(c){
+        long long t0=probe_start();
+        if(c->writes==CMD_WRITE) pthread_rwlock_wrlock(&g_dbLock); else pthread_rwlock_rdlock(&g_dbLock);
+        err=c->run(&r, rp);
+        long long seq=jnl_last_seq();
+        pthread_rwlock_unlock(&g_dbLock);
+        if(c->writes && !err && !jnl_wait_durable(seq)){   // acknowledge only what is on disk
+            pthread_rwlock_wrlock(&g_dbLock); int saved=jnl_sync_recover(); pthread_rwlock_unlock(&g_dbLock);
+            if(!saved || !jnl_wait_durable(seq)) err="Could not sync the journal.";
+        }
+        probe_end_cmd((int)(c-g_commands), t0);   // lock wait and durability included
+        if(__atomic_exchange_n(&g_txnCompactDue, 0, __ATOMIC_ACQ_REL)){
+            pthread_rwlock_wrlock(&g_dbLock); txn_compact(); pthread_rwlock_unlock(&g_dbLock);
+        }
+    }
+    if(err){ rp->len=0; rp->rows=0; snprintf(head, headCap, "ERR %s\n", err); }
+    else snprintf(head, headCap, "OK %d\n", rp->rows);
+}
+
+static void* server_client(void *arg){
+    int fd=(int)(intptr_t)arg;
+    FILE *in=fdopen(fd, "r"); if(!in){ close(fd); return NULL; }
+    char line[CMD_LINE_MAX], head[160];
+    Reply rp={NULL, 0, 0, 0};
+    while(fgets(line, sizeof line, in)){
+        size_t n=strlen(line);
+        if(n && line[n-1]=='\n') line[--n]='\0';
+        else if(!feof(in)){   // over-long request: drop the rest of it
+            int c; while((c=fgetc(in))!=EOF && c!='\n'){}
+            if(write_all(fd, "ERR Line too long.\n", 19)<0) break;
+            continue;
+        }
+        if(n && line[n-1]=='\r') line[--n]='\0';
+        if(!strcmp(line, "quit")) break;
+        if(!strncmp(line, "cdc|", 4)){ cdc_feed(fd, atoll(line+4)); break; }
+        server_exec(line, &rp, head, sizeof head);
+        if(write_all(fd, head, strlen(head))<0 || (rp.len && write_all(fd, rp.buf, rp.len)<0)) break;
+    }
+    free(rp.buf);
+    fclose(in);   // closes fd
+    return NULL;
+}
+
+// leader: the standby's socket path with --follow, NULL for a primary.
+static int serve(const char *path, const char *leader){
+    if(strlen(path)>=sizeof(((struct sockaddr_un*)0)->sun_path)){ fprintf(stderr, "%s: socket path too long\n", path); return 1; }
+    load_all();
+    pthread_rwlockattr_t ra; pthread_rwlockattr_init(&ra);
+#ifdef __GLIBC__
+    // a steady stream of readers must not starve the writers
+    pthread_rwlockattr_setkind_np(&ra, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+    pthread_rwlock_init(&g_dbLock, &ra);
+    pthread_rwlockattr_destroy(&ra);
+    g_concurrentSales=1;
+    if(!leader) cdc_start();
+
+    int ls=socket(AF_UNIX, SOCK_STREAM, 0); if(ls<0){ perror("socket"); return 1; }
+    struct sockaddr_un addr; memset(&addr, 0, sizeof addr);
+    addr.sun_family=AF_UNIX; strcpy(addr.sun_path, path);
+    unlink(path);
+    if(bind(ls, (struct sockaddr*)&addr, sizeof addr)<0 || listen(ls, SERVER_BACKLOG)<0){ perror(path); close(ls); return 1; }
+
+    struct sigaction sa; memset(&sa, 0, sizeof sa);
+    sa.sa_handler=on_stop_signal;   // no SA_RESTART: accept() must return EINTR
+    sigaction(SIGINT, &sa, NULL); sigaction(SIGTERM, &sa, NULL);
+    sigset_t stop, old; sigemptyset(&stop); sigaddset(&stop, SIGINT); sigaddset(&stop, SIGTERM);
+    printf("Serving on %s (%d patients, %d doctors)%s%s. Ctrl-C to stop.\n", path, tbl_live(&g_patients), tbl_live(&g_doctors),
+           leader ? ", following " : "", leader ? leader : "");
+    fflush(stdout);
+    if(leader){
+        pthread_sigmask(SIG_BLOCK, &stop, &old);
+        int ok=follow_start(leader);
+        pthread_sigmask(SIG_SETMASK, &old, NULL);
+        if(!ok){ close(ls); unlink(path); return 1; }
+    }
+
+    while(!g_stop){
+        int fd=accept(ls, NULL, NULL);
+        if(fd<0){ if(errno==EINTR || errno==ECONNABORTED) continue; perror("accept"); break; }
+        // client threads inherit a mask without the stop signals, so they land here
+        pthread_sigmask(SIG_BLOCK, &stop, &old);
+        pthread_t th;
+        if(pthread_create(&th, NULL, server_client, (void*)(intptr_t)fd)==0) pthread_detach(th); else close(fd);
+        pthread_sigmask(SIG_SETMASK, &old, NULL);
+    }
+    close(ls); unlink(path);
+    pthread_rwlock_wrlock(&g_dbLock);
+    compact_all();
+    puts("Server stopped.");
+    return 0;
+}
+
+// --------------------- Load generator ---------------------
+/* --loadgen [socket] [clients] [requests] [write%]: each client thread opens
+ * its own connection and sends a random mix of reads (patient.get,
+ * billing.balance, billing.invoices) and writes (patient.add, invoice.add,
+ * med.sell of one unit when the server has medicines) against the ids the server reports, timing every round trip. Prints
+ * throughput and latency percentiles across all clients.
+ */
+typedef struct {
+    const char   *path;
+    int           requests, writePct, maxPatientId, maxMedId;
+    unsigned long long rng;
+    double       *lat;      // seconds per request
+    int           done, errors;
+} LoadClient;
+
+static unsigned lg_rand(LoadClient *c){   // xorshift64*
+    c->rng^=c->rng>>12; c->rng^=c->rng<<25; c->rng^=c->rng>>27;
+    return (unsigned)((c->rng*2685821657736338717ULL)>>32);
+}
+
+static int lg_connect(const char *path){
+    int fd=socket(AF_UNIX, SOCK_STREAM, 0); if(fd<0) return -1;
+    struct sockaddr_un addr; memset(&addr, 0, sizeof addr);
+    addr.sun_family=AF_UNIX; strncpy(addr.sun_path, path, sizeof addr.sun_path-1);
+    if(connect(fd, (struct sockaddr*)&addr, sizeof addr)<0){ close(fd); return -1; }
+    return fd;
+}
+
+// Sends one request and reads its reply; returns the row count, -1 on ERR, -2 if the connection failed.
+static int lg_call(int fd, FILE *in, const char *req, char *line, size_t cap){
+    if(write_all(fd, req, strlen(req))<0 || !fgets(line, (int)cap, in)) return -2;
+    if(strncmp(line, "OK ", 3)) return -1;
+    int rows=atoi(line+3);
+    for(int i=0;i<rows;i++) if(!fgets(line, (int)cap, in)) return -2;
+    return rows;
+}
+
+static void* lg_client(void *arg){
+    LoadClient *c=(LoadClient*)arg;
+    int fd=lg_connect(c->path); if(fd<0){ perror(c->path); return NULL; }
+    FILE *in=fdopen(fd, "r");
+    char req[256], line[CMD_LINE_MAX];
+    for(int i=0;i<c->requests;i++){
+        int pid=1+(int)(lg_rand(c)%(unsigned)c->maxPatientId), kind=(int)(lg_rand(c)%4);
+        if((int)(lg_rand(c)%100)<c->writePct){
+            if(kind<2) snprintf(req, sizeof req, "patient.add|Load Gen %u|%u|F|555-0100|1 Bench Road\n", lg_rand(c)%100000, lg_rand(c)%90);
+            else if(kind==3 && c->maxMedId) snprintf(req, sizeof req, "med.sell|%d|%u|1\n", pid, 1+lg_rand(c)%(unsigned)c->maxMedId);
+            else snprintf(req, sizeof req, "invoice.add|%d|%u.%02u|load test\n", pid, lg_rand(c)%500, lg_rand(c)%100);
+        } else {
+            if(kind<2) snprintf(req, sizeof req, "patient.get|%d\n", pid);
+            else if(kind==2) snprintf(req, sizeof req, "billing.balance|%d\n", pid);
+            else snprintf(req, sizeof req, "billing.invoices|%d\n", pid);
+        }
+        double t0=now_sec();
+        int rc=lg_call(fd, in, req, line, sizeof line);
+        if(rc==-2){ fprintf(stderr, "connection lost\n"); break; }
+        c->lat[c->done++]=now_sec()-t0;
+        if(rc<0) c->errors++;   // e.g. a deleted id: still a served request
+    }
+    write_all(fd, "quit\n", 5);
+    fclose(in);
+    return NULL;
+}
+
+static int cmp_double(const void *a, const void *b){
+    double x=*(const double*)a, y=*(const double*)b; return (x>y)-(x<y);
+}
+
+static int loadgen(const char *path, int clients, int requests, int writePct){
+    if(clients<1) clients=1;
+    if(requests<1) requests=1;
+    int fd=lg_connect(path); if(fd<0){ perror(path); return 1; }
+    FILE *in=fdopen(fd, "r"); char line[CMD_LINE_MAX]; int maxPid=0, maxMid=0;
+    if(write_all(fd, "stats\n", 6)<0 || !fgets(line, sizeof line, in) || strncmp(line, "OK ", 3)){ fprintf(stderr, "%s: bad reply to stats\n", path); fclose(in); return 1; }
+    for(int i=0, n=atoi(line+3); i<n && fgets(line, sizeof line, in); i++)
+        if(!strncmp(line, "patients|", 9)) maxPid=atoi(strchr(line+9, '|')+1)-1;
+        else if(!strncmp(line, "medicines|", 10)) maxMid=atoi(strchr(line+10, '|')+1)-1;
+    write_all(fd, "quit\n", 5); fclose(in);
+    if(maxPid<1){ fprintf(stderr, "server has no patients to query\n"); return 1; }
+
+    LoadClient *cs=(LoadClient*)xcalloc((size_t)clients, sizeof *cs);
+    pthread_t *th=(pthread_t*)xcalloc((size_t)clients, sizeof *th);
+    double t0=now_sec();
+    for(int i=0;i<clients;i++){
+        cs[i].path=path; cs[i].requests=requests; cs[i].writePct=writePct; cs[i].maxPatientId=maxPid; cs[i].maxMedId=maxMid;
+        cs[i].rng=0x9E3779B97F4A7C15ULL*(unsigned long long)(i+1);
+        cs[i].lat=(double*)xcalloc((size_t)requests, sizeof(double));
+        pthread_create(&th[i], NULL, lg_client, &cs[i]);
+    }
+    for(int i=0;i<clients;i++) pthread_join(th[i], NULL);
+    double secs=now_sec()-t0;
+
+    long total=0, errors=0;
+    for(int i=0;i<clients;i++){ total+=cs[i].done; errors+=cs[i].errors; }
+    double *all=(double*)xcalloc(total ? (size_t)total : 1, sizeof(double));
+    for(int i=0, k=0;i<clients;i++){ memcpy(all+k, cs[i].lat, (size_t)cs[i].done*sizeof(double)); k+=cs[i].done; free(cs[i].lat); }
+    qsort(all, (size_t)total, sizeof(double), cmp_double);
+    printf("%d clients x %d requests, %d%% writes: %ld done (%ld ERR replies) in %.3f s, %.0f req/s\n",
+           clients, requests, writePct, total, errors, secs, total/secs);
+    if(total)
+        printf("latency us: p50 %.1f  p90 %.1f  p99 %.1f  max %.1f\n",
+               all[total/2]*1e6, all[(long)(total*0.90)]*1e6, all[(long)(total*0.99)]*1e6, all[total-1]*1e6);
+    free(all); free(cs); free(th);
+    return total ? 0 : 1;
+}
+
+/* --call <socket> <command>...: sends each command over one connection and
+ * prints the replies as the server wrote them, for scripts. Exits 1 if any
+ * reply was ERR or the connection failed.
+ */
+static int call_cli(const char *path, int argc, char **argv){
+    int fd=lg_connect(path); if(fd<0){ perror(path); return 1; }
+    FILE *in=fdopen(fd, "r"); char line[CMD_LINE_MAX]; int rc=0;
+    for(int i=0;i<argc;i++){
+        if(write_all(fd, argv[i], strlen(argv[i]))<0 || write_all(fd, "\n", 1)<0 || !fgets(line, sizeof line, in)){
+            fprintf(stderr, "%s: connection lost\n", path); rc=1; break;
+        }
+        fputs(line, stdout);
+        if(strncmp(line, "OK ", 3)){ rc=1; continue; }
+        int rows=atoi(line+3), k=0;
+        for(;k<rows && fgets(line, sizeof line, in);k++) fputs(line, stdout);
+        if(k<rows){ fprintf(stderr, "%s: connection lost\n", path); rc=1; break; }
+    }
+    write_all(fd, "quit\n", 5); fclose(in);
+    return rc;
+}
+#endif
+
+// --------------------- Replication ---------------------
+/* Warm standby. A server streams its change feed (see Journal) to any
+ * connection that sends
+ *     cdc|<seq>
+ * instead of a command: every record after <seq>, in seq order, once group
+ * commit has made it durable. Each wakeup sends
+ *     HB <seq> <ns>          the newest seq it could send, and its wall clock
+ *     REC <seq> <n> <ns>     per record, then its n "<journal>|op|row" lines
+ * and a quiet feed repeats the HB line every CDC_HEARTBEAT_S seconds. <ns> on
+ * REC is the leader's wall clock at append. When the ring no longer reaches
+ * back to <seq>, <seq> is ahead of the leader (which lost an unsynced tail)
+ * or <seq> is 0, the feed first sends the whole dataset, taken under the
+ * exclusive lock, and carries on from there:
+ *     SNAP <seq> <rows>      then rows "<journal>|I|row" lines
+ *
+ * --follow <leader socket> [socket] loads its own copy from the current
+ * directory, subscribes from the seq it holds and applies the feed through
+ * the journal replay functions, journaling every record locally under the
+ * leader's seq. A restarted standby therefore catches up from its snapshot
+ * plus journal offset, and one restarted with --serve takes over as leader.
+ * It serves reads on its own socket, refuses writes, reconnects when the
+ * leader goes away and reports how far behind it is through cdc.status and
+ * the cdc.* probes. The lag assumes both clocks agree, as on one host.
+ */
+#ifndef _WIN32
+#define CDC_BATCH        4096   // records copied out of the ring per wakeup
+#define CDC_HEARTBEAT_S     1
+#define CDC_RETRY_S         1   // wait before reconnecting to the leader
+#define CDC_LINE         JNL_LINE
+
+static void cdc_start(){
+    g_cdcRing=(CdcRec*)xcalloc(CDC_RING, sizeof *g_cdcRing);
+    g_cdcBase=g_seq;
+}
+
+static void cdc_put(Reply *b, const char *s, size_t n){
+    if(b->len+n+1>b->cap){
+        while(b->len+n+1>b->cap) b->cap = b->cap ? b->cap*2 : 4096;
+        b->buf=(char*)xrealloc(b->buf, b->cap);
+    }
+    memcpy(b->buf+b->len, s, n); b->len+=n; b->buf[b->len]='\0';
+}
+
+// Sends the whole dataset once it is durable; returns its seq, or -1 if the standby went away.
+static long long cdc_snapshot(int fd){
+    long long t0=probe_start();
+    Reply body={NULL, 0, 0, 0}; char row[CDC_LINE]; long rows=0;
+    pthread_rwlock_wrlock(&g_dbLock);
+    long long seq=jnl_last_seq();
+    for(int t=0;t<NTABLES;t++){
+        const TableDef *d=&g_tables[t];
+        int pre=snprintf(row, sizeof row, "%s|I|", d->jnl->jnl);
+        for(int i=0;i<d->tbl->count;i++){
+            if(!tbl_alive(d->tbl, i)) continue;
+            int n=pre+d->fmt(row+pre, sizeof row-pre-1, tbl_at(d->tbl, i));
+            if(n>(int)sizeof row-2) n=(int)sizeof row-2;
+            row[n++]='\n'; cdc_put(&body, row, (size_t)n); rows++;
+        }
+    }
+    pthread_rwlock_unlock(&g_dbLock);
+    if(!jnl_wait_durable(seq)){ free(body.buf); return -1; }   // the standby reconnects and asks again
+    char head[64]; int n=snprintf(head, sizeof head, "SNAP %lld %ld\n", seq, rows);
+    int ok = write_all(fd, head, (size_t)n)==0 && (!body.len || write_all(fd, body.buf, body.len)==0);
+    free(body.buf);
+    probe_end(PROBE_CDC_SNAPSHOT, t0, (long long)body.len);
+    return ok ? seq : -1;
+}
+
+// Streams the feed after seq `from` to fd until the standby hangs up.
+static void cdc_feed(int fd, long long from){
+    if(!g_cdcRing){ write_all(fd, "ERR Not a leader.\n", 18); return; }
+    int slot=-1;
+    SYNC_LOCK();
+    for(int k=0;k<CDC_MAX_FEEDS && slot<0;k++) if(!g_cdcFeeds[k].used){ slot=k; g_cdcFeeds[k].used=1; g_cdcFeeds[k].sent=from; }
+    SYNC_UNLOCK();
+    if(slot<0){ write_all(fd, "ERR Too many standbys.\n", 23); return; }
+    Reply b={NULL, 0, 0, 0}; char head[80];
+    long long sent=from;
+    int fresh = from<=0;   // seq 0 says nothing about snapshots made without a journal (--gen, --to-bin)
+    SYNC_LOCK(); int resync=g_cdcResync; SYNC_UNLOCK();
+    for(int ok=1; ok; ){
+        SYNC_LOCK();
+        g_cdcFeeds[slot].sent=sent;
+        if(fresh || resync!=g_cdcResync || sent<g_cdcBase || sent>g_seq){
+            resync=g_cdcResync;
+            SYNC_UNLOCK();
+            sent=cdc_snapshot(fd); ok = sent>=0; fresh=0;
+            continue;
+        }
+        struct timespec until; clock_gettime(CLOCK_REALTIME, &until); until.tv_sec+=CDC_HEARTBEAT_S;
+        int quiet=0;
+        while(cdc_ready_locked()<=sent && !quiet) quiet = pthread_cond_timedwait(&g_syncDone, &g_syncMu, &until)!=0;
+        if(sent<g_cdcBase || resync!=g_cdcResync){ SYNC_UNLOCK(); continue; }   // fell out of the ring, or behind a change it lacks, while waiting
+        long long ready=cdc_ready_locked(), last = ready-sent>CDC_BATCH ? sent+CDC_BATCH : ready;
+        b.len=0;
+        int n=snprintf(head, sizeof head, "HB %lld %lld\n", ready, wall_ns()); cdc_put(&b, head, (size_t)n);
+        for(long long q=sent+1;q<=last;q++){
+            const CdcRec *r=&g_cdcRing[q&(CDC_RING-1)];
+            n=snprintf(head, sizeof head, "REC %lld %d %lld\n", r->seq, r->parts, r->ns);
+            cdc_put(&b, head, (size_t)n); cdc_put(&b, r->text, strlen(r->text));
+        }
+        SYNC_UNLOCK();
+        if(last>sent) sent=last;
+        ok = write_all(fd, b.buf, b.len)==0;
+    }
+    SYNC_LOCK(); g_cdcFeeds[slot].used=0; SYNC_UNLOCK();
+    free(b.buf);
+}
+
+// Splits a "<journal>|op|row" line in place.
+static int follow_split(char *line, const TableDef **d, char *op, const char **row){
+    char *bar=strchr(line, '|'); if(!bar || !bar[1] || bar[2]!='|') return 0;
+    *bar='\0'; *d=table_of_jnl(line); *op=bar[1]; *row=bar+3;
+    return *d!=NULL;
+}
+
+// Applies one part, keeping up the indexes that load_all would otherwise rebuild.
+static void follow_apply_part(const TableDef *d, char op, const char *row){
+    Appointment *a = d->tbl==&g_appts ? find_appt_by_id(atoi(row)) : NULL;
+    const Patient *p = d->tbl==&g_patients ? find_patient_by_id(atoi(row)) : NULL;
+    Patient before; if(p) before=*p;
+    int lot = d->tbl==&g_lots ? idx_get(&g_lotIdx, atoi(row)) : -1, lotQty = lot>=0 ? lot_at(lot)->qty : 0;
+    if(a && !a->canceled && op!='D') slot_unindex_appt(a);   // remove_appt_at unindexes a delete
+    if(d->apply(op, row)<0) d->jnl->malformed++;
+    if(d->tbl==&g_appts && (a=find_appt_by_id(atoi(row)))!=NULL) slot_index_appt(a);
+    if(d->tbl==&g_patients) ward_sync(p ? &before : NULL, find_patient_by_id(atoi(row)));
+    if(d->tbl==&g_lots && (lot=idx_get(&g_lotIdx, atoi(row)))>=0) stock_lot_changed(lot, lotQty);
+    if(d->tbl==&g_meds){ const Medicine *m=find_med_by_id(atoi(row)); if(m) stock_requeue(stock_slot(m->id, 1), m); }
+}
+
+// Journals record seq under the leader's seq, then applies it; older seqs are skipped.
+static void follow_record(long long seq, long long ns, int n, char lines[][CDC_LINE]){
+    const TableDef **d=(const TableDef**)xcalloc((size_t)n, sizeof *d);
+    TxnPart *parts=(TxnPart*)xcalloc((size_t)n, sizeof *parts);
+    for(int k=0;k<n;k++){
+        if(!follow_split(lines[k], &d[k], &parts[k].op, &parts[k].row)){
+            fprintf(stderr, "cdc: unreadable record %lld skipped\n", seq);
+            free(d); free(parts); return;
+        }
+        parts[k].j=d[k]->jnl;
+    }
+    long long t0=probe_start();
+    pthread_rwlock_wrlock(&g_dbLock);
+    if(seq>g_seq){
+        SYNC_LOCK(); g_seq=seq-1; SYNC_UNLOCK();
+        int due;
+        if(n==1) due=jnl_append(parts[0].j, parts[0].op, parts[0].row, tbl_live(d[0]->tbl));
+        else if(!jnl_append_txn(parts, n, tbl_live(d[0]->tbl), &due)) due=0;
+        int kept = jnl_last_seq()==seq;   // else it could not be journaled here, and the saves below keep it
+        for(int k=0;k<n;k++) follow_apply_part(d[k], parts[k].op, parts[k].row);
+        if(!kept){
+            SYNC_LOCK(); g_seq=seq; SYNC_UNLOCK();
+            for(int k=0;k<n;k++) d[k]->save();
+        }
+        else if(due){ if(n==1) d[0]->save(); else txn_compact(); }
+        str_maybe_gc();
+        g_follow.applied++; g_follow.lastNs=ns;
+    }
+    pthread_rwlock_unlock(&g_dbLock);
+    free(d); free(parts);
+    probe_end(PROBE_CDC_APPLY, t0, 0);
+    long long t1=probe_start(), lag=wall_ns()-ns;
+    if(t1) probe_end(PROBE_CDC_LAG, t1-(lag>0 ? lag : 0), 0);
+}
+
+// Replaces every table with a SNAP body and saves it, so the local files start at seq.
+static void follow_install(long long seq, char *rows){
+    long long t0=probe_start();
+    pthread_rwlock_wrlock(&g_dbLock);
+    for(int t=0;t<NTABLES;t++){ const TableDef *d=&g_tables[t]; tbl_clear(d->tbl); idx_clear(d->idx); *d->nextId=1; }
+    for(char *line=rows, *nl; *line; line=nl+1){
+        nl=strchr(line, '\n'); if(!nl) break;
+        *nl='\0';
+        const TableDef *d; char op; const char *row;
+        if(follow_split(line, &d, &op, &row) && d->apply(op, row)<0) d->jnl->malformed++;
+    }
+    rebuild_indexes();
+    SYNC_LOCK(); g_seq=g_appendedSeq=g_durableSeq=seq; SYNC_UNLOCK();
+    for(int t=0;t<NTABLES;t++){ g_tables[t].save(); g_tables[t].jnl->txnSeq=0; }
+    jnl_truncate(&g_txnJnl);
+    str_gc();
+    g_follow.snapshots++;
+    pthread_rwlock_unlock(&g_dbLock);
+    probe_end(PROBE_CDC_SNAPSHOT, t0, 0);
+}
+
+static void* follow_thread(void *unused){
+    (void)unused;
+    char line[CDC_LINE], (*parts)[CDC_LINE]=NULL; int cap=0;
+    Reply snap={NULL, 0, 0, 0};
+    for(int was=0;;was=1){
+        int fd=lg_connect(g_follow.leader);
+        FILE *in = fd>=0 ? fdopen(fd, "r") : NULL;
+        char req[48]; int n=snprintf(req, sizeof req, "cdc|%lld\n", jnl_last_seq());
+        if(in && write_all(fd, req, (size_t)n)==0){
+            if(was) __atomic_add_fetch(&g_follow.reconnects, 1, __ATOMIC_RELAXED);
+            __atomic_store_n(&g_follow.connected, 1, __ATOMIC_RELAXED);
+            while(fgets(line, sizeof line, in)){
+                long long seq, ns; long rows; int k=0;
+                if(sscanf(line, "HB %lld %lld", &seq, &ns)==2) __atomic_store_n(&g_follow.leaderSeq, seq, __ATOMIC_RELAXED);
+                else if(sscanf(line, "REC %lld %d %lld", &seq, &k, &ns)==3 && k>=1){
+                    int i=0;
+                    for(;i<k;i++){
+                        if(i==cap){ cap = cap ? cap*2 : 16; parts=(char(*)[CDC_LINE])xrealloc(parts, (size_t)cap*CDC_LINE); }
+                        if(!fgets(parts[i], CDC_LINE, in)) break;
+                        parts[i][strcspn(parts[i], "\n")]='\0';
+                    }
+                    if(i<k) break;
+                    follow_record(seq, ns, k, parts);
+                } else if(sscanf(line, "SNAP %lld %ld", &seq, &rows)==2){
+                    long i=0; snap.len=0;
+                    for(;i<rows && fgets(line, sizeof line, in);i++) cdc_put(&snap, line, strlen(line));
+                    if(i<rows) break;
+                    cdc_put(&snap, "", 0);
+                    follow_install(seq, snap.buf ? snap.buf : line);
+                    __atomic_store_n(&g_follow.leaderSeq, seq, __ATOMIC_RELAXED);
+                } else { fprintf(stderr, "%s: %s", g_follow.leader, line); break; }
+            }
+            __atomic_store_n(&g_follow.connected, 0, __ATOMIC_RELAXED);
+        }
+        if(in) fclose(in); else if(fd>=0) close(fd);
+        sleep(CDC_RETRY_S);
+    }
+    return NULL;
+}
+
+static int follow_start(const char *leader){
+    g_follow.leader=leader;
+    pthread_t th;
+    if(pthread_create(&th, NULL, follow_thread, NULL)!=0){ perror("pthread_create"); return 0; }
+    pthread_detach(th);
+    return 1;
+}
+#endif
+
+// --------------------- Main ---------------------
+// --to-bin / --to-text: rewrites every snapshot in one format. load_all reads
+// whichever snapshot is newer, so this works in both directions.
+static int convert_storage(int binary){
+    load_all();
+    g_binaryStore=binary;
+    save_patients(); save_doctors(); save_appts(); save_meds(); save_invoices(); save_lots();
+    printf("Wrote %s snapshots: %d patients, %d doctors, %d appointments, %d medicines, %d invoices, %d lots.\n",
+           binary ? "binary" : "text", tbl_live(&g_patients), tbl_live(&g_doctors),
+           tbl_live(&g_appts), tbl_live(&g_meds), tbl_live(&g_invoices), tbl_live(&g_lots));
+    return 0;
+}
+
+// --export <table> <csv|json> <file|-> [filters]: streams one table to a file and exits.
+static int export_cli(int argc, char **argv){
+    if(argc<3) return 2;
+    int kind=parse_list_kind(argv[0]), format;
+    if(!strcmp(argv[1], "csv")) format=EXPORT_CSV; else if(!strcmp(argv[1], "json")) format=EXPORT_JSON; else return 2;
+    if(kind<0) return 2;
+    ListFilter f; filter_all(&f);
+    for(int i=3;i<argc;i++){
+        const char *opt=argv[i], *v = i+1<argc ? argv[++i] : "";
+        if(!strcmp(opt, "--from") || !strcmp(opt, "--to")){
+            int *d = opt[2]=='f' ? &f.lo : &f.hi;
+            if(!parse_date(v, d)){ fprintf(stderr, "Invalid date %s. Use YYYY-MM-DD.\n", v); return 2; }
+        }
+        else if(!strcmp(opt, "--doctor")) f.doctorId=atoi(v);
+        else if(!strcmp(opt, "--patient")) f.patientId=atoi(v);
+        else if(!strcmp(opt, "--canceled")) f.canceled = (*v=='y' || *v=='Y' || *v=='1');
+        else return 2;
+    }
+    load_all();
+    double t0=now_sec(); long n=export_rows(kind, format, &f, argv[2]);
+    if(n<0){ fprintf(stderr, "Could not write %s.\n", argv[2]); return 1; }
+    fprintf(stderr, "Exported %ld %s in %.1f ms.\n", n, argv[0], (now_sec()-t0)*1e3);
+    return 0;
+}
+
+static void usage(const char *prog){
+    printf("Usage: %s [--binary] [--to-bin | --to-text | --batch [file] | --serve [socket] | --gen [rows] | --bench [rows] [file]\n"
+           "          | --bench-parse [rows] | --bench-report [rows]]\n"
+           "       %s --follow <leader socket> [socket]\n"
+           "       %s --loadgen [socket] [clients] [requests] [write%%]\n"
+           "       %s --call <socket> <command>...\n"
+           "       %s --export patients|appointments|invoices csv|json file|- [--from YYYY-MM-DD] [--to YYYY-MM-DD]\n"
+           "                   [--doctor id] [--patient id] [--canceled y|n]\n"
+           "  --binary   compact tables into binary .bin snapshots instead of text .db\n"
+           "  --batch [file]  apply commands from file (default stdin), save once, and exit\n"
+           "  --serve [socket]  serve the command protocol on a Unix socket (default hms.sock)\n"
+           "  --follow   serve a read-only standby that streams every change from the leader's socket\n"
+           "  --loadgen  drive a running server and report throughput and latency (default 8 100000 10)\n"
+           "  --call     send commands (e.g. \"cdc.status\") to a running server and print the replies\n"
+           "  --to-bin   convert all snapshots to binary and exit\n"
+           "  --to-text  convert all snapshots to pipe-delimited text and exit\n"
+           "  --gen [rows]  write a synthetic dataset of rows appointments and invoices (10^3..10^7, default 100000)\n"
+           "               into the current directory, which must hold no snapshots\n"
+           "  --bench [rows] [file]  run the benchmark suite on the snapshots here (generating rows of them if\n"
+           "               there are none) and append name|rows|ops|total_ms|ns_per_op lines to file or stdout\n"
+           "  --bench-parse [rows]  time sscanf vs. the row parser on generated files (default 1000000)\n"
+           "  --bench-report [rows]  time the billing reports on generated invoices, rows vs. columns (default 1000000)\n"
+           "Environment: HMS_THREADS (worker threads), HMS_SYNC_MS (journal fsync window in ms,\n"
+           "  default %d; 0 = fsync every change, negative = never), HMS_STATS=1 (start with instrumentation on),\n"
+           "  HMS_REFS (delete rules, e.g. appointments.patient=cascade,invoices.patient=restrict; default soft),\n"
+           "  HMS_WARDS (rooms per ward from ward 1, e.g. 30,30,12; default %d wards of %d; room n of ward w is w*%d+n)\n"
+           "Signals: SIGUSR1 prints the instrumentation probes to stderr, SIGUSR2 turns them on or off\n", prog, prog, prog, prog, prog, JNL_SYNC_MS_DEFAULT,
+           WARDS_DEFAULT, WARD_ROOMS_DEFAULT, ROOM_STRIDE);
+}
+
+int main(int argc, char **argv){
+    cmd_probes_start();
+    for(int i=1;i<argc;i++){
+        if(!strcmp(argv[i],"--binary")) g_binaryStore=1;
+        else if(!strcmp(argv[i],"--to-bin")) return convert_storage(1);
+        else if(!strcmp(argv[i],"--to-text")) return convert_storage(0);
+        else if(!strcmp(argv[i],"--batch")) return batch_run(i+1<argc ? argv[i+1] : NULL);
+#ifndef _WIN32
+        else if(!strcmp(argv[i],"--serve")) return serve(i+1<argc ? argv[i+1] : SERVER_SOCKET, NULL);
+        else if(!strcmp(argv[i],"--follow")){
+            if(i+1>=argc){ usage(argv[0]); return 2; }
+            return serve(i+2<argc ? argv[i+2] : SERVER_SOCKET, argv[i+1]);
+        }
+        else if(!strcmp(argv[i],"--loadgen"))
+            return loadgen(i+1<argc ? argv[i+1] : SERVER_SOCKET, i+2<argc ? atoi(argv[i+2]) : 8,
+                           i+3<argc ? atoi(argv[i+3]) : 100000, i+4<argc ? atoi(argv[i+4]) : 10);
+        else if(!strcmp(argv[i],"--call")){
+            if(i+2>=argc){ usage(argv[0]); return 2; }
+            return call_cli(argv[i+1], argc-i-2, argv+i+2);
+        }
+#endif
+        else if(!strcmp(argv[i],"--export")){
+            int rc=export_cli(argc-i-1, argv+i+1);
+            if(rc==2) usage(argv[0]);
+            return rc;
+        }
+        else if(!strcmp(argv[i],"--gen")) return gen_main(i+1<argc ? atol(argv[i+1]) : 100000);
+        else if(!strcmp(argv[i],"--bench")) return bench_suite(i+1<argc ? atol(argv[i+1]) : 100000, i+2<argc ? argv[i+2] : NULL);
+        else if(!strcmp(argv[i],"--bench-parse")) return bench_parse(i+1<argc ? atol(argv[i+1]) : 1000000);
+        else if(!strcmp(argv[i],"--bench-report")) return bench_report(i+1<argc ? atol(argv[i+1]) : 1000000);
+        else { usage(argv[0]); return 2; }
+    }
+    load_all();
+    puts("\n=== Hospital Management System (C) ===");
+    for(;;){
+        puts("\nMain Menu\n 1) Patients\n 2) Doctors\n 3) Appointments\n 4) Pharmacy\n 5) Billing\n 6) Reports\n 7) Wards\n 8) Instrumentation\n 9) About\n 0) Exit");
+        int ch=input_int("Choose: ");
+        switch(ch){
+            case 1: patients_menu(); break;
+            case 2: doctors_menu(); break;
+            case 3: appts_menu(); break;
+            case 4: pharmacy_menu(); break;
+            case 5: billing_menu(); break;
+            case 6: reports_menu(); break;
+            case 7: wards_menu(); break;
+            case 8: probes_menu(); break;
+            case 9: puts("Simple text-file HMS. Extend as you like. Developed as a learning project."); press_enter(); break;
+            case 0: compact_all(); puts("Goodbye!"); return 0;
+            default: puts("Invalid choice.");
+        }
+    }
+}
@@ -0,0 +1,158 @@
+#!/bin/sh
+# Two-process replication check: a leader (--serve) and a standby (--follow)
+# on Unix sockets, driven by --loadgen and compared through --call.
+#
+#   tests/replication.sh <hms binary> <scratch directory>
+#
+# Phases:
+#   1. a standby starting from an empty directory takes the leader's snapshot
+#      and follows a live load;
+#   2. a standby stopped and restarted within the ring catches up from its own
+#      snapshot plus journal offset, without a new snapshot;
+#   3. a standby that misses more than the ring holds (65536 records) resyncs
+#      from a fresh snapshot.
+# After each phase the standby's seq must reach the leader's, its lag must go
+# back to 0 and every table must read the same on both sides.
+set -eu
+
+HMS=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+WORK=$2
+RING=65536
+
+rm -rf "$WORK"
+mkdir -p "$WORK/leader" "$WORK/standby"
+WORK=$(cd "$WORK" && pwd)
+LSOCK=$WORK/leader.sock
+SSOCK=$WORK/standby.sock
+LEADER=
+STANDBY=
+
+stop(){   # stop <pid>: SIGTERM compacts the journals before the server exits
+    [ -n "$1" ] || return 0
+    kill "$1" 2>/dev/null || true
+    wait "$1" 2>/dev/null || true
+}
+cleanup(){ stop "$STANDBY"; stop "$LEADER"; }
+trap cleanup EXIT
+trap 'exit 1' INT TERM
+
+fail(){ echo "FAIL: $*" >&2; exit 1; }
+
+# field <socket> <row prefix> <n>: the n-th |-field of the cdc.status row
+field(){
+    "$HMS" --call "$1" cdc.status | sed -n "s/^$2|//p" | cut -d'|' -f"$3"
+}
+
+wait_up(){   # wait_up <socket>
+    i=0
+    until "$HMS" --call "$1" ping >/dev/null 2>&1; do
+        i=$((i+1)); [ $i -lt 100 ] || fail "$1 did not come up"
+        sleep 0.1
+    done
+}
+
+start_leader(){
+    (cd "$WORK/leader" && exec "$HMS" --serve "$LSOCK" >"$WORK/leader.log" 2>&1) &
+    LEADER=$!
+    wait_up "$LSOCK"
+}
+
+start_standby(){
+    (cd "$WORK/standby" && exec "$HMS" --follow "$LSOCK" "$SSOCK" >>"$WORK/standby.log" 2>&1) &
+    STANDBY=$!
+    wait_up "$SSOCK"
+}
+
+# Waits until the standby has applied everything the leader has sent.
+wait_synced(){
+    i=0
+    while :; do
+        last=$(field "$LSOCK" seq 1); applied=$(field "$SSOCK" seq 1)
+        [ "$applied" = "$last" ] && [ "$(field "$SSOCK" lag 1)" = 0 ] && break
+        i=$((i+1)); [ $i -lt 600 ] || fail "standby stuck at seq $applied, leader at $last"
+        sleep 0.1
+    done
+    echo "  synced at seq $last: $("$HMS" --call "$SSOCK" cdc.status | grep -E '^(lag|stream)\|' | tr '\n' ' ')"
+}
+
+# Pages through one list command: dump_list <socket> <command> <filter fields>
+dump_list(){
+    off=0
+    while :; do
+        page=$("$HMS" --call "$1" "$2|$3$off|10000" | tail -n +2)
+        [ -n "$page" ] || break
+        printf '%s\n' "$page"
+        off=$((off+10000))
+    done
+}
+
+# Every table as the server reads it, in a form that does not depend on slot order.
+dump(){
+    {
+        "$HMS" --call "$1" stats | grep -v '^strings|'
+        "$HMS" --call "$1" report.stock report.revenue report.patients report.appts ward.list med.low "med.expiring|9999-12-31"
+        dump_list "$1" patient.list ""
+        dump_list "$1" appt.list "|||||"
+        dump_list "$1" invoice.list "|||"
+    } | sort
+}
+
+compare(){
+    dump "$LSOCK" >"$WORK/leader.dump"
+    dump "$SSOCK" >"$WORK/standby.dump"
+    diff "$WORK/leader.dump" "$WORK/standby.dump" >"$WORK/diff" ||
+        fail "$1: standby differs from leader (see $WORK/diff)"
+    echo "  $1: $(wc -l <"$WORK/leader.dump") rows match"
+}
+
+load(){   # load <clients> <requests> <write%>
+    "$HMS" --loadgen "$LSOCK" "$@" | sed 's/^/  /'
+}
+
+# Runs a load while sampling the standby's lag, and prints the worst seen.
+load_sampled(){
+    load "$@" &
+    pid=$!; most=0; mostMs=0; samples=0
+    while kill -0 $pid 2>/dev/null; do
+        lag=$("$HMS" --call "$SSOCK" cdc.status | sed -n 's/^lag|//p')
+        [ -n "$lag" ] || fail "standby stopped answering under load"
+        n=${lag%%|*}; ms=${lag#*|}; samples=$((samples+1))
+        [ "$n" -le "$most" ] || most=$n
+        [ "$ms" -le "$mostMs" ] || mostMs=$ms
+        sleep 0.05
+    done
+    wait $pid
+    echo "  lag under load: at most $most records, $mostMs ms over $samples samples"
+}
+
+(cd "$WORK/leader" && "$HMS" --gen 1000 >/dev/null)
+start_leader
+
+echo "phase 1: fresh standby, snapshot then live stream"
+start_standby
+load_sampled 4 2000 50
+wait_synced
+[ "$(field "$SSOCK" stream 2)" = 1 ] || fail "phase 1: expected one snapshot"
+compare "phase 1"
+
+echo "phase 2: restart within the ring, catch up from snapshot + offset"
+stop "$STANDBY"; STANDBY=
+load 4 1000 50
+start_standby
+wait_synced
+[ "$(field "$SSOCK" stream 2)" = 0 ] || fail "phase 2: standby resent a snapshot instead of its offset"
+compare "phase 2"
+
+echo "phase 3: miss more than the ring ($RING records), resync from a snapshot"
+stop "$STANDBY"; STANDBY=
+before=$(field "$LSOCK" seq 1)
+load 4 $((RING/4+1000)) 100
+missed=$(( $(field "$LSOCK" seq 1) - before ))
+[ "$missed" -gt "$RING" ] || fail "phase 3: only $missed records written"
+[ "$(field "$LSOCK" ring 1)" -gt "$before" ] || fail "phase 3: ring still reaches seq $before"
+start_standby
+wait_synced
+[ "$(field "$SSOCK" stream 2)" = 1 ] || fail "phase 3: expected a resync snapshot after missing $missed records"
+compare "phase 3"
+
+echo "PASS"